@@ -112,6 +112,9 @@ LOCAL_C_INCLUDES := \
 		deps/sqlite/
 
 LOCAL_SRC_FILES := \
+		jni/src/abmscanner.cpp                    \
+		jni/src/activeobjectidallocator.cpp       \
+		jni/src/activeobjectindex.cpp             \
 		jni/src/ban.cpp                           \
 		jni/src/camera.cpp                        \
 		jni/src/cavegen.cpp                       \
@@ -132,6 +135,8 @@ LOCAL_SRC_FILES := \
 		jni/src/content_sao.cpp                   \
 		jni/src/convert_json.cpp                  \
 		jni/src/craftdef.cpp                      \
+		jni/src/database-blocklog.cpp             \
+		jni/src/database-cache.cpp                \
 		jni/src/database-dummy.cpp                \
 		jni/src/database-sqlite3.cpp              \
 		jni/src/database.cpp                      \
@@ -172,6 +177,8 @@ LOCAL_SRC_FILES := \
 		jni/src/map_settings_manager.cpp          \
 		jni/src/mapblock.cpp                      \
 		jni/src/mapblock_mesh.cpp                 \
+		jni/src/mapblockindex.cpp                 \
+		jni/src/mapblocklru.cpp                   \
 		jni/src/mapgen.cpp                        \
 		jni/src/mapgen_flat.cpp                   \
 		jni/src/mapgen_fractal.cpp                \
@@ -180,7 +187,9 @@ LOCAL_SRC_FILES := \
 		jni/src/mapgen_v6.cpp                     \
 		jni/src/mapgen_v7.cpp                     \
 		jni/src/mapgen_valleys.cpp                \
+		jni/src/mapmigrator.cpp                   \
 		jni/src/mapnode.cpp                       \
+		jni/src/mapsaver.cpp                      \
 		jni/src/mapsector.cpp                     \
 		jni/src/mesh.cpp                          \
 		jni/src/mg_biome.cpp                      \
@@ -196,6 +205,7 @@ LOCAL_SRC_FILES := \
 		jni/src/noise.cpp                         \
 		jni/src/objdef.cpp                        \
 		jni/src/object_properties.cpp             \
+		jni/src/objectposition.cpp                \
 		jni/src/particles.cpp                     \
 		jni/src/pathfinder.cpp                    \
 		jni/src/player.cpp                        \
@@ -228,6 +238,7 @@ LOCAL_SRC_FILES := \
 		jni/src/util/base64.cpp                   \
 		jni/src/util/directiontables.cpp          \
 		jni/src/util/enriched_string.cpp          \
+		jni/src/util/lz4.cpp                      \
 		jni/src/util/numeric.cpp                  \
 		jni/src/util/pointedthing.cpp             \
 		jni/src/util/serialize.cpp                \
@@ -236,17 +247,27 @@ LOCAL_SRC_FILES := \
 		jni/src/util/srp.cpp                      \
 		jni/src/util/timetaker.cpp                \
 		jni/src/unittest/test.cpp                 \
+		jni/src/unittest/test_abmscanner.cpp      \
+		jni/src/unittest/test_activeblocklist.cpp \
+		jni/src/unittest/test_activeobjectidallocator.cpp \
+		jni/src/unittest/test_activeobjectindex.cpp \
 		jni/src/unittest/test_collision.cpp       \
 		jni/src/unittest/test_compression.cpp     \
 		jni/src/unittest/test_connection.cpp      \
+		jni/src/unittest/test_database.cpp        \
 		jni/src/unittest/test_filepath.cpp        \
 		jni/src/unittest/test_inventory.cpp       \
 		jni/src/unittest/test_map_settings_manager.cpp \
+		jni/src/unittest/test_mapblock.cpp        \
+		jni/src/unittest/test_mapblockindex.cpp   \
+		jni/src/unittest/test_mapblocklru.cpp     \
 		jni/src/unittest/test_mapnode.cpp         \
+		jni/src/unittest/test_mapsaver.cpp        \
 		jni/src/unittest/test_nodedef.cpp         \
 		jni/src/unittest/test_noderesolver.cpp    \
 		jni/src/unittest/test_noise.cpp           \
 		jni/src/unittest/test_objdef.cpp          \
+		jni/src/unittest/test_objectposition.cpp  \
 		jni/src/unittest/test_profiler.cpp        \
 		jni/src/unittest/test_random.cpp          \
 		jni/src/unittest/test_schematic.cpp       \
@@ -0,0 +1,199 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "abmscanner.h"
+#include "mapblock.h"
+#include "noise.h" // PcgRandom
+#include "threading/thread.h"
+#include "threading/mutex_auto_lock.h"
+#include "log.h"
+#include "porting.h"
+
+/*
+	ABMScanJob
+*/
+
+MapNode ABMScanJob::getNode(v3s16 p_rel)
+{
+	v3s16 offset = getContainerPos(p_rel, MAP_BLOCKSIZE);
+	MapBlock *block = blocks[getNeighbourIndex(offset)];
+	if (block == NULL)
+		return MapNode(CONTENT_IGNORE);
+	return block->getNodeNoEx(p_rel - offset * MAP_BLOCKSIZE);
+}
+
+void ABMScanJob::scan(const ActiveABMMap &aabms)
+{
+	MapBlock *block = blocks[getNeighbourIndex(v3s16(0, 0, 0))];
+	PcgRandom rng(seed);
+
+	v3s16 p0;
+	for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+	for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+	for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++) {
+		content_t c = block->getNodeNoEx(p0).getContent();
+
+		ActiveABMMap::const_iterator j = aabms.find(c);
+		if (j == aabms.end())
+			continue;
+
+		for (std::vector<ActiveABM>::const_iterator
+				i = j->second.begin(); i != j->second.end(); ++i) {
+			if (rng.next() % i->chance != 0)
+				continue;
+
+			// Check neighbors
+			if (!i->required_neighbors.empty()) {
+				bool found = false;
+				v3s16 p1;
+				for (p1.X = p0.X - 1; p1.X <= p0.X + 1 && !found; p1.X++)
+				for (p1.Y = p0.Y - 1; p1.Y <= p0.Y + 1 && !found; p1.Y++)
+				for (p1.Z = p0.Z - 1; p1.Z <= p0.Z + 1 && !found; p1.Z++) {
+					if (p1 == p0)
+						continue;
+					found = i->required_neighbors.count(
+						getNode(p1).getContent()) != 0;
+				}
+				if (!found)
+					continue;
+			}
+
+			ABMCandidate candidate;
+			candidate.aabm = &(*i);
+			candidate.p0 = p0;
+			candidate.content = c;
+			candidates.push_back(candidate);
+		}
+	}
+}
+
+/*
+	ABMScanThread
+*/
+
+class ABMScanThread : public Thread
+{
+public:
+	ABMScanThread(ABMScanner *scanner) :
+		Thread("ABMScan"),
+		m_scanner(scanner)
+	{}
+
+	// Wakes the thread up to scan the pending jobs of the scanner
+	void startScan() { m_start.post(); }
+
+	void stop()
+	{
+		Thread::stop();
+		m_start.post();
+	}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			m_start.wait();
+			if (stopRequested())
+				break;
+
+			while (m_scanner->scanNextJob())
+				;
+			m_scanner->m_done.post();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	ABMScanner *m_scanner;
+	Semaphore m_start;
+};
+
+/*
+	ABMScanner
+*/
+
+ABMScanner::ABMScanner(u32 num_threads) :
+	m_aabms(NULL),
+	m_jobs(NULL),
+	m_next_job(0)
+{
+	// The calling thread is one of the scanning threads
+	for (u32 i = 1; i < num_threads; i++) {
+		ABMScanThread *thread = new ABMScanThread(this);
+		if (!thread->start()) {
+			errorstream << "ABMScanner: Failed to start scan thread"
+				<< std::endl;
+			delete thread;
+			break;
+		}
+		m_threads.push_back(thread);
+	}
+}
+
+ABMScanner::~ABMScanner()
+{
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i]->stop();
+		m_threads[i]->wait();
+		delete m_threads[i];
+	}
+}
+
+void ABMScanner::scan(const ActiveABMMap &aabms, std::vector<ABMScanJob> &jobs)
+{
+	if (jobs.empty())
+		return;
+
+	m_aabms = &aabms;
+	m_jobs = &jobs;
+	m_next_job = 0;
+
+	// Waking up the workers isn't worth it for a single block
+	u32 woken = jobs.size() > 1 ? m_threads.size() : 0;
+	for (u32 i = 0; i < woken; i++)
+		m_threads[i]->startScan();
+
+	while (scanNextJob())
+		;
+
+	for (u32 i = 0; i < woken; i++)
+		m_done.wait();
+
+	m_aabms = NULL;
+	m_jobs = NULL;
+}
+
+bool ABMScanner::scanNextJob()
+{
+	ABMScanJob *job;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		if (m_jobs == NULL || m_next_job >= m_jobs->size())
+			return false;
+		job = &(*m_jobs)[m_next_job++];
+	}
+
+	job->scan(*m_aabms);
+	return true;
+}
@@ -0,0 +1,116 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef ABMSCANNER_HEADER
+#define ABMSCANNER_HEADER
+
+#include "irr_v3d.h"
+#include "mapnode.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
+#include <map>
+#include <set>
+#include <vector>
+
+class ActiveBlockModifier;
+class MapBlock;
+class ABMScanThread;
+
+struct ActiveABM
+{
+	ActiveBlockModifier *abm;
+	int chance;
+	std::set<content_t> required_neighbors;
+};
+
+typedef std::map<content_t, std::vector<ActiveABM> > ActiveABMMap;
+
+// A node that passed the chance roll and neighbor check of an ABM
+struct ABMCandidate
+{
+	const ActiveABM *aabm;
+	// Position relative to the block
+	v3s16 p0;
+	content_t content;
+};
+
+/*
+	Scanning of a single block.
+
+	The scan only reads node data, through the block pointers gathered
+	beforehand by the server thread, so that it doesn't touch the
+	(non thread-safe) caches of the Map.
+*/
+struct ABMScanJob
+{
+	v3s16 blockpos;
+	// The block and its 26 neighbours, indexed by getNeighbourIndex().
+	// Missing neighbours are NULL and read as CONTENT_IGNORE.
+	MapBlock *blocks[27];
+	// Seed of the chance rolls of this block
+	u64 seed;
+
+	std::vector<ABMCandidate> candidates;
+
+	static u32 getNeighbourIndex(v3s16 offset)
+	{
+		return (offset.Z + 1) * 9 + (offset.Y + 1) * 3 + (offset.X + 1);
+	}
+
+	// Fills candidates, in node order
+	void scan(const ActiveABMMap &aabms);
+
+private:
+	MapNode getNode(v3s16 p_rel);
+};
+
+/*
+	Runs ABMScanJobs on a pool of worker threads.
+	The calling thread takes part in the scanning, so a pool of one
+	thread has no workers and scans everything itself.
+*/
+class ABMScanner
+{
+public:
+	ABMScanner(u32 num_threads);
+	~ABMScanner();
+
+	u32 getThreadCount() const { return m_threads.size() + 1; }
+
+	// Returns once all jobs have been scanned
+	void scan(const ActiveABMMap &aabms, std::vector<ABMScanJob> &jobs);
+
+private:
+	friend class ABMScanThread;
+
+	// Scans the next pending job, returns false if there is none left
+	bool scanNextJob();
+
+	std::vector<ABMScanThread *> m_threads;
+
+	Mutex m_queue_mutex;
+	const ActiveABMMap *m_aabms;
+	std::vector<ABMScanJob> *m_jobs;
+	size_t m_next_job;
+
+	// Posted by every worker when it has run out of jobs
+	Semaphore m_done;
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "activeobjectidallocator.h"
+#include "threading/mutex_auto_lock.h"
+
+ActiveObjectIdAllocator::ActiveObjectIdAllocator() :
+	m_flags(ID_COUNT + 1, 0),
+	m_next_unused(1),
+	m_used_count(0),
+	m_failed_count(0)
+{
+}
+
+u16 ActiveObjectIdAllocator::allocate()
+{
+	MutexAutoLock lock(m_mutex);
+
+	// Never used ids, skipping the ones that have been reserved
+	while (m_next_unused <= ID_COUNT) {
+		u16 id = m_next_unused++;
+		if (m_flags[id] & ID_USED)
+			continue;
+		m_flags[id] |= ID_USED;
+		m_used_count++;
+		return id;
+	}
+
+	// Released ids, skipping the ones that have been reserved since
+	while (!m_released.empty()) {
+		u16 id = m_released.front();
+		m_released.pop_front();
+		m_flags[id] &= ~ID_QUEUED;
+		if (m_flags[id] & ID_USED)
+			continue;
+		m_flags[id] |= ID_USED;
+		m_used_count++;
+		return id;
+	}
+
+	m_failed_count++;
+	return 0;
+}
+
+bool ActiveObjectIdAllocator::reserve(u16 id)
+{
+	MutexAutoLock lock(m_mutex);
+
+	if (id == 0 || (m_flags[id] & ID_USED))
+		return false;
+
+	m_flags[id] |= ID_USED;
+	m_used_count++;
+	return true;
+}
+
+void ActiveObjectIdAllocator::release(u16 id)
+{
+	MutexAutoLock lock(m_mutex);
+
+	if (id == 0 || !(m_flags[id] & ID_USED))
+		return;
+
+	m_flags[id] &= ~ID_USED;
+	m_used_count--;
+
+	// Never used ids come back through m_next_unused, and an id can't be
+	// queued twice
+	if (id >= m_next_unused || (m_flags[id] & ID_QUEUED))
+		return;
+	m_flags[id] |= ID_QUEUED;
+	m_released.push_back(id);
+}
+
+void ActiveObjectIdAllocator::clear()
+{
+	MutexAutoLock lock(m_mutex);
+
+	m_flags.assign(ID_COUNT + 1, 0);
+	m_released.clear();
+	m_next_unused = 1;
+	m_used_count = 0;
+}
+
+bool ActiveObjectIdAllocator::isUsed(u16 id)
+{
+	MutexAutoLock lock(m_mutex);
+	return id != 0 && (m_flags[id] & ID_USED);
+}
+
+u32 ActiveObjectIdAllocator::getUsedCount()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_used_count;
+}
+
+u32 ActiveObjectIdAllocator::getFailedCount()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_failed_count;
+}
@@ -0,0 +1,74 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef ACTIVEOBJECTIDALLOCATOR_HEADER
+#define ACTIVEOBJECTIDALLOCATOR_HEADER
+
+#include "irrlichttypes.h"
+#include "threading/mutex.h"
+#include <deque>
+#include <vector>
+
+/*
+	Allocator of active object ids, used by ServerEnvironment.
+
+	Ids are reused as late as possible: the ids that have never been used
+	are handed out first, then the released ids in the order they were
+	released. All operations are O(1) and thread-safe. 0 is never a valid id.
+*/
+
+class ActiveObjectIdAllocator
+{
+public:
+	ActiveObjectIdAllocator();
+
+	// Returns 0 if all ids are in use
+	u16 allocate();
+	// Marks a specific id as used. Returns false if it is 0 or already used.
+	bool reserve(u16 id);
+	// Makes an allocated or reserved id available again
+	void release(u16 id);
+	void clear();
+
+	bool isUsed(u16 id);
+	u32 getUsedCount();
+	// Number of allocate() calls that failed because all ids were in use
+	u32 getFailedCount();
+
+	static const u32 ID_COUNT = 65535;
+
+private:
+	enum {
+		ID_USED = 0x01,
+		// In m_released; cleared lazily when popped
+		ID_QUEUED = 0x02,
+	};
+
+	Mutex m_mutex;
+	// Flags of each id
+	std::vector<u8> m_flags;
+	// Released ids, oldest first. May contain ids reserved since.
+	std::deque<u16> m_released;
+	// Ids from here on have never been used
+	u32 m_next_unused;
+	u32 m_used_count;
+	u32 m_failed_count;
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "activeobjectindex.h"
+#include "constants.h"
+#include "util/numeric.h"
+
+// Objects can leave the map generation limit after they have been added.
+// Positions are clamped to slightly beyond it, so that far away objects
+// end up in the outermost cells instead of overflowing the cell coordinates.
+#define INDEX_LIMIT_BS ((MAX_MAP_GENERATION_LIMIT + MAP_BLOCKSIZE) * BS)
+
+v3s16 ActiveObjectIndex::getCell(v3f pos)
+{
+	pos.X = rangelim(pos.X, -INDEX_LIMIT_BS, INDEX_LIMIT_BS);
+	pos.Y = rangelim(pos.Y, -INDEX_LIMIT_BS, INDEX_LIMIT_BS);
+	pos.Z = rangelim(pos.Z, -INDEX_LIMIT_BS, INDEX_LIMIT_BS);
+	return getContainerPos(floatToInt(pos, BS), MAP_BLOCKSIZE);
+}
+
+s64 ActiveObjectIndex::getCellKey(v3s16 cell)
+{
+	return (s64)(u16)cell.X
+		| ((s64)(u16)cell.Y << 16)
+		| ((s64)(u16)cell.Z << 32);
+}
+
+v3s16 ActiveObjectIndex::getKeyCell(s64 key)
+{
+	return v3s16(
+		(s16)(u16)(key & 0xFFFF),
+		(s16)(u16)((key >> 16) & 0xFFFF),
+		(s16)(u16)((key >> 32) & 0xFFFF));
+}
+
+void ActiveObjectIndex::insert(u16 id, v3f pos)
+{
+	if (contains(id))
+		remove(id);
+
+	s64 key = getCellKey(getCell(pos));
+	m_cells[key].push_back(id);
+	m_object_cells[id] = key;
+}
+
+void ActiveObjectIndex::remove(u16 id)
+{
+	UNORDERED_MAP<u16, s64>::iterator it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+
+	removeFromCell(id, it->second);
+	m_object_cells.erase(it);
+}
+
+void ActiveObjectIndex::update(u16 id, v3f pos)
+{
+	UNORDERED_MAP<u16, s64>::iterator it = m_object_cells.find(id);
+	if (it == m_object_cells.end())
+		return;
+
+	s64 key = getCellKey(getCell(pos));
+	if (key == it->second)
+		return;
+
+	removeFromCell(id, it->second);
+	m_cells[key].push_back(id);
+	it->second = key;
+}
+
+void ActiveObjectIndex::clear()
+{
+	m_cells.clear();
+	m_object_cells.clear();
+}
+
+void ActiveObjectIndex::removeFromCell(u16 id, s64 key)
+{
+	CellMap::iterator cell = m_cells.find(key);
+	if (cell == m_cells.end())
+		return;
+
+	std::vector<u16> &ids = cell->second;
+	for (size_t i = 0; i < ids.size(); i++) {
+		if (ids[i] != id)
+			continue;
+		// Order inside a cell is irrelevant
+		ids[i] = ids.back();
+		ids.pop_back();
+		break;
+	}
+
+	if (ids.empty())
+		m_cells.erase(cell);
+}
+
+u64 ActiveObjectIndex::getCellCount(v3f minp, v3f maxp) const
+{
+	v3s16 cmin = getCell(minp);
+	v3s16 cmax = getCell(maxp);
+	if (cmin.X > cmax.X || cmin.Y > cmax.Y || cmin.Z > cmax.Z)
+		return 0;
+
+	return (u64)(cmax.X - cmin.X + 1)
+		* (u64)(cmax.Y - cmin.Y + 1)
+		* (u64)(cmax.Z - cmin.Z + 1);
+}
+
+void ActiveObjectIndex::getObjectsInArea(v3f minp, v3f maxp,
+		std::vector<u16> &result) const
+{
+	v3s16 cmin = getCell(minp);
+	v3s16 cmax = getCell(maxp);
+
+	// A query bigger than the amount of occupied cells is answered
+	// faster by going through the occupied cells directly
+	if (getCellCount(minp, maxp) > m_cells.size()) {
+		for (CellMap::const_iterator it = m_cells.begin();
+				it != m_cells.end(); ++it) {
+			v3s16 cell = getKeyCell(it->first);
+			if (cell.X < cmin.X || cell.X > cmax.X ||
+					cell.Y < cmin.Y || cell.Y > cmax.Y ||
+					cell.Z < cmin.Z || cell.Z > cmax.Z)
+				continue;
+			result.insert(result.end(), it->second.begin(), it->second.end());
+		}
+		return;
+	}
+
+	v3s16 c;
+	for (c.X = cmin.X; c.X <= cmax.X; c.X++)
+	for (c.Y = cmin.Y; c.Y <= cmax.Y; c.Y++)
+	for (c.Z = cmin.Z; c.Z <= cmax.Z; c.Z++) {
+		CellMap::const_iterator it = m_cells.find(getCellKey(c));
+		if (it == m_cells.end())
+			continue;
+		result.insert(result.end(), it->second.begin(), it->second.end());
+	}
+}
+
+void ActiveObjectIndex::getOccupiedBlocks(std::vector<v3s16> &result) const
+{
+	result.reserve(result.size() + m_cells.size());
+	for (CellMap::const_iterator it = m_cells.begin();
+			it != m_cells.end(); ++it)
+		result.push_back(getKeyCell(it->first));
+}
+
+void ActiveObjectIndex::getObjectsInBlock(v3s16 blockpos,
+		std::vector<u16> &result) const
+{
+	CellMap::const_iterator it = m_cells.find(getCellKey(blockpos));
+	if (it != m_cells.end())
+		result.insert(result.end(), it->second.begin(), it->second.end());
+}
@@ -0,0 +1,80 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef ACTIVEOBJECTINDEX_HEADER
+#define ACTIVEOBJECTINDEX_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include "util/cpp11_container.h"
+#include <vector>
+
+/*
+	Spatial index of active objects, used by ServerEnvironment.
+
+	Objects are bucketed by the MapBlock their base position lies in.
+	Area queries only visit the cells overlapping the queried box, so
+	their cost depends on the number of objects nearby instead of the
+	total number of active objects.
+
+	Results of queries are candidates: they contain every object whose
+	cell overlaps the box, the caller has to check the exact position.
+*/
+
+class ActiveObjectIndex
+{
+public:
+	void insert(u16 id, v3f pos);
+	void remove(u16 id);
+	// Moves a known object to the cell of pos. Unknown ids are ignored.
+	void update(u16 id, v3f pos);
+	void clear();
+
+	bool contains(u16 id) const
+	{ return m_object_cells.find(id) != m_object_cells.end(); }
+
+	u32 size() const
+	{ return m_object_cells.size(); }
+
+	// Appends the ids of the objects in all cells overlapping [minp, maxp]
+	void getObjectsInArea(v3f minp, v3f maxp, std::vector<u16> &result) const;
+
+	// Appends the positions of the blocks containing objects
+	void getOccupiedBlocks(std::vector<v3s16> &result) const;
+	// Appends the ids of the objects in the block at blockpos
+	void getObjectsInBlock(v3s16 blockpos, std::vector<u16> &result) const;
+
+private:
+	typedef UNORDERED_MAP<s64, std::vector<u16> > CellMap;
+
+	static v3s16 getCell(v3f pos);
+	static s64 getCellKey(v3s16 cell);
+	static v3s16 getKeyCell(s64 key);
+
+	// Number of cells a query of the box [minp, maxp] would visit
+	u64 getCellCount(v3f minp, v3f maxp) const;
+
+	void removeFromCell(u16 id, s64 key);
+
+	// Cell key -> ids of the objects in the cell
+	CellMap m_cells;
+	// Object id -> key of the cell the object is in
+	UNORDERED_MAP<u16, s64> m_object_cells;
+};
+
+#endif
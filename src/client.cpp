@@ -430,7 +430,7 @@ void Client::step(float dtime)
 		std::vector<v3s16> deleted_blocks;
 		m_env.getMap().timerUpdate(map_timer_and_unload_dtime,
 			g_settings->getFloat("client_unload_unused_data_timeout"),
-			g_settings->getS32("client_mapblock_limit"),
+			g_settings->getS32("client_mapblock_limit"), 0,
 			&deleted_blocks);
 
 		/*
@@ -35,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "hud.h"
 #include "particles.h"
 #include "network/networkpacket.h"
+#include "objectposition.h"
 
 struct MeshMakeData;
 class MapBlockMesh;
@@ -368,6 +369,7 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_ChatMessage(NetworkPacket* pkt);
 	void handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt);
 	void handleCommand_ActiveObjectMessages(NetworkPacket* pkt);
+	void handleCommand_ActiveObjectPositions(NetworkPacket* pkt);
 	void handleCommand_Movement(NetworkPacket* pkt);
 	void handleCommand_HP(NetworkPacket* pkt);
 	void handleCommand_Breath(NetworkPacket* pkt);
@@ -601,6 +603,8 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 
 	MeshUpdateThread m_mesh_update_thread;
 	ClientEnvironment m_env;
+	// Keyframes of TOCLIENT_ACTIVE_OBJECT_POSITIONS
+	ObjectPositionDecoder m_object_positions;
 	ParticleManager m_particle_manager;
 	con::Connection m_con;
 	IrrlichtDevice *m_device;
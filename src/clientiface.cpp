@@ -30,6 +30,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "map.h"
 #include "emerge.h"
 #include "content_sao.h"              // TODO this is used for cleanup of only
+#include "genericobject.h"
+#include "util/serialize.h"
 #include "log.h"
 #include "util/srp.h"
 
@@ -593,6 +595,128 @@ u32 RemoteClient::uptime()
 	return getTime(PRECISION_SECONDS) - m_connection_time;
 }
 
+/*
+	Key of the area of interest state of an object command
+*/
+static inline u32 getObjectUpdateKey(u16 id, u8 cmd)
+{
+	return ((u32)id << 8) | cmd;
+}
+
+/*
+	The client interpolates the positions of an object over the
+	update_interval of GENERIC_CMD_UPDATE_POSITION, which is its last
+	field. Stretch it to the interval the updates are actually sent at.
+*/
+static void stretchUpdateInterval(ActiveObjectMessage &aom, float interval)
+{
+	if (interval <= 0 || aom.datastring.size() < 5 ||
+			aom.datastring[0] != GENERIC_CMD_UPDATE_POSITION)
+		return;
+
+	size_t pos = aom.datastring.size() - 4;
+	f32 update_interval = readF1000((const u8 *)aom.datastring.c_str() + pos);
+	if (update_interval >= interval)
+		return;
+
+	u8 buf[4];
+	writeF1000(buf, interval);
+	aom.datastring.replace(pos, 4, (const char *)buf, 4);
+}
+
+float RemoteClient::getObjectUpdateInterval(PlayerSAO *playersao,
+		v3f object_pos) const
+{
+	const f32 full_rate_d = m_object_full_rate_d;
+	const f32 max_interval = m_object_max_interval;
+
+	if (playersao == NULL || max_interval <= 0)
+		return 0;
+
+	v3f relative = object_pos - playersao->getEyePosition();
+	f32 d = relative.getLength();
+	if (d <= full_rate_d)
+		return 0;
+
+	// Reaches max_interval at four times the full rate distance
+	f32 interval = max_interval * (d - full_rate_d) / (3 * MYMAX(full_rate_d, BS));
+
+	// Objects behind the player are only seen by turning around
+	v3f camera_dir = v3f(0,0,1);
+	camera_dir.rotateYZBy(playersao->getPitch());
+	camera_dir.rotateXZBy(playersao->getYaw());
+	if (camera_dir.dotProduct(relative) < 0)
+		interval *= 2;
+
+	return MYMIN(interval, max_interval);
+}
+
+void RemoteClient::stepObjectUpdates(float dtime)
+{
+	m_object_update_time += dtime;
+}
+
+bool RemoteClient::filterObjectMessage(ActiveObjectMessage &aom, float interval)
+{
+	if (aom.datastring.empty())
+		return true;
+
+	// Only updates replacing the whole previous state can be skipped
+	u8 cmd = aom.datastring[0];
+	if (cmd != GENERIC_CMD_UPDATE_POSITION && cmd != GENERIC_CMD_SET_ANIMATION)
+		return true;
+
+	u32 key = getObjectUpdateKey(aom.id, cmd);
+	float last_sent = -1;
+	UNORDERED_MAP<u32, float>::iterator it = m_object_update_sent.find(key);
+	if (it != m_object_update_sent.end())
+		last_sent = it->second;
+
+	if (interval <= 0 || last_sent < 0 ||
+			m_object_update_time - last_sent >= interval) {
+		m_object_update_sent[key] = m_object_update_time;
+		m_held_object_messages.erase(key);
+		stretchUpdateInterval(aom, interval);
+		return true;
+	}
+
+	HeldObjectMessage held = { aom, last_sent + interval, interval };
+	std::map<u32, HeldObjectMessage>::iterator h =
+			m_held_object_messages.find(key);
+	if (h == m_held_object_messages.end())
+		m_held_object_messages.insert(std::make_pair(key, held));
+	else
+		h->second = held;
+	return false;
+}
+
+void RemoteClient::popDueObjectMessages(std::vector<ActiveObjectMessage> &dest)
+{
+	for (std::map<u32, HeldObjectMessage>::iterator
+			i = m_held_object_messages.begin();
+			i != m_held_object_messages.end();) {
+		if (i->second.due_time > m_object_update_time) {
+			++i;
+			continue;
+		}
+		m_object_update_sent[i->first] = m_object_update_time;
+		stretchUpdateInterval(i->second.aom, i->second.interval);
+		dest.push_back(i->second.aom);
+		m_held_object_messages.erase(i++);
+	}
+}
+
+void RemoteClient::forgetObject(u16 id)
+{
+	u8 cmds[] = { GENERIC_CMD_UPDATE_POSITION, GENERIC_CMD_SET_ANIMATION };
+	for (size_t i = 0; i < ARRLEN(cmds); i++) {
+		u32 key = getObjectUpdateKey(id, cmds[i]);
+		m_object_update_sent.erase(key);
+		m_held_object_messages.erase(key);
+	}
+	m_object_positions.forget(id);
+}
+
 ClientInterface::ClientInterface(con::Connection* con)
 :
 	m_con(con),
@@ -22,18 +22,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "irr_v3d.h"                   // for irrlicht datatypes
 
 #include "constants.h"
+#include "activeobject.h"              // for ActiveObjectMessage
 #include "serialization.h"             // for SER_FMT_VER_INVALID
 #include "threading/mutex.h"
 #include "network/networkpacket.h"
+#include "objectposition.h"
+#include "settings.h"
 #include "util/cpp11_container.h"
 
 #include <list>
 #include <vector>
 #include <set>
+#include <map>
 
 class MapBlock;
 class ServerEnvironment;
 class EmergeManager;
+class PlayerSAO;
 
 /*
  * State Transitions
@@ -266,7 +271,12 @@ class RemoteClient
 		m_version_patch(0),
 		m_full_version("unknown"),
 		m_deployed_compression(0),
-		m_connection_time(getTime(PRECISION_SECONDS))
+		m_connection_time(getTime(PRECISION_SECONDS)),
+		m_object_full_rate_d(
+			g_settings->getFloat("object_update_full_rate_distance") * BS),
+		m_object_max_interval(
+			g_settings->getFloat("object_update_max_interval")),
+		m_object_update_time(0)
 	{
 	}
 	~RemoteClient()
@@ -325,6 +335,30 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	/*
+		Area of interest.
+
+		Position and animation updates of the known objects that are far
+		from the player, or behind them, are sent at a lower rate. The
+		latest held back update of an object is sent once its interval
+		has passed.
+	*/
+	// Minimum time between two updates of an object at object_pos,
+	// 0 if all of them have to be sent
+	float getObjectUpdateInterval(PlayerSAO *playersao, v3f object_pos) const;
+	// Advances the clock of the held back updates
+	void stepObjectUpdates(float dtime);
+	// Returns false if the message is held back instead of being sent now
+	bool filterObjectMessage(ActiveObjectMessage &aom, float interval);
+	// Moves the held back messages that are due to dest
+	void popDueObjectMessages(std::vector<ActiveObjectMessage> &dest);
+	// Drops the state of an object the client doesn't know anymore
+	void forgetObject(u16 id);
+
+	// Keyframes of TOCLIENT_ACTIVE_OBJECT_POSITIONS, used instead of
+	// GENERIC_CMD_UPDATE_POSITION messages since protocol version 29
+	ObjectPositionEncoder m_object_positions;
+
 	ClientState getState()
 		{ return m_state; }
 
@@ -436,6 +470,23 @@ class RemoteClient
 		time this client was created
 	 */
 	const u32 m_connection_time;
+
+	/*
+		Area of interest, see filterObjectMessage()
+	*/
+	struct HeldObjectMessage {
+		ActiveObjectMessage aom;
+		float due_time;
+		float interval;
+	};
+	// object_update_full_rate_distance in world units
+	const f32 m_object_full_rate_d;
+	const f32 m_object_max_interval;
+	float m_object_update_time;
+	// Key (see getObjectUpdateKey()) -> m_object_update_time of the last update sent
+	UNORDERED_MAP<u32, float> m_object_update_sent;
+	// Key -> latest update held back
+	std::map<u32, HeldObjectMessage> m_held_object_messages;
 };
 
 class ClientInterface {
@@ -0,0 +1,517 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+Block log format:
+	Segment files map.blocklog/<8 digit id>.seg, replayed in order of ids.
+	Each is a sequence of records:
+		u32 crc32 of the rest of the record
+		u32 data size, 0xFFFFFFFF for a deleted block
+		s64 position, see Database::getBlockAsInteger
+		u8[] data
+	Byte order is big-endian.
+*/
+
+#ifndef _WIN32
+
+#include "database-blocklog.h"
+
+#include "log.h"
+#include "filesys.h"
+#include "exceptions.h"
+#include "settings.h"
+#include "threading/thread.h"
+#include "threading/semaphore.h"
+#include "threading/mutex_auto_lock.h"
+#include "util/serialize.h"
+#include "util/string.h"
+#include "util/basic_macros.h"
+#include "zlib.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define RECORD_HEADER_SIZE 16
+#define RECORD_DELETED 0xFFFFFFFF
+// Time between looking for segments to compact
+#define COMPACT_INTERVAL_MS 60000
+// Records compacted before the lock is released for other users
+#define COMPACT_RECORDS_PER_LOCK 64
+
+/*
+	BlockLogCompactThread
+*/
+
+class BlockLogCompactThread : public Thread
+{
+public:
+	BlockLogCompactThread(Database_BlockLog *db) :
+		Thread("BlockLogCompact"),
+		m_db(db)
+	{}
+
+	// Wakes the thread up to stop it
+	void wakeUp() { m_wakeup.post(); }
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			m_wakeup.wait(COMPACT_INTERVAL_MS);
+			if (stopRequested())
+				break;
+			u32 removed = m_db->compact();
+			if (removed > 0) {
+				infostream << "Database_BlockLog: compacted " << removed
+					<< " segments" << std::endl;
+			}
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	Database_BlockLog *m_db;
+	Semaphore m_wakeup;
+};
+
+/*
+	Database_BlockLog
+*/
+
+static u32 record_crc(const u8 *header, const char *data, u32 size)
+{
+	// The crc itself is not covered
+	uLong crc = crc32(0L, header + 4, RECORD_HEADER_SIZE - 4);
+	if (size > 0)
+		crc = crc32(crc, (const Bytef *)data, size);
+	return crc;
+}
+
+static bool sync_dir(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+	bool ok = fsync(fd) == 0;
+	close(fd);
+	return ok;
+}
+
+Database_BlockLog::Database_BlockLog(const std::string &savedir) :
+	m_dir(savedir + DIR_DELIM + "map.blocklog"),
+	m_segment_size(MYMAX(g_settings->getU64("blocklog_segment_size"),
+		(u64)RECORD_HEADER_SIZE)),
+	m_active(NULL),
+	m_in_save(false),
+	m_unsynced(false),
+	m_compact_thread(NULL)
+{
+	if (!fs::CreateAllDirs(m_dir))
+		throw DatabaseException("Failed to create directory " + m_dir);
+
+	std::vector<fs::DirListNode> files = fs::GetDirListing(m_dir);
+	std::vector<u32> ids;
+	for (size_t i = 0; i < files.size(); i++) {
+		const std::string &name = files[i].name;
+		if (files[i].dir || name.size() != 12 ||
+				name.compare(8, 4, ".seg") != 0 ||
+				name.find_first_not_of("0123456789") != 8)
+			continue;
+		ids.push_back(stoi(name.substr(0, 8)));
+	}
+	std::sort(ids.begin(), ids.end());
+
+	// Later records replace earlier ones, replay them in order
+	for (size_t i = 0; i < ids.size(); i++) {
+		Segment *seg = openSegment(ids[i], 0);
+		m_segments[seg->id] = seg;
+		if (recoverSegment(seg))
+			continue;
+
+		if (i + 1 < ids.size()) {
+			errorstream << "Database_BlockLog: segment " << seg->id
+				<< " is damaged at offset " << seg->size
+				<< ", ignoring the rest of it" << std::endl;
+		} else {
+			// Most likely the last save was interrupted
+			warningstream << "Database_BlockLog: removing an incomplete "
+				"record at the end of segment " << seg->id << std::endl;
+			if (ftruncate(seg->fd, seg->size) != 0)
+				throw DatabaseException("Failed to truncate "
+					+ getSegmentPath(seg->id) + ": " + strerror(errno));
+		}
+	}
+
+	if (!m_segments.empty() && m_segments.rbegin()->second->size <
+			m_segment_size) {
+		m_active = m_segments.rbegin()->second;
+	} else {
+		u32 id = m_segments.empty() ? 1 : m_segments.rbegin()->first + 1;
+		m_active = openSegment(id, 0);
+		m_segments[id] = m_active;
+	}
+
+	infostream << "Database_BlockLog: " << m_index.size() << " blocks in "
+		<< m_segments.size() << " segments" << std::endl;
+
+	m_compact_thread = new BlockLogCompactThread(this);
+	if (!m_compact_thread->start()) {
+		errorstream << "Database_BlockLog: failed to start the compaction "
+			"thread" << std::endl;
+		delete m_compact_thread;
+		m_compact_thread = NULL;
+	}
+}
+
+Database_BlockLog::~Database_BlockLog()
+{
+	if (m_compact_thread) {
+		m_compact_thread->stop();
+		m_compact_thread->wakeUp();
+		m_compact_thread->wait();
+		delete m_compact_thread;
+	}
+
+	syncActive();
+	for (SegmentMap::iterator it = m_segments.begin();
+			it != m_segments.end(); ++it)
+		closeSegment(it->second);
+}
+
+std::string Database_BlockLog::getSegmentPath(u32 id) const
+{
+	char name[16];
+	snprintf(name, sizeof(name), "%08u.seg", id);
+	return m_dir + DIR_DELIM + name;
+}
+
+Database_BlockLog::Segment *Database_BlockLog::openSegment(u32 id,
+		size_t min_capacity)
+{
+	std::string path = getSegmentPath(id);
+	bool existed = fs::PathExists(path);
+	// Writes always go to the end, also after truncating the file
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd == -1)
+		throw DatabaseException("Failed to open " + path + ": "
+			+ strerror(errno));
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		throw DatabaseException("Failed to stat " + path + ": "
+			+ strerror(errno));
+	}
+
+	Segment *seg = new Segment;
+	seg->id = id;
+	seg->fd = fd;
+	seg->size = st.st_size;
+	seg->live = 0;
+	// Appended records become readable through the mapping without
+	// remapping, as long as they fit into it
+	seg->capacity = MYMAX(MYMAX(seg->size, min_capacity),
+		(size_t)m_segment_size);
+	void *data = mmap(NULL, seg->capacity, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		delete seg;
+		throw DatabaseException("Failed to map " + path + ": "
+			+ strerror(errno));
+	}
+	seg->data = (char *)data;
+
+	if (!existed && !sync_dir(m_dir)) {
+		errorstream << "Database_BlockLog: failed to sync " << m_dir
+			<< std::endl;
+	}
+	return seg;
+}
+
+void Database_BlockLog::closeSegment(Segment *seg)
+{
+	munmap(seg->data, seg->capacity);
+	close(seg->fd);
+	delete seg;
+}
+
+bool Database_BlockLog::recoverSegment(Segment *seg)
+{
+	size_t offset = 0;
+	while (offset + RECORD_HEADER_SIZE <= seg->size) {
+		const u8 *header = (const u8 *)seg->data + offset;
+		u32 size = readU32(header + 4);
+		s64 key = readS64(header + 8);
+		bool deleted = size == RECORD_DELETED;
+		size_t record_size = RECORD_HEADER_SIZE + (deleted ? 0 : size);
+		if (offset + record_size > seg->size)
+			break;
+
+		const char *data = seg->data + offset + RECORD_HEADER_SIZE;
+		if (readU32(header) != record_crc(header, data, deleted ? 0 : size))
+			break;
+
+		removeFromIndex(key);
+		if (!deleted) {
+			Location &loc = m_index[key];
+			loc.segment = seg->id;
+			loc.offset = offset + RECORD_HEADER_SIZE;
+			loc.size = size;
+			seg->live += record_size;
+		}
+		offset += record_size;
+	}
+
+	bool complete = offset == seg->size;
+	seg->size = offset;
+	return complete;
+}
+
+bool Database_BlockLog::appendRecord(s64 key, const char *data, u32 size)
+{
+	size_t record_size = RECORD_HEADER_SIZE + (data ? size : 0);
+	if (m_active->size + record_size > m_active->capacity) {
+		// Seal the segment
+		syncActive();
+		u32 id = m_active->id + 1;
+		m_active = openSegment(id, record_size);
+		m_segments[id] = m_active;
+	}
+
+	u8 header[RECORD_HEADER_SIZE];
+	writeU32(header + 4, data ? size : RECORD_DELETED);
+	writeS64(header + 8, key);
+	writeU32(header, record_crc(header, data, data ? size : 0));
+
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = RECORD_HEADER_SIZE;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = data ? size : 0;
+	ssize_t written = writev(m_active->fd, iov, data ? 2 : 1);
+	if (written != (ssize_t)record_size) {
+		errorstream << "Database_BlockLog: failed to write to segment "
+			<< m_active->id << ": " << strerror(errno) << std::endl;
+		// Don't leave a partial record behind for the next one
+		if (written > 0 && ftruncate(m_active->fd, m_active->size) != 0) {
+			errorstream << "Database_BlockLog: failed to truncate segment "
+				<< m_active->id << std::endl;
+		}
+		return false;
+	}
+
+	removeFromIndex(key);
+	if (data) {
+		Location &loc = m_index[key];
+		loc.segment = m_active->id;
+		loc.offset = m_active->size + RECORD_HEADER_SIZE;
+		loc.size = size;
+		m_active->live += record_size;
+	}
+	m_active->size += record_size;
+
+	m_unsynced = true;
+	if (!m_in_save)
+		syncActive();
+	return true;
+}
+
+void Database_BlockLog::syncActive()
+{
+	if (!m_unsynced)
+		return;
+	if (fsync(m_active->fd) != 0) {
+		errorstream << "Database_BlockLog: failed to sync segment "
+			<< m_active->id << ": " << strerror(errno) << std::endl;
+	}
+	m_unsynced = false;
+}
+
+void Database_BlockLog::removeFromIndex(s64 key)
+{
+	Index::iterator it = m_index.find(key);
+	if (it == m_index.end())
+		return;
+	m_segments[it->second.segment]->live -=
+		RECORD_HEADER_SIZE + it->second.size;
+	m_index.erase(it);
+}
+
+void Database_BlockLog::beginSave()
+{
+	MutexAutoLock lock(m_mutex);
+	m_in_save = true;
+}
+
+void Database_BlockLog::endSave()
+{
+	MutexAutoLock lock(m_mutex);
+	m_in_save = false;
+	syncActive();
+}
+
+bool Database_BlockLog::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	MutexAutoLock lock(m_mutex);
+	return appendRecord(getBlockAsInteger(pos), data.c_str(), data.size());
+}
+
+void Database_BlockLog::loadBlock(const v3s16 &pos, std::string *block)
+{
+	MutexAutoLock lock(m_mutex);
+	Index::const_iterator it = m_index.find(getBlockAsInteger(pos));
+	if (it == m_index.end()) {
+		block->clear();
+		return;
+	}
+	const Location &loc = it->second;
+	block->assign(m_segments[loc.segment]->data + loc.offset, loc.size);
+}
+
+bool Database_BlockLog::deleteBlock(const v3s16 &pos)
+{
+	MutexAutoLock lock(m_mutex);
+	s64 key = getBlockAsInteger(pos);
+	if (m_index.find(key) == m_index.end())
+		return true;
+	return appendRecord(key, NULL, 0);
+}
+
+void Database_BlockLog::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->resize(positions.size());
+
+	MutexAutoLock lock(m_mutex);
+	for (size_t i = 0; i < positions.size(); i++) {
+		Index::const_iterator it =
+			m_index.find(getBlockAsInteger(positions[i]));
+		if (it == m_index.end()) {
+			(*blocks)[i].clear();
+			continue;
+		}
+		const Location &loc = it->second;
+		(*blocks)[i].assign(m_segments[loc.segment]->data + loc.offset,
+			loc.size);
+	}
+}
+
+void Database_BlockLog::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	MutexAutoLock lock(m_mutex);
+	dst.reserve(dst.size() + m_index.size());
+	for (Index::const_iterator it = m_index.begin(); it != m_index.end(); ++it)
+		dst.push_back(getIntegerAsBlock(it->first));
+}
+
+u32 Database_BlockLog::getSegmentCount()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_segments.size();
+}
+
+u32 Database_BlockLog::compact()
+{
+	MutexAutoLock compact_lock(m_compact_mutex);
+
+	std::vector<u32> ids;
+	{
+		MutexAutoLock lock(m_mutex);
+		for (SegmentMap::const_iterator it = m_segments.begin();
+				it != m_segments.end(); ++it) {
+			const Segment *seg = it->second;
+			if (seg != m_active && seg->live * 2 <= seg->size)
+				ids.push_back(seg->id);
+		}
+	}
+
+	for (size_t i = 0; i < ids.size(); i++)
+		compactSegment(ids[i]);
+	return ids.size();
+}
+
+void Database_BlockLog::compactSegment(u32 id)
+{
+	size_t offset = 0;
+	for (;;) {
+		MutexAutoLock lock(m_mutex);
+		Segment *seg = m_segments[id];
+		// Deleted blocks may still be in an older segment
+		bool has_older = m_segments.begin()->first < id;
+
+		for (u32 n = 0; n < COMPACT_RECORDS_PER_LOCK &&
+				offset < seg->size; n++) {
+			const u8 *header = (const u8 *)seg->data + offset;
+			u32 size = readU32(header + 4);
+			s64 key = readS64(header + 8);
+			Index::const_iterator it = m_index.find(key);
+
+			if (size == RECORD_DELETED) {
+				if (has_older && it == m_index.end())
+					appendRecord(key, NULL, 0);
+				offset += RECORD_HEADER_SIZE;
+				continue;
+			}
+
+			// Only the latest record of a block is still used
+			offset += RECORD_HEADER_SIZE;
+			if (it != m_index.end() && it->second.segment == id &&
+					it->second.offset == offset) {
+				// The mapping stays valid, appending may not remap it
+				appendRecord(key, seg->data + offset, size);
+			}
+			offset += size;
+		}
+
+		if (offset < seg->size)
+			continue;
+
+		if (seg->live > 0) {
+			// Some record could not be written, keep the segment
+			errorstream << "Database_BlockLog: failed to compact segment "
+				<< id << std::endl;
+			return;
+		}
+
+		// The copies have to be on disk before the originals are gone
+		syncActive();
+		m_segments.erase(id);
+		closeSegment(seg);
+		std::string path = getSegmentPath(id);
+		if (unlink(path.c_str()) != 0 || !sync_dir(m_dir)) {
+			errorstream << "Database_BlockLog: failed to remove " << path
+				<< std::endl;
+		}
+		return;
+	}
+}
+
+#endif // _WIN32
@@ -0,0 +1,133 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef DATABASE_BLOCKLOG_HEADER
+#define DATABASE_BLOCKLOG_HEADER
+
+// Memory mapped files are only implemented for POSIX systems
+#ifndef _WIN32
+
+#include "database.h"
+#include "threading/mutex.h"
+#include "util/cpp11_container.h"
+#include <map>
+#include <string>
+
+class BlockLogCompactThread;
+
+/*
+	Map database made of append-only segment files in map.blocklog/.
+
+	Every save appends a record to the newest segment, and an in-memory
+	index maps the block positions to their latest record. The segments
+	are memory mapped, so loads are plain copies out of the mapping.
+	When opened, the index is rebuilt by reading all records in order, a
+	partially written record at the end of the log is cut off.
+
+	A background thread rewrites the live records of segments which
+	mostly contain overwritten ones to the end of the log, then removes
+	those segments.
+*/
+class Database_BlockLog : public Database
+{
+public:
+	Database_BlockLog(const std::string &savedir);
+	~Database_BlockLog();
+
+	void beginSave();
+	void endSave();
+
+	bool saveBlock(const v3s16 &pos, const std::string &data);
+	void loadBlock(const v3s16 &pos, std::string *block);
+	bool deleteBlock(const v3s16 &pos);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+	bool supportsConcurrentLoads() const { return true; }
+
+	// Compacts every segment which is at least half unused. Returns the
+	// number of removed segments.
+	u32 compact();
+
+	u32 getSegmentCount();
+
+private:
+	friend class BlockLogCompactThread;
+
+	struct Segment {
+		u32 id;
+		int fd;
+		char *data;
+		// Size of the mapping, at least the file size
+		size_t capacity;
+		// Bytes written to the file
+		size_t size;
+		// Bytes of records that are still in the index
+		size_t live;
+	};
+
+	struct Location {
+		u32 segment;
+		// Offset of the block data, after the record header
+		u32 offset;
+		u32 size;
+	};
+
+	typedef std::map<u32, Segment *> SegmentMap;
+	typedef UNORDERED_MAP<s64, Location> Index;
+
+	std::string getSegmentPath(u32 id) const;
+
+	// Opens and maps a segment, creating it if needed
+	Segment *openSegment(u32 id, size_t min_capacity);
+	void closeSegment(Segment *seg);
+	// Adds the records of a segment to the index. Returns false if a
+	// damaged record was found, seg->size then ends before it.
+	bool recoverSegment(Segment *seg);
+
+	// Appends a record, data is NULL for deleting the block
+	bool appendRecord(s64 key, const char *data, u32 size);
+	void syncActive();
+	void removeFromIndex(s64 key);
+
+	// Moves the live records of the segment to the end of the log.
+	// m_mutex is locked and unlocked in between records.
+	void compactSegment(u32 id);
+
+	std::string m_dir;
+	u32 m_segment_size;
+
+	// Held by compact(), so that only one thread compacts at a time
+	Mutex m_compact_mutex;
+
+	// Protects everything below
+	Mutex m_mutex;
+	SegmentMap m_segments;
+	// Segment appended to, the newest one
+	Segment *m_active;
+	Index m_index;
+	bool m_in_save;
+	bool m_unsynced;
+
+	BlockLogCompactThread *m_compact_thread;
+};
+
+#endif // _WIN32
+
+#endif
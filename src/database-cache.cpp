@@ -0,0 +1,256 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "database-cache.h"
+#include "exceptions.h"
+#include "threading/mutex_auto_lock.h"
+#include "profiler.h"
+#include "log.h"
+
+Database_Cache::Database_Cache(Database *db, u64 capacity) :
+	m_db(db),
+	m_capacity(capacity),
+	m_in_save(false),
+	m_size(0),
+	m_hits(0),
+	m_misses(0)
+{
+}
+
+Database_Cache::~Database_Cache()
+{
+	u64 lookups = m_hits + m_misses;
+	if (lookups > 0) {
+		infostream << "Database_Cache: " << m_hits << " hits, "
+			<< m_misses << " misses (" << (m_hits * 100 / lookups)
+			<< "% hit rate)" << std::endl;
+	}
+	delete m_db;
+}
+
+void Database_Cache::beginSave()
+{
+	m_db->beginSave();
+	m_in_save = true;
+	m_transaction_keys.clear();
+}
+
+void Database_Cache::endSave()
+{
+	m_in_save = false;
+	try {
+		m_db->endSave();
+	} catch (DatabaseException &e) {
+		// The database may hold none of the blocks saved in between
+		for (size_t i = 0; i < m_transaction_keys.size(); i++)
+			erase(m_transaction_keys[i]);
+		m_transaction_keys.clear();
+		throw;
+	}
+	m_transaction_keys.clear();
+}
+
+bool Database_Cache::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	s64 key = getBlockAsInteger(pos);
+	if (!m_db->saveBlock(pos, data)) {
+		// Whatever the database holds now, it isn't what is cached
+		erase(key);
+		return false;
+	}
+	put(key, data);
+	if (m_in_save)
+		m_transaction_keys.push_back(key);
+	return true;
+}
+
+void Database_Cache::loadBlock(const v3s16 &pos, std::string *block)
+{
+	s64 key = getBlockAsInteger(pos);
+	if (get(key, block)) {
+		countLookups(1, 0);
+		return;
+	}
+	countLookups(0, 1);
+
+	m_db->loadBlock(pos, block);
+	if (!block->empty())
+		put(key, *block);
+}
+
+bool Database_Cache::deleteBlock(const v3s16 &pos)
+{
+	erase(getBlockAsInteger(pos));
+	return m_db->deleteBlock(pos);
+}
+
+bool Database_Cache::saveBlocks(const std::vector<v3s16> &positions,
+		const std::vector<std::string> &blocks)
+{
+	bool success = m_db->saveBlocks(positions, blocks);
+	// On failure there is no telling which blocks were written
+	for (size_t i = 0; i < positions.size(); i++) {
+		s64 key = getBlockAsInteger(positions[i]);
+		if (success)
+			put(key, blocks[i]);
+		else
+			erase(key);
+	}
+	if (success && m_in_save) {
+		for (size_t i = 0; i < positions.size(); i++)
+			m_transaction_keys.push_back(getBlockAsInteger(positions[i]));
+	}
+	return success;
+}
+
+void Database_Cache::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Only the missing blocks are loaded from the database, in one batch
+	std::vector<size_t> missing;
+	std::vector<v3s16> missing_positions;
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (get(getBlockAsInteger(positions[i]), &(*blocks)[i]))
+			continue;
+		missing.push_back(i);
+		missing_positions.push_back(positions[i]);
+	}
+	countLookups(positions.size() - missing.size(), missing.size());
+	if (missing.empty())
+		return;
+
+	std::vector<std::string> loaded;
+	m_db->loadBlocks(missing_positions, &loaded);
+	for (size_t i = 0; i < missing.size(); i++) {
+		std::string &block = (*blocks)[missing[i]];
+		block.swap(loaded[i]);
+		if (!block.empty())
+			put(getBlockAsInteger(missing_positions[i]), block);
+	}
+}
+
+void Database_Cache::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	m_db->listAllLoadableBlocks(dst);
+}
+
+bool Database_Cache::initialized() const
+{
+	return m_db->initialized();
+}
+
+bool Database_Cache::supportsConcurrentLoads() const
+{
+	// The cache itself is locked
+	return m_db->supportsConcurrentLoads();
+}
+
+u64 Database_Cache::getHits()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_hits;
+}
+
+u64 Database_Cache::getMisses()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_misses;
+}
+
+u64 Database_Cache::getSize()
+{
+	MutexAutoLock lock(m_mutex);
+	return m_size;
+}
+
+u64 Database_Cache::getEntrySize(const std::string &data)
+{
+	// Roughly accounts for the list node and the index entry too
+	return data.size() + sizeof(Entry) + 64;
+}
+
+bool Database_Cache::get(s64 key, std::string *data)
+{
+	MutexAutoLock lock(m_mutex);
+	UNORDERED_MAP<s64, EntryList::iterator>::iterator it = m_index.find(key);
+	if (it == m_index.end())
+		return false;
+
+	// Move to the front
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	*data = it->second->data;
+	return true;
+}
+
+void Database_Cache::put(s64 key, const std::string &data)
+{
+	MutexAutoLock lock(m_mutex);
+	UNORDERED_MAP<s64, EntryList::iterator>::iterator it = m_index.find(key);
+	if (it != m_index.end()) {
+		m_size -= getEntrySize(it->second->data);
+		m_entries.erase(it->second);
+		m_index.erase(it);
+	}
+
+	u64 size = getEntrySize(data);
+	if (size > m_capacity)
+		return;
+
+	// Evict the least recently used blocks
+	while (m_size + size > m_capacity) {
+		Entry &oldest = m_entries.back();
+		m_size -= getEntrySize(oldest.data);
+		m_index.erase(oldest.key);
+		m_entries.pop_back();
+	}
+
+	m_entries.push_front(Entry());
+	Entry &entry = m_entries.front();
+	entry.key = key;
+	entry.data = data;
+	m_index[key] = m_entries.begin();
+	m_size += size;
+}
+
+void Database_Cache::erase(s64 key)
+{
+	MutexAutoLock lock(m_mutex);
+	UNORDERED_MAP<s64, EntryList::iterator>::iterator it = m_index.find(key);
+	if (it == m_index.end())
+		return;
+
+	m_size -= getEntrySize(it->second->data);
+	m_entries.erase(it->second);
+	m_index.erase(it);
+}
+
+void Database_Cache::countLookups(u32 hits, u32 misses)
+{
+	{
+		MutexAutoLock lock(m_mutex);
+		m_hits += hits;
+		m_misses += misses;
+	}
+	g_profiler->add("Database cache: hits", hits);
+	g_profiler->add("Database cache: misses", misses);
+}
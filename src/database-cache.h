@@ -0,0 +1,100 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef DATABASE_CACHE_HEADER
+#define DATABASE_CACHE_HEADER
+
+#include <list>
+#include <string>
+#include <vector>
+#include "database.h"
+#include "irrlichttypes.h"
+#include "threading/mutex.h"
+#include "util/cpp11_container.h"
+
+/*
+	Keeps the most recently saved and loaded blocks of another database in
+	memory, so that blocks that are unloaded and loaded again soon after
+	(players walking back and forth) are not read and decompressed again.
+
+	Blocks that are not found are not cached. Takes ownership of the
+	wrapped database.
+*/
+
+class Database_Cache : public Database
+{
+public:
+	// capacity: bytes of block data (plus bookkeeping) to keep at most
+	Database_Cache(Database *db, u64 capacity);
+	~Database_Cache();
+
+	void beginSave();
+	void endSave();
+
+	bool saveBlock(const v3s16 &pos, const std::string &data);
+	void loadBlock(const v3s16 &pos, std::string *block);
+	bool deleteBlock(const v3s16 &pos);
+
+	bool saveBlocks(const std::vector<v3s16> &positions,
+			const std::vector<std::string> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	bool initialized() const;
+	bool supportsConcurrentLoads() const;
+
+	u64 getHits();
+	u64 getMisses();
+	u64 getSize();
+
+private:
+	struct Entry {
+		s64 key;
+		std::string data;
+	};
+	typedef std::list<Entry> EntryList;
+
+	static u64 getEntrySize(const std::string &data);
+
+	// Returns false if the block isn't cached
+	bool get(s64 key, std::string *data);
+	void put(s64 key, const std::string &data);
+	void erase(s64 key);
+	void countLookups(u32 hits, u32 misses);
+
+	Database *m_db;
+	u64 m_capacity;
+
+	bool m_in_save;
+	// Blocks saved since beginSave(), dropped if the commit fails
+	std::vector<s64> m_transaction_keys;
+
+	Mutex m_mutex;
+	// Most recently used first
+	EntryList m_entries;
+	UNORDERED_MAP<s64, EntryList::iterator> m_index;
+	u64 m_size;
+	u64 m_hits;
+	u64 m_misses;
+};
+
+#endif
@@ -29,6 +29,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include "leveldb/write_batch.h"
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -87,6 +88,44 @@ bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 	return true;
 }
 
+bool Database_LevelDB::saveBlocks(const std::vector<v3s16> &positions,
+		const std::vector<std::string> &blocks)
+{
+	// Applied in order, so later duplicates win
+	leveldb::WriteBatch batch;
+	for (size_t i = 0; i < positions.size(); i++)
+		batch.Put(i64tos(getBlockAsInteger(positions[i])), blocks[i]);
+
+	leveldb::Status status = m_database->Write(leveldb::WriteOptions(), &batch);
+	if (!status.ok()) {
+		warningstream << "saveBlocks: LevelDB error saving "
+			<< positions.size() << " blocks: " << status.ToString()
+			<< std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// LevelDB has no multi-get, reading from a single snapshot at least
+	// gives a consistent view of all blocks
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+	for (size_t i = 0; i < positions.size(); i++) {
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(positions[i])), &(*blocks)[i]);
+		if (!status.ok())
+			(*blocks)[i].clear();
+	}
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
 void Database_LevelDB::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	leveldb::Iterator* it = m_database->NewIterator(leveldb::ReadOptions());
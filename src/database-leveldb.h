@@ -37,6 +37,10 @@ class Database_LevelDB : public Database
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	bool saveBlocks(const std::vector<v3s16> &positions,
+			const std::vector<std::string> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 private:
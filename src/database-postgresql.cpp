@@ -39,11 +39,39 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "exceptions.h"
 #include "settings.h"
+#include "util/cpp11_container.h"
+#include "util/serialize.h"
+
+#include <cstring>
+#include <sstream>
+
+// Blocks per batched statement
+#define BATCH_SIZE 32
+
+// Header of the binary COPY format: signature, flags, extension length
+static const char COPY_HEADER[19] = {
+	'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0',
+	0, 0, 0, 0, 0, 0, 0, 0
+};
+// Field count of -1 ends the data
+static const char COPY_TRAILER[2] = { '\377', '\377' };
+
+// For results in binary format
+static inline s32 pg_binary_to_int(PGresult *res, int row, int col)
+{
+	u32 val;
+	memcpy(&val, PQgetvalue(res, row, col), sizeof(val));
+	return ntohl(val);
+}
 
 Database_PostgreSQL::Database_PostgreSQL(const Settings &conf) :
 	m_connect_string(""),
 	m_conn(NULL),
-	m_pgversion(0)
+	m_pgversion(0),
+	m_in_save(false),
+	m_copying(false),
+	m_copy_seq(0),
+	m_save_failed(false)
 {
 	if (!conf.getNoEx("pgsql_connection", m_connect_string)) {
 		throw SettingNotFoundException(
@@ -102,6 +130,16 @@ void Database_PostgreSQL::verifyDatabase()
 
 	PQreset(m_conn);
 	ping();
+	// Prepared statements and temporary tables belong to the connection
+	initStatements();
+
+	// The open transaction was lost, saves go on in a new one, but the
+	// commit has to fail
+	m_copying = false;
+	if (m_in_save) {
+		checkResults(PQexec(m_conn, "BEGIN;"));
+		m_save_failed = true;
+	}
 }
 
 void Database_PostgreSQL::ping()
@@ -136,6 +174,37 @@ void Database_PostgreSQL::initStatements()
 
 	prepareStatement("list_all_loadable_blocks",
 			"SELECT posX, posY, posZ FROM blocks");
+
+	// Any number of positions, given as three arrays of coordinates
+	prepareStatement("read_blocks",
+			"SELECT b.posX, b.posY, b.posZ, b.data FROM blocks b "
+			"JOIN unnest($1::int4[], $2::int4[], $3::int4[]) AS p(x, y, z) "
+			"ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
+
+	// Temporary tables belong to the connection
+	checkResults(PQexec(m_conn,
+			"CREATE TEMPORARY TABLE IF NOT EXISTS blocks_save ("
+			"posX INT NOT NULL, posY INT NOT NULL, posZ INT NOT NULL, "
+			"seq INT NOT NULL, data BYTEA) ON COMMIT DELETE ROWS"));
+
+	// An upsert may not touch the same row twice, keep the last copy
+	prepareStatement("write_saved_blocks",
+			"INSERT INTO blocks (posX, posY, posZ, data) "
+			"SELECT DISTINCT ON (posX, posY, posZ) posX, posY, posZ, data "
+			"FROM blocks_save ORDER BY posX, posY, posZ, seq DESC "
+			"ON CONFLICT ON CONSTRAINT blocks_pkey DO "
+			"UPDATE SET data = EXCLUDED.data");
+
+	std::ostringstream write_batch;
+	write_batch << "INSERT INTO blocks (posX, posY, posZ, data) VALUES ";
+	for (u32 i = 0; i < BATCH_SIZE; i++) {
+		write_batch << (i == 0 ? "" : ", ") << "($" << 4 * i + 1
+			<< "::int4, $" << 4 * i + 2 << "::int4, $" << 4 * i + 3
+			<< "::int4, $" << 4 * i + 4 << "::bytea)";
+	}
+	write_batch << " ON CONFLICT ON CONSTRAINT blocks_pkey DO "
+		"UPDATE SET data = EXCLUDED.data";
+	prepareStatement("write_blocks", write_batch.str());
 }
 
 PGresult *Database_PostgreSQL::checkResults(PGresult *result, bool clear)
@@ -147,10 +216,12 @@ PGresult *Database_PostgreSQL::checkResults(PGresult *result, bool clear)
 	case PGRES_TUPLES_OK:
 		break;
 	case PGRES_FATAL_ERROR:
-	default:
+	default: {
+		std::string error = PQresultErrorMessage(result);
+		PQclear(result);
 		throw DatabaseException(
-			std::string("PostgreSQL database error: ") +
-			PQresultErrorMessage(result));
+			std::string("PostgreSQL database error: ") + error);
+	}
 	}
 
 	if (clear)
@@ -187,11 +258,116 @@ void Database_PostgreSQL::beginSave()
 {
 	verifyDatabase();
 	checkResults(PQexec(m_conn, "BEGIN;"));
+	m_in_save = true;
+	m_save_failed = false;
 }
 
 void Database_PostgreSQL::endSave()
 {
-	checkResults(PQexec(m_conn, "COMMIT;"));
+	try {
+		flushSaves();
+		// COMMIT of an aborted transaction rolls it back without an error
+		if (m_save_failed ||
+				PQtransactionStatus(m_conn) != PQTRANS_INTRANS) {
+			throw DatabaseException("PostgreSQL database error: "
+				"The transaction was aborted");
+		}
+		checkResults(PQexec(m_conn, "COMMIT;"));
+	} catch (DatabaseException &e) {
+		abortSave();
+		throw;
+	}
+	m_in_save = false;
+}
+
+void Database_PostgreSQL::abortSave()
+{
+	m_in_save = false;
+	m_copying = false;
+	if (PQstatus(m_conn) != CONNECTION_OK)
+		return;
+
+	// Leave a COPY that failed halfway
+	if (PQtransactionStatus(m_conn) == PQTRANS_ACTIVE) {
+		PQputCopyEnd(m_conn, "Save aborted");
+		PGresult *result;
+		while ((result = PQgetResult(m_conn)))
+			PQclear(result);
+	}
+	if (PQtransactionStatus(m_conn) != PQTRANS_IDLE)
+		PQclear(PQexec(m_conn, "ROLLBACK;"));
+}
+
+void Database_PostgreSQL::beginCopy()
+{
+	PGresult *result = PQexec(m_conn,
+		"COPY blocks_save FROM STDIN (FORMAT binary)");
+	if (PQresultStatus(result) != PGRES_COPY_IN)
+		checkResults(result);
+	PQclear(result);
+
+	if (PQputCopyData(m_conn, COPY_HEADER, sizeof(COPY_HEADER)) != 1) {
+		throw DatabaseException(std::string(
+			"PostgreSQL database error: ") + PQerrorMessage(m_conn));
+	}
+	m_copying = true;
+	m_copy_seq = 0;
+}
+
+void Database_PostgreSQL::copyBlock(const v3s16 &pos,
+		const std::string &data)
+{
+	if (!m_copying)
+		beginCopy();
+
+	/*
+		u16 field count
+		for every field: s32 length, data
+	*/
+	u8 row[2 + 4 * 8 + 4];
+	writeU16(&row[0], 5);
+	s32 values[4] = { pos.X, pos.Y, pos.Z, m_copy_seq++ };
+	for (u32 i = 0; i < 4; i++) {
+		writeU32(&row[2 + 8 * i], sizeof(s32));
+		writeU32(&row[2 + 8 * i + 4], values[i]);
+	}
+	writeU32(&row[2 + 4 * 8], data.size());
+
+	if (PQputCopyData(m_conn, (const char *)row, sizeof(row)) != 1 ||
+			PQputCopyData(m_conn, data.c_str(), data.size()) != 1) {
+		throw DatabaseException(std::string(
+			"PostgreSQL database error: ") + PQerrorMessage(m_conn));
+	}
+}
+
+void Database_PostgreSQL::flushSaves()
+{
+	if (!m_copying)
+		return;
+	m_copying = false;
+
+	if (PQputCopyData(m_conn, COPY_TRAILER, sizeof(COPY_TRAILER)) != 1 ||
+			PQputCopyEnd(m_conn, NULL) != 1) {
+		throw DatabaseException(std::string(
+			"PostgreSQL database error: ") + PQerrorMessage(m_conn));
+	}
+	// Read every result, so that the connection is ready for the next
+	// query even if the COPY failed
+	std::string error;
+	PGresult *result;
+	while ((result = PQgetResult(m_conn))) {
+		if (PQresultStatus(result) != PGRES_COMMAND_OK && error.empty())
+			error = PQresultErrorMessage(result);
+		PQclear(result);
+	}
+	if (!error.empty()) {
+		throw DatabaseException(std::string(
+			"PostgreSQL database error: ") + error);
+	}
+
+	execPrepared("write_saved_blocks", 0, NULL);
+	// Don't upsert the same rows again if the transaction goes on
+	checkResults(PQexec(m_conn, "TRUNCATE blocks_save"));
 }
 
 bool Database_PostgreSQL::saveBlock(const v3s16 &pos,
@@ -207,6 +383,11 @@ bool Database_PostgreSQL::saveBlock(const v3s16 &pos,
 
 	verifyDatabase();
 
+	if (m_in_save) {
+		copyBlock(pos, data);
+		return true;
+	}
+
 	s32 x, y, z;
 	x = htonl(pos.X);
 	y = htonl(pos.Y);
@@ -226,6 +407,7 @@ void Database_PostgreSQL::loadBlock(const v3s16 &pos,
 		std::string *block)
 {
 	verifyDatabase();
+	flushSaves();
 
 	s32 x, y, z;
 	x = htonl(pos.X);
@@ -252,6 +434,7 @@ void Database_PostgreSQL::loadBlock(const v3s16 &pos,
 bool Database_PostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
+	flushSaves();
 
 	s32 x, y, z;
 	x = htonl(pos.X);
@@ -262,14 +445,139 @@ bool Database_PostgreSQL::deleteBlock(const v3s16 &pos)
 	const int argLen[] = { sizeof(x), sizeof(y), sizeof(z) };
 	const int argFmt[] = { 1, 1, 1 };
 
-	execPrepared("read_block", ARRLEN(args), args, argLen, argFmt);
+	execPrepared("delete_block", ARRLEN(args), args, argLen, argFmt);
 
 	return true;
 }
 
+bool Database_PostgreSQL::saveBlocks(const std::vector<v3s16> &positions,
+		const std::vector<std::string> &blocks)
+{
+	verifyDatabase();
+
+	if (m_in_save) {
+		bool success = true;
+		for (size_t i = 0; i < positions.size(); i++) {
+			if (blocks[i].size() > INT_MAX) {
+				errorstream << "Database_PostgreSQL::saveBlocks: Data "
+						<< "truncation! Not saving block "
+						<< PP(positions[i]) << std::endl;
+				success = false;
+				continue;
+			}
+			copyBlock(positions[i], blocks[i]);
+		}
+		return success;
+	}
+
+	// An upsert may not touch the same row twice, keep the last duplicate
+	UNORDERED_MAP<s64, size_t> last;
+	for (size_t i = 0; i < positions.size(); i++)
+		last[getBlockAsInteger(positions[i])] = i;
+
+	bool success = true;
+	std::vector<size_t> todo;
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (last[getBlockAsInteger(positions[i])] != i)
+			continue;
+		if (blocks[i].size() > INT_MAX) {
+			errorstream << "Database_PostgreSQL::saveBlocks: Data truncation! "
+					<< "Not saving block " << PP(positions[i]) << std::endl;
+			success = false;
+			continue;
+		}
+		todo.push_back(i);
+	}
+
+	size_t n = 0;
+	s32 coords[3 * BATCH_SIZE];
+	const void *args[4 * BATCH_SIZE];
+	int argLen[4 * BATCH_SIZE];
+	int argFmt[4 * BATCH_SIZE];
+	for (; n + BATCH_SIZE <= todo.size(); n += BATCH_SIZE) {
+		for (u32 j = 0; j < BATCH_SIZE; j++) {
+			size_t i = todo[n + j];
+			coords[3 * j] = htonl(positions[i].X);
+			coords[3 * j + 1] = htonl(positions[i].Y);
+			coords[3 * j + 2] = htonl(positions[i].Z);
+			for (u32 k = 0; k < 3; k++) {
+				args[4 * j + k] = &coords[3 * j + k];
+				argLen[4 * j + k] = sizeof(s32);
+			}
+			args[4 * j + 3] = blocks[i].c_str();
+			argLen[4 * j + 3] = blocks[i].size();
+		}
+		for (u32 k = 0; k < ARRLEN(argFmt); k++)
+			argFmt[k] = 1;
+
+		execPrepared("write_blocks", ARRLEN(args), args, argLen, argFmt);
+	}
+
+	for (; n < todo.size(); n++) {
+		if (!saveBlock(positions[todo[n]], blocks[todo[n]]))
+			success = false;
+	}
+
+	return success;
+}
+
+void Database_PostgreSQL::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+	flushSaves();
+
+	blocks->clear();
+	blocks->resize(positions.size());
+	if (positions.empty())
+		return;
+
+	// Arrays in text format, {x1,x2,...}
+	std::ostringstream coords[3];
+	for (size_t i = 0; i < positions.size(); i++) {
+		const char *sep = i == 0 ? "{" : ",";
+		coords[0] << sep << positions[i].X;
+		coords[1] << sep << positions[i].Y;
+		coords[2] << sep << positions[i].Z;
+	}
+	std::string arrays[3];
+	for (u32 k = 0; k < 3; k++)
+		arrays[k] = coords[k].str() + "}";
+
+	const void *args[] = {
+		arrays[0].c_str(), arrays[1].c_str(), arrays[2].c_str()
+	};
+	const int argLen[] = { -1, -1, -1 };
+	const int argFmt[] = { 0, 0, 0 };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args,
+			argLen, argFmt, false);
+
+	// A position may be wanted more than once
+	UNORDERED_MAP<s64, int> rows;
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; row++) {
+		v3s16 pos(pg_binary_to_int(results, row, 0),
+			pg_binary_to_int(results, row, 1),
+			pg_binary_to_int(results, row, 2));
+		rows[getBlockAsInteger(pos)] = row;
+	}
+	for (size_t i = 0; i < positions.size(); i++) {
+		UNORDERED_MAP<s64, int>::const_iterator it =
+			rows.find(getBlockAsInteger(positions[i]));
+		if (it != rows.end()) {
+			(*blocks)[i].assign(PQgetvalue(results, it->second, 3),
+				PQgetlength(results, it->second, 3));
+		}
+	}
+
+	PQclear(results);
+}
+
 void Database_PostgreSQL::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
+	flushSaves();
 
 	PGresult *results = execPrepared("list_all_loadable_blocks", 0,
 			NULL, NULL, NULL, false, false);
@@ -277,7 +585,7 @@ void Database_PostgreSQL::listAllLoadableBlocks(std::vector<v3s16> &dst)
 	int numrows = PQntuples(results);
 
 	for (int row = 0; row < numrows; ++row) {
-		dst.push_back(pg_to_v3s16(results, 0, 0));
+		dst.push_back(pg_to_v3s16(results, row, 0));
 	}
 
 	PQclear(results);
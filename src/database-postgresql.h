@@ -34,11 +34,16 @@ class Database_PostgreSQL : public Database
 	~Database_PostgreSQL();
 
 	void beginSave();
+	// Throws DatabaseException and rolls back if the transaction failed
 	void endSave();
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	bool saveBlocks(const std::vector<v3s16> &positions,
+			const std::vector<std::string> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	bool initialized() const;
 
@@ -57,6 +62,19 @@ class Database_PostgreSQL : public Database
 	void ping();
 	void verifyDatabase();
 
+	/*
+		Blocks saved between beginSave() and endSave() are streamed into
+		the temporary table blocks_save with COPY, and written to blocks
+		by a single upsert when the transaction ends.
+	*/
+	void beginCopy();
+	void copyBlock(const v3s16 &pos, const std::string &data);
+	// Ends the COPY and upserts the copied blocks, if any. Must be called
+	// before any other query, which can't run during a COPY.
+	void flushSaves();
+	// Rolls back after a failure, leaving the connection usable
+	void abortSave();
+
 	// Database usage
 	PGresult *checkResults(PGresult *res, bool clear = true);
 
@@ -89,6 +107,13 @@ class Database_PostgreSQL : public Database
 	std::string m_connect_string;
 	PGconn *m_conn;
 	int m_pgversion;
+
+	bool m_in_save;
+	bool m_copying;
+	// Order of the copied rows, the latest one of a block wins
+	s32 m_copy_seq;
+	// Set if saves of the transaction were lost with the connection
+	bool m_save_failed;
 };
 
 #endif
@@ -27,12 +27,21 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "exceptions.h"
 #include "util/string.h"
+#include "util/basic_macros.h"
 
 #include <hiredis.h>
 #include <cassert>
 
+// Keys per HMGET command of loadBlocks()
+#define LOAD_BATCH_SIZE 256
+// Saves sent before reading their replies, so that the client doesn't
+// buffer the replies of a whole save. The server still queues the
+// commands inside MULTI until EXEC.
+#define MAX_PENDING_SAVES 1024
 
-Database_Redis::Database_Redis(Settings &conf)
+
+Database_Redis::Database_Redis(Settings &conf) :
+	m_in_save(false)
 {
 	std::string tmp;
 	try {
@@ -66,39 +75,106 @@ void Database_Redis::beginSave() {
 			"Redis command 'MULTI' failed: ") + ctx->errstr);
 	}
 	freeReplyObject(reply);
+	m_in_save = true;
+	m_transaction_saves.clear();
 }
 
 void Database_Redis::endSave() {
-	redisReply *reply = static_cast<redisReply *>(redisCommand(ctx, "EXEC"));
-	if (!reply) {
+	m_in_save = false;
+	std::vector<v3s16> saves;
+	saves.swap(m_transaction_saves);
+
+	// Send EXEC along with the last saves, so the whole transaction
+	// takes a single round trip after MULTI
+	if (redisAppendCommand(ctx, "EXEC") != REDIS_OK) {
+		throw DatabaseException(std::string(
+			"Redis command 'EXEC' failed: ") + ctx->errstr);
+	}
+	readSaveReplies();
+
+	redisReply *reply;
+	if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
 		throw DatabaseException(std::string(
 			"Redis command 'EXEC' failed: ") + ctx->errstr);
 	}
+
+	// EXEC replies with the results of the queued commands, in order
+	std::string errstr;
+	size_t failed = 0;
+	if (reply->type == REDIS_REPLY_ERROR) {
+		errstr = std::string(reply->str, reply->len);
+		failed = saves.size();
+	} else if (reply->type != REDIS_REPLY_ARRAY
+			|| reply->elements != saves.size()) {
+		errstr = "invalid reply";
+		failed = saves.size();
+	} else {
+		for (size_t i = 0; i < saves.size(); i++) {
+			redisReply *element = reply->element[i];
+			if (element->type != REDIS_REPLY_ERROR)
+				continue;
+			errstr = std::string(element->str, element->len);
+			warningstream << "endSave: saving block " << PP(saves[i])
+				<< " failed: " << errstr << std::endl;
+			failed++;
+		}
+	}
 	freeReplyObject(reply);
+
+	if (failed > 0) {
+		throw DatabaseException("Redis transaction failed to save "
+			+ itos(failed) + " of " + itos(saves.size()) + " blocks: "
+			+ errstr);
+	}
 }
 
-bool Database_Redis::saveBlock(const v3s16 &pos, const std::string &data)
+void Database_Redis::appendSave(const v3s16 &pos, const std::string &data)
 {
-	std::string tmp = i64tos(getBlockAsInteger(pos));
+	if (m_pending_saves.size() >= MAX_PENDING_SAVES)
+		readSaveReplies();
 
-	redisReply *reply = static_cast<redisReply *>(redisCommand(ctx, "HSET %s %s %b",
-			hash.c_str(), tmp.c_str(), data.c_str(), data.size()));
-	if (!reply) {
-		warningstream << "saveBlock: redis command 'HSET' failed on "
-			"block " << PP(pos) << ": " << ctx->errstr << std::endl;
-		freeReplyObject(reply);
-		return false;
+	std::string tmp = i64tos(getBlockAsInteger(pos));
+	if (redisAppendCommand(ctx, "HSET %s %s %b", hash.c_str(),
+			tmp.c_str(), data.c_str(), data.size()) != REDIS_OK) {
+		throw DatabaseException(std::string(
+			"Redis command 'HSET' failed: ") + ctx->errstr);
 	}
+	m_pending_saves.push_back(pos);
+	if (m_in_save)
+		m_transaction_saves.push_back(pos);
+}
 
-	if (reply->type == REDIS_REPLY_ERROR) {
-		warningstream << "saveBlock: saving block " << PP(pos)
-			<< " failed: " << std::string(reply->str, reply->len) << std::endl;
+bool Database_Redis::readSaveReplies()
+{
+	// Within a transaction the replies only tell whether the commands
+	// were queued, EXEC runs them
+	bool success = true;
+	for (size_t i = 0; i < m_pending_saves.size(); i++) {
+		redisReply *reply;
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+			m_pending_saves.clear();
+			throw DatabaseException(std::string(
+				"Redis command 'HSET' failed: ") + ctx->errstr);
+		}
+		if (reply->type == REDIS_REPLY_ERROR) {
+			warningstream << "saveBlock: saving block "
+				<< PP(m_pending_saves[i]) << " failed: "
+				<< std::string(reply->str, reply->len) << std::endl;
+			success = false;
+		}
 		freeReplyObject(reply);
-		return false;
 	}
+	m_pending_saves.clear();
+	return success;
+}
 
-	freeReplyObject(reply);
-	return true;
+bool Database_Redis::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	appendSave(pos, data);
+	// Failures within a transaction are reported by endSave()
+	if (m_in_save)
+		return true;
+	return readSaveReplies();
 }
 
 void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
@@ -143,6 +219,82 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+bool Database_Redis::saveBlocks(const std::vector<v3s16> &positions,
+		const std::vector<std::string> &blocks)
+{
+	for (size_t i = 0; i < positions.size(); i++)
+		appendSave(positions[i], blocks[i]);
+	if (m_in_save)
+		return true;
+	return readSaveReplies();
+}
+
+void Database_Redis::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	// Pipelined: send all HMGETs, then read all replies
+	size_t num_commands = 0;
+	for (size_t i = 0; i < positions.size(); i += LOAD_BATCH_SIZE) {
+		size_t count = MYMIN(LOAD_BATCH_SIZE, positions.size() - i);
+
+		std::vector<std::string> keys(count);
+		std::vector<const char *> argv(count + 2);
+		std::vector<size_t> argvlen(count + 2);
+		argv[0] = "HMGET";
+		argvlen[0] = 5;
+		argv[1] = hash.c_str();
+		argvlen[1] = hash.size();
+		for (size_t j = 0; j < count; j++) {
+			keys[j] = i64tos(getBlockAsInteger(positions[i + j]));
+			argv[j + 2] = keys[j].c_str();
+			argvlen[j + 2] = keys[j].size();
+		}
+
+		if (redisAppendCommandArgv(ctx, argv.size(), &argv[0],
+				&argvlen[0]) != REDIS_OK) {
+			throw DatabaseException(std::string(
+				"Redis command 'HMGET' failed: ") + ctx->errstr);
+		}
+		num_commands++;
+	}
+
+	// Every reply is read before failing, so that later commands don't
+	// get the replies of these
+	std::string errstr;
+	for (size_t n = 0; n < num_commands; n++) {
+		redisReply *reply;
+		if (redisGetReply(ctx, (void **)&reply) != REDIS_OK) {
+			throw DatabaseException(std::string(
+				"Redis command 'HMGET' failed: ") + ctx->errstr);
+		}
+
+		size_t i = n * LOAD_BATCH_SIZE;
+		size_t count = MYMIN(LOAD_BATCH_SIZE, positions.size() - i);
+		if (reply->type != REDIS_REPLY_ARRAY || reply->elements != count) {
+			errstr = reply->type == REDIS_REPLY_ERROR ?
+				std::string(reply->str, reply->len) : "invalid reply";
+			freeReplyObject(reply);
+			continue;
+		}
+
+		for (size_t j = 0; j < count; j++) {
+			redisReply *element = reply->element[j];
+			// Missing blocks are NIL
+			if (element->type == REDIS_REPLY_STRING)
+				(*blocks)[i + j].assign(element->str, element->len);
+		}
+		freeReplyObject(reply);
+	}
+
+	if (!errstr.empty()) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET' errored: ") + errstr);
+	}
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
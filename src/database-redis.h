@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database.h"
 #include <hiredis.h>
 #include <string>
+#include <vector>
 
 class Settings;
 
@@ -37,16 +38,35 @@ class Database_Redis : public Database
 	~Database_Redis();
 
 	void beginSave();
+	// Throws DatabaseException if any save of the transaction failed
 	void endSave();
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	bool saveBlocks(const std::vector<v3s16> &positions,
+			const std::vector<std::string> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 private:
+	// Sends HSET along with the other pipelined commands
+	void appendSave(const v3s16 &pos, const std::string &data);
+	// Reads the replies to the pipelined HSETs, returns false if any failed
+	bool readSaveReplies();
+
 	redisContext *ctx;
 	std::string hash;
+
+	// Saves between beginSave() and endSave() are only sent, their
+	// replies are read at the end of the transaction
+	bool m_in_save;
+	// Blocks of the HSETs whose replies have not been read yet
+	std::vector<v3s16> m_pending_saves;
+	// Blocks of the HSETs of the transaction, in the order of the
+	// results of EXEC
+	std::vector<v3s16> m_transaction_saves;
 };
 
 #endif // USE_REDIS
@@ -33,6 +33,8 @@ SQLite format specification:
 #include "settings.h"
 #include "porting.h"
 #include "util/string.h"
+#include "util/basic_macros.h"
+#include "threading/mutex_auto_lock.h"
 
 #include <cassert>
 
@@ -44,6 +46,10 @@ SQLite format specification:
 #define BUSY_FATAL_TRESHOLD	3000	// Allow SQLITE_BUSY to be returned, which will cause a minetest crash.
 #define BUSY_ERROR_INTERVAL	10000	// Safety net: report again every 10 seconds
 
+// Blocks per batched statement, two variables each stay well below
+// SQLITE_MAX_VARIABLE_NUMBER
+#define BATCH_SIZE 64
+
 
 #define SQLRES(s, r, m) \
 	if ((s) != (r)) { \
@@ -120,7 +126,10 @@ Database_SQLite3::Database_SQLite3(const std::string &savedir) :
 	m_stmt_list(NULL),
 	m_stmt_delete(NULL),
 	m_stmt_begin(NULL),
-	m_stmt_end(NULL)
+	m_stmt_end(NULL),
+	m_stmt_read_batch(NULL),
+	m_stmt_write_batch(NULL),
+	m_num_readers(g_settings->getU16("sqlite_read_connections"))
 {
 }
 
@@ -170,10 +179,70 @@ void Database_SQLite3::openDatabase()
 			 + itos(g_settings->getU16("sqlite_synchronous"));
 	SQLOK(sqlite3_exec(m_database, query_str.c_str(), NULL, NULL, NULL),
 		"Failed to modify sqlite3 synchronous mode");
+
+	// Readers and the writer only stay out of each other's way in WAL mode.
+	// The mode is stored in the database file.
+	if (m_num_readers > 0) {
+		SQLOK(sqlite3_exec(m_database, "PRAGMA journal_mode = WAL",
+				NULL, NULL, NULL),
+			"Failed to enable sqlite3 WAL mode");
+	}
+}
+
+void Database_SQLite3::openReadConnections()
+{
+	std::string dbp = m_savedir + DIR_DELIM + "map.sqlite";
+
+	m_readers.resize(m_num_readers);
+	for (u32 i = 0; i < m_num_readers; i++) {
+		ReadConnection &conn = m_readers[i];
+		conn.database = NULL;
+		conn.stmt_read = NULL;
+		conn.stmt_read_batch = NULL;
+
+		if (sqlite3_open_v2(dbp.c_str(), &conn.database,
+				SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ||
+				sqlite3_busy_handler(conn.database,
+					Database_SQLite3::busyHandler,
+					conn.busy_handler_data) != SQLITE_OK ||
+				sqlite3_prepare_v2(conn.database,
+					"SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1",
+					-1, &conn.stmt_read, NULL) != SQLITE_OK) {
+			throw DatabaseException(std::string("Failed to open SQLite3 "
+				"read connection: ") + sqlite3_errmsg(conn.database));
+		}
+		prepareBatchStatement(conn.database, &conn.stmt_read_batch,
+			"SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN (", "?", ")");
+
+		m_free_readers.push_back(&conn);
+	}
+	m_free_readers_sem.post(m_num_readers);
+
+	verbosestream << "ServerMap: Opened " << m_num_readers
+		<< " SQLite3 read connections." << std::endl;
+}
+
+Database_SQLite3::ReadConnection *Database_SQLite3::acquireReadConnection()
+{
+	m_free_readers_sem.wait();
+	MutexAutoLock lock(m_readers_mutex);
+	ReadConnection *conn = m_free_readers.back();
+	m_free_readers.pop_back();
+	return conn;
+}
+
+void Database_SQLite3::releaseReadConnection(ReadConnection *conn)
+{
+	{
+		MutexAutoLock lock(m_readers_mutex);
+		m_free_readers.push_back(conn);
+	}
+	m_free_readers_sem.post();
 }
 
 void Database_SQLite3::verifyDatabase()
 {
+	MutexAutoLock lock(m_init_mutex);
 	if (m_initialized) return;
 
 	openDatabase();
@@ -188,6 +257,14 @@ void Database_SQLite3::verifyDatabase()
 #endif
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
+	prepareBatchStatement(m_database, &m_stmt_read_batch,
+		"SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN (", "?", ")");
+	prepareBatchStatement(m_database, &m_stmt_write_batch,
+		"REPLACE INTO `blocks` (`pos`, `data`) VALUES ", "(?, ?)", "");
+
+	// After the writer, which creates the database and switches it to WAL
+	if (m_num_readers > 0)
+		openReadConnections();
 
 	m_initialized = true;
 
@@ -200,6 +277,24 @@ inline void Database_SQLite3::bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int
 		"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
 }
 
+void Database_SQLite3::prepareBatchStatement(sqlite3 *database,
+		sqlite3_stmt **stmt, const std::string &head, const std::string &row,
+		const std::string &tail)
+{
+	std::string query = head;
+	for (u32 i = 0; i < BATCH_SIZE; i++) {
+		if (i != 0)
+			query += ", ";
+		query += row;
+	}
+	query += tail;
+
+	if (sqlite3_prepare_v2(database, query.c_str(), -1, stmt, NULL) != SQLITE_OK) {
+		throw DatabaseException("Failed to prepare query '" + query + "': "
+			+ sqlite3_errmsg(database));
+	}
+}
+
 bool Database_SQLite3::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -247,21 +342,126 @@ void Database_SQLite3::loadBlock(const v3s16 &pos, std::string *block)
 {
 	verifyDatabase();
 
-	bindPos(m_stmt_read, pos);
+	if (m_num_readers == 0) {
+		readBlock(m_stmt_read, pos, block);
+		return;
+	}
+
+	ReadConnection *conn = acquireReadConnection();
+	try {
+		readBlock(conn->stmt_read, pos, block);
+	} catch (...) {
+		releaseReadConnection(conn);
+		throw;
+	}
+	releaseReadConnection(conn);
+}
 
-	if (sqlite3_step(m_stmt_read) != SQLITE_ROW) {
-		sqlite3_reset(m_stmt_read);
+void Database_SQLite3::readBlock(sqlite3_stmt *stmt, const v3s16 &pos,
+		std::string *block)
+{
+	bindPos(stmt, pos);
+
+	if (sqlite3_step(stmt) != SQLITE_ROW) {
+		sqlite3_reset(stmt);
 		return;
 	}
 
-	const char *data = (const char *) sqlite3_column_blob(m_stmt_read, 0);
-	size_t len = sqlite3_column_bytes(m_stmt_read, 0);
+	const char *data = (const char *) sqlite3_column_blob(stmt, 0);
+	size_t len = sqlite3_column_bytes(stmt, 0);
 
 	*block = (data) ? std::string(data, len) : "";
 
-	sqlite3_step(m_stmt_read);
+	sqlite3_step(stmt);
 	// We should never get more than 1 row, so ok to reset
-	sqlite3_reset(m_stmt_read);
+	sqlite3_reset(stmt);
+}
+
+bool Database_SQLite3::saveBlocks(const std::vector<v3s16> &positions,
+		const std::vector<std::string> &blocks)
+{
+#ifdef __ANDROID__
+	// REPLACE doesn't work there, see saveBlock()
+	return Database::saveBlocks(positions, blocks);
+#else
+	verifyDatabase();
+
+	// Rows of a single REPLACE are inserted in order,
+	// so later duplicates still win
+	size_t i = 0;
+	for (; i + BATCH_SIZE <= positions.size(); i += BATCH_SIZE) {
+		for (u32 j = 0; j < BATCH_SIZE; j++) {
+			const std::string &data = blocks[i + j];
+			bindPos(m_stmt_write_batch, positions[i + j], 2 * j + 1);
+			SQLOK(sqlite3_bind_blob(m_stmt_write_batch, 2 * j + 2,
+					data.data(), data.size(), NULL),
+				"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+		}
+		SQLRES(sqlite3_step(m_stmt_write_batch), SQLITE_DONE,
+			"Failed to save blocks")
+		sqlite3_reset(m_stmt_write_batch);
+	}
+
+	bool success = true;
+	for (; i < positions.size(); i++) {
+		if (!saveBlock(positions[i], blocks[i]))
+			success = false;
+	}
+
+	return success;
+#endif
+}
+
+void Database_SQLite3::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	if (m_num_readers == 0) {
+		readBlocks(m_stmt_read_batch, positions, blocks);
+		return;
+	}
+
+	ReadConnection *conn = acquireReadConnection();
+	try {
+		readBlocks(conn->stmt_read_batch, positions, blocks);
+	} catch (...) {
+		releaseReadConnection(conn);
+		throw;
+	}
+	releaseReadConnection(conn);
+}
+
+void Database_SQLite3::readBlocks(sqlite3_stmt *stmt,
+		const std::vector<v3s16> &positions, std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+
+	s64 keys[BATCH_SIZE];
+	for (size_t i = 0; i < positions.size(); i += BATCH_SIZE) {
+		u32 count = MYMIN(BATCH_SIZE, positions.size() - i);
+		// A partial batch repeats its last position
+		for (u32 j = 0; j < BATCH_SIZE; j++) {
+			const v3s16 &pos = positions[i + MYMIN(j, count - 1)];
+			keys[j] = getBlockAsInteger(pos);
+			bindPos(stmt, pos, j + 1);
+		}
+
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			s64 key = sqlite3_column_int64(stmt, 0);
+			const char *data = (const char *) sqlite3_column_blob(stmt, 1);
+			size_t len = sqlite3_column_bytes(stmt, 1);
+			if (!data)
+				continue;
+
+			for (u32 j = 0; j < count; j++) {
+				if (keys[j] == key)
+					(*blocks)[i + j].assign(data, len);
+			}
+		}
+		sqlite3_reset(stmt);
+	}
 }
 
 void Database_SQLite3::createDatabase()
@@ -294,6 +494,17 @@ Database_SQLite3::~Database_SQLite3()
 	FINALIZE_STATEMENT(m_stmt_begin)
 	FINALIZE_STATEMENT(m_stmt_end)
 	FINALIZE_STATEMENT(m_stmt_delete)
+	FINALIZE_STATEMENT(m_stmt_read_batch)
+	FINALIZE_STATEMENT(m_stmt_write_batch)
+
+	for (size_t i = 0; i < m_readers.size(); i++) {
+		sqlite3_finalize(m_readers[i].stmt_read);
+		sqlite3_finalize(m_readers[i].stmt_read_batch);
+		if (sqlite3_close(m_readers[i].database) != SQLITE_OK) {
+			errorstream << "Failed to close database read connection: "
+				<< sqlite3_errmsg(m_readers[i].database) << std::endl;
+		}
+	}
 
 	SQLOK_ERRSTREAM(sqlite3_close(m_database), "Failed to close database");
 }
@@ -21,7 +21,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define DATABASE_SQLITE3_HEADER
 
 #include "database.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
 #include <string>
+#include <vector>
 
 extern "C" {
 	#include "sqlite3.h"
@@ -39,20 +42,54 @@ class Database_SQLite3 : public Database
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
 	bool deleteBlock(const v3s16 &pos);
+	bool saveBlocks(const std::vector<v3s16> &positions,
+			const std::vector<std::string> &blocks);
+	void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	bool initialized() const { return m_initialized; }
+	// Loads go through the read connections, if there are any
+	bool supportsConcurrentLoads() const { return m_num_readers > 0; }
 
 private:
+	/*
+		Read-only connection, used for loading blocks alongside the write
+		connection in WAL mode (see sqlite_read_connections). Each one is
+		used by one thread at a time.
+	*/
+	struct ReadConnection {
+		sqlite3 *database;
+		sqlite3_stmt *stmt_read;
+		sqlite3_stmt *stmt_read_batch;
+		s64 busy_handler_data[2];
+	};
+
 	// Open the database
 	void openDatabase();
 	// Create the database structure
 	void createDatabase();
 	// Open and initialize the database if needed
 	void verifyDatabase();
+	void openReadConnections();
+
+	ReadConnection *acquireReadConnection();
+	void releaseReadConnection(ReadConnection *conn);
+
+	// Runs the statements of m_stmt_read and m_stmt_read_batch
+	void readBlock(sqlite3_stmt *stmt, const v3s16 &pos, std::string *block);
+	void readBlocks(sqlite3_stmt *stmt, const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
 
 	void bindPos(sqlite3_stmt *stmt, const v3s16 &pos, int index=1);
+	// Prepares the statement made of head, row repeated BATCH_SIZE times
+	// (separated by commas), and tail
+	void prepareBatchStatement(sqlite3 *database, sqlite3_stmt **stmt,
+			const std::string &head, const std::string &row,
+			const std::string &tail);
 
 	bool m_initialized;
+	// Loads may happen in other threads than the writes
+	Mutex m_init_mutex;
 
 	std::string m_savedir;
 
@@ -63,9 +100,18 @@ class Database_SQLite3 : public Database
 	sqlite3_stmt *m_stmt_delete;
 	sqlite3_stmt *m_stmt_begin;
 	sqlite3_stmt *m_stmt_end;
+	// Batches of BATCH_SIZE blocks
+	sqlite3_stmt *m_stmt_read_batch;
+	sqlite3_stmt *m_stmt_write_batch;
 
 	s64 m_busy_handler_data[2];
 
+	u32 m_num_readers;
+	std::vector<ReadConnection> m_readers;
+	std::vector<ReadConnection *> m_free_readers;
+	Mutex m_readers_mutex;
+	Semaphore m_free_readers_sem;
+
 	static int busyHandler(void *data, int count);
 };
 
@@ -67,3 +67,24 @@ v3s16 Database::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+
+bool Database::saveBlocks(const std::vector<v3s16> &positions,
+		const std::vector<std::string> &blocks)
+{
+	bool success = true;
+	for (size_t i = 0; i < positions.size(); i++) {
+		if (!saveBlock(positions[i], blocks[i]))
+			success = false;
+	}
+	return success;
+}
+
+
+void Database::loadBlocks(const std::vector<v3s16> &positions,
+		std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+		loadBlock(positions[i], &(*blocks)[i]);
+}
@@ -34,6 +34,8 @@ class Database
 public:
 	virtual ~Database() {}
 
+	// endSave() throws DatabaseException if the saves since beginSave()
+	// could not all be committed
 	virtual void beginSave() {}
 	virtual void endSave() {}
 
@@ -41,12 +43,28 @@ class Database
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
+	/*
+		Batched versions of saveBlock() and loadBlock(), which backends can
+		do in fewer round trips. The defaults call them for every block.
+	*/
+	// blocks[i] is the data of positions[i]. A position may appear more
+	// than once, the last one wins. Returns false if any block failed.
+	virtual bool saveBlocks(const std::vector<v3s16> &positions,
+			const std::vector<std::string> &blocks);
+	// Sets blocks[i] to the data of positions[i], empty if not found
+	virtual void loadBlocks(const std::vector<v3s16> &positions,
+			std::vector<std::string> *blocks);
+
 	static s64 getBlockAsInteger(const v3s16 &pos);
 	static v3s16 getIntegerAsBlock(s64 i);
 
 	virtual void listAllLoadableBlocks(std::vector<v3s16> &dst) = 0;
 
 	virtual bool initialized() const { return true; }
+
+	// Whether loadBlock() and loadBlocks() may be called from several
+	// threads at once, and while another thread uses the other methods
+	virtual bool supportsConcurrentLoads() const { return false; }
 };
 
 #endif
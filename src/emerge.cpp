@@ -504,15 +504,27 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 EmergeAction EmergeThread::getBlockOrStartGen(
 	v3s16 pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
+	// 1). Attempt to fetch block from memory
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+		*block = m_map->getBlockNoCreateNoEx(pos);
+		if (*block && !(*block)->isDummy() && (*block)->isGenerated())
+			return EMERGE_FROM_MEMORY;
+	}
+
+	// 2). Attempt to load block from disk. The database is read without the
+	// env lock, so that the emerge threads can wait for it in parallel.
+	std::string blob;
+	m_map->readBlock(pos, &blob);
+
 	MutexAutoLock envlock(m_server->m_env_mutex);
 
-	// 1). Attempt to fetch block from memory
+	// Another thread may have loaded or generated it meanwhile
 	*block = m_map->getBlockNoCreateNoEx(pos);
 	if (*block && !(*block)->isDummy() && (*block)->isGenerated())
 		return EMERGE_FROM_MEMORY;
 
-	// 2). Attempt to load block from disk
-	*block = m_map->loadBlock(pos);
+	*block = m_map->loadBlock(pos, &blob);
 	if (*block && (*block)->isGenerated())
 		return EMERGE_FROM_DISK;
 
@@ -18,6 +18,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <fstream>
+#include <algorithm>
+#include <iterator>
 #include "environment.h"
 #include "filesys.h"
 #include "porting.h"
@@ -43,7 +45,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "daynightratio.h"
 #include "map.h"
 #include "emerge.h"
+#include "abmscanner.h"
 #include "util/serialize.h"
+#include "util/string.h"
 #include "threading/mutex_auto_lock.h"
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
@@ -366,6 +370,23 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp)
 	MapNode n;
 	content_t c;
 	lbm_lookup_map::const_iterator it = getLBMsIntroducedAfter(stamp);
+
+	// Skip the node scan if no LBM applies to any content of the block
+	const std::vector<content_t> &contents = block->getContents();
+	bool found = false;
+	for (std::vector<content_t>::const_iterator cit = contents.begin();
+			cit != contents.end() && !found; ++cit) {
+		for (LBMManager::lbm_lookup_map::const_iterator iit = it;
+				iit != m_lbm_lookup.end(); ++iit) {
+			if (iit->second.lookup(*cit)) {
+				found = true;
+				break;
+			}
+		}
+	}
+	if (!found)
+		return;
+
 	for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++)
 	for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
 	for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++)
@@ -390,15 +411,28 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp)
 	ActiveBlockList
 */
 
-void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
+/*
+	Adds change to the count of the blocks within r of p0, except for
+	those also within r of *skip. Only the blocks outside of the skipped
+	cube are visited.
+*/
+void ActiveBlockList::addRange(v3s16 p0, s16 r, const v3s16 *skip,
+		s32 change, ChangeMap &changes)
 {
 	v3s16 p;
 	for(p.X=p0.X-r; p.X<=p0.X+r; p.X++)
 	for(p.Y=p0.Y-r; p.Y<=p0.Y+r; p.Y++)
-	for(p.Z=p0.Z-r; p.Z<=p0.Z+r; p.Z++)
 	{
-		// Set in list
-		list.insert(p);
+		bool column_skipped = skip &&
+				abs(p.X - skip->X) <= r && abs(p.Y - skip->Y) <= r;
+		for(p.Z=p0.Z-r; p.Z<=p0.Z+r; p.Z++)
+		{
+			if(column_skipped && abs(p.Z - skip->Z) <= r) {
+				p.Z = skip->Z + r;
+				continue;
+			}
+			changes[p] += change;
+		}
 	}
 }
 
@@ -407,52 +441,100 @@ void ActiveBlockList::update(std::vector<v3s16> &active_positions,
 		std::set<v3s16> &blocks_removed,
 		std::set<v3s16> &blocks_added)
 {
+	ChangeMap changes;
+
+	std::vector<v3s16> positions = active_positions;
+	std::sort(positions.begin(), positions.end());
+
 	/*
-		Create the new list
+		Find the positions that are gone and the new ones.
+		Positions of players that stayed in the same block cancel out.
 	*/
-	std::set<v3s16> newlist = m_forceloaded_list;
-	for(std::vector<v3s16>::iterator i = active_positions.begin();
-			i != active_positions.end(); ++i)
-	{
-		fillRadiusBlock(*i, radius, newlist);
+	std::vector<v3s16> gone;
+	std::vector<v3s16> added;
+	if(radius != m_radius) {
+		gone = m_positions;
+		added = positions;
+	} else {
+		std::set_difference(m_positions.begin(), m_positions.end(),
+				positions.begin(), positions.end(),
+				std::back_inserter(gone));
+		std::set_difference(positions.begin(), positions.end(),
+				m_positions.begin(), m_positions.end(),
+				std::back_inserter(added));
+	}
+
+	// Pair them up so that only the difference of the ranges is visited
+	size_t moved = MYMIN(gone.size(), added.size());
+	for(size_t i = 0; i < moved; i++) {
+		if(radius == m_radius) {
+			addRange(added[i], radius, &gone[i], 1, changes);
+			addRange(gone[i], radius, &added[i], -1, changes);
+		} else {
+			addRange(added[i], radius, NULL, 1, changes);
+			addRange(gone[i], m_radius, NULL, -1, changes);
+		}
 	}
+	for(size_t i = moved; i < gone.size(); i++)
+		addRange(gone[i], m_radius, NULL, -1, changes);
+	for(size_t i = moved; i < added.size(); i++)
+		addRange(added[i], radius, NULL, 1, changes);
+
+	m_positions.swap(positions);
+	m_radius = radius;
 
 	/*
-		Find out which blocks on the old list are not on the new list
+		Forceloaded blocks
 	*/
-	// Go through old list
-	for(std::set<v3s16>::iterator i = m_list.begin();
-			i != m_list.end(); ++i)
-	{
-		v3s16 p = *i;
-		// If not on new list, it's been removed
-		if(newlist.find(p) == newlist.end())
-			blocks_removed.insert(p);
+	for(std::set<v3s16>::iterator i = m_forceloaded.begin();
+			i != m_forceloaded.end(); ++i) {
+		if(m_forceloaded_list.find(*i) == m_forceloaded_list.end())
+			changes[*i] -= 1;
+	}
+	for(std::set<v3s16>::iterator i = m_forceloaded_list.begin();
+			i != m_forceloaded_list.end(); ++i) {
+		if(m_forceloaded.find(*i) == m_forceloaded.end())
+			changes[*i] += 1;
 	}
+	m_forceloaded = m_forceloaded_list;
 
 	/*
-		Find out which blocks on the new list are not on the old list
+		Apply the changes, collecting the blocks whose count goes from
+		or to zero
 	*/
-	// Go through new list
-	for(std::set<v3s16>::iterator i = newlist.begin();
-			i != newlist.end(); ++i)
-	{
-		v3s16 p = *i;
-		// If not on old list, it's been added
-		if(m_list.find(p) == m_list.end())
+	for(ChangeMap::iterator i = changes.begin(); i != changes.end(); ++i) {
+		if(i->second == 0)
+			continue;
+		v3s16 p = i->first;
+		std::map<v3s16, u32>::iterator rc = m_refcount.find(p);
+		u32 count = rc == m_refcount.end() ? 0 : rc->second;
+		// Counts can't become negative
+		assert(i->second > 0 || count >= (u32)-i->second);
+		u32 new_count = count + i->second;
+
+		if(new_count == 0) {
+			m_refcount.erase(rc);
+			if(m_list.erase(p) != 0)
+				blocks_removed.insert(p);
+			m_retry.erase(p);
+		} else if(count == 0) {
+			m_refcount[p] = new_count;
+			m_list.insert(p);
 			blocks_added.insert(p);
+		} else {
+			rc->second = new_count;
+		}
 	}
 
 	/*
-		Update m_list
+		Blocks that couldn't be activated last time are tried again
 	*/
-	m_list.clear();
-	for(std::set<v3s16>::iterator i = newlist.begin();
-			i != newlist.end(); ++i)
-	{
-		v3s16 p = *i;
-		m_list.insert(p);
+	for(std::set<v3s16>::iterator i = m_retry.begin();
+			i != m_retry.end(); ++i) {
+		m_list.insert(*i);
+		blocks_added.insert(*i);
 	}
+	m_retry.clear();
 }
 
 /*
@@ -472,8 +554,36 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_game_time_fraction_counter(0),
 	m_last_clear_objects_time(0),
 	m_recommended_send_interval(0.1),
-	m_max_lag_estimate(0.1)
-{
+	m_max_lag_estimate(0.1),
+	m_object_step_counter(0)
+{
+	// If unspecified, leave a proc for the server thread's other work
+	// and one for the emerge thread
+	s16 nthreads = 0;
+	if (!g_settings->getS16NoEx("num_abm_scan_threads", nthreads) || nthreads == 0)
+		nthreads = Thread::getNumberOfProcessors() - 2;
+	if (nthreads < 1)
+		nthreads = 1;
+	m_abm_scanner = new ABMScanner(nthreads);
+	infostream << "ServerEnvironment: scanning ABMs with "
+		<< m_abm_scanner->getThreadCount() << " threads" << std::endl;
+
+	// Format: distance:interval[,distance:interval...]
+	std::vector<std::string> tiers =
+		str_split(g_settings->get("entity_step_tiers"), ',');
+	for (std::vector<std::string>::iterator i = tiers.begin();
+			i != tiers.end(); ++i) {
+		std::vector<std::string> tier = str_split(trim(*i), ':');
+		if (tier.size() != 2 || stoi(tier[1]) < 1) {
+			if (!trim(*i).empty())
+				warningstream << "Invalid entity_step_tiers entry \""
+					<< *i << "\"" << std::endl;
+			continue;
+		}
+		m_entity_step_tiers.push_back(std::make_pair(
+			stof(tier[0]) * BS, (u32)stoi(tier[1])));
+	}
+	std::sort(m_entity_step_tiers.begin(), m_entity_step_tiers.end());
 }
 
 ServerEnvironment::~ServerEnvironment()
@@ -494,6 +604,8 @@ ServerEnvironment::~ServerEnvironment()
 		delete i->abm;
 	}
 
+	delete m_abm_scanner;
+
 	// Deallocate players
 	for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
 			i != m_players.end(); ++i) {
@@ -513,24 +625,31 @@ ServerMap & ServerEnvironment::getServerMap()
 
 RemotePlayer *ServerEnvironment::getPlayer(const u16 peer_id)
 {
-	for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
-			i != m_players.end(); ++i) {
-		RemotePlayer *player = *i;
-		if (player->peer_id == peer_id)
-			return player;
+	// Disconnected players all have peer id 0
+	if (peer_id == 0) {
+		for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
+				i != m_players.end(); ++i) {
+			RemotePlayer *player = *i;
+			if (player->peer_id == peer_id)
+				return player;
+		}
+		return NULL;
 	}
-	return NULL;
+
+	UNORDERED_MAP<u16, RemotePlayer *>::iterator it =
+		m_players_by_peer_id.find(peer_id);
+	if (it == m_players_by_peer_id.end())
+		return NULL;
+	return it->second;
 }
 
 RemotePlayer *ServerEnvironment::getPlayer(const char* name)
 {
-	for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
-			i != m_players.end(); ++i) {
-		RemotePlayer *player = *i;
-		if (strcmp(player->getName(), name) == 0)
-			return player;
-	}
-	return NULL;
+	UNORDERED_MAP<std::string, RemotePlayer *>::iterator it =
+		m_players_by_name.find(name);
+	if (it == m_players_by_name.end())
+		return NULL;
+	return it->second;
 }
 
 void ServerEnvironment::addPlayer(RemotePlayer *player)
@@ -548,6 +667,9 @@ void ServerEnvironment::addPlayer(RemotePlayer *player)
 	FATAL_ERROR_IF(getPlayer(player->getName()) != NULL, "Player name not unique");
 	// Add.
 	m_players.push_back(player);
+	m_players_by_name[player->getName()] = player;
+	if (player->peer_id != 0)
+		m_players_by_peer_id[player->peer_id] = player;
 }
 
 void ServerEnvironment::removePlayer(RemotePlayer *player)
@@ -555,6 +677,10 @@ void ServerEnvironment::removePlayer(RemotePlayer *player)
 	for (std::vector<RemotePlayer *>::iterator it = m_players.begin();
 			it != m_players.end(); ++it) {
 		if ((*it) == player) {
+			m_players_by_name.erase(player->getName());
+			if (player->peer_id != 0 &&
+					getPlayer(player->peer_id) == player)
+				m_players_by_peer_id.erase(player->peer_id);
 			delete *it;
 			m_players.erase(it);
 			return;
@@ -562,6 +688,21 @@ void ServerEnvironment::removePlayer(RemotePlayer *player)
 	}
 }
 
+void ServerEnvironment::setPlayerPeerId(RemotePlayer *player, u16 peer_id)
+{
+	if (player->peer_id == peer_id)
+		return;
+
+	if (player->peer_id != 0 && getPlayer(player->peer_id) == player)
+		m_players_by_peer_id.erase(player->peer_id);
+
+	player->peer_id = peer_id;
+
+	// Players not added to the environment yet are indexed by addPlayer()
+	if (peer_id != 0 && getPlayer(player->getName()) == player)
+		m_players_by_peer_id[peer_id] = player;
+}
+
 bool ServerEnvironment::line_of_sight(v3f pos1, v3f pos2, float stepsize, v3s16 *p)
 {
 	float distance = pos1.getDistanceFrom(pos2);
@@ -751,18 +892,11 @@ void ServerEnvironment::loadDefaultMeta()
 	m_lbm_mgr.loadIntroductionTimes("", m_gamedef, m_game_time);
 }
 
-struct ActiveABM
-{
-	ActiveBlockModifier *abm;
-	int chance;
-	std::set<content_t> required_neighbors;
-};
-
 class ABMHandler
 {
 private:
 	ServerEnvironment *m_env;
-	std::map<content_t, std::vector<ActiveABM> > m_aabms;
+	ActiveABMMap m_aabms;
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 			float dtime_s, ServerEnvironment *env,
@@ -821,7 +955,7 @@ class ABMHandler
 						k != ids.end(); ++k)
 				{
 					content_t c = *k;
-					std::map<content_t, std::vector<ActiveABM> >::iterator j;
+					ActiveABMMap::iterator j;
 					j = m_aabms.find(c);
 					if(j == m_aabms.end()){
 						std::vector<ActiveABM> aabmlist;
@@ -861,69 +995,99 @@ class ABMHandler
 		return active_object_count;
 
 	}
+	// Whether any node of the block may be a trigger content of an ABM
+	bool hasTriggerContents(MapBlock *block)
+	{
+		const std::vector<content_t> &contents = block->getContents();
+		for (std::vector<content_t>::const_iterator it = contents.begin();
+				it != contents.end(); ++it) {
+			if (m_aabms.find(*it) != m_aabms.end())
+				return true;
+		}
+		return false;
+	}
 	void apply(MapBlock *block)
+	{
+		std::vector<MapBlock *> blocks(1, block);
+		apply(blocks);
+	}
+	/*
+		The nodes of the blocks are first scanned for trigger candidates
+		by the ABMScanner threads, then the triggers are run here, in the
+		server thread.
+	*/
+	void apply(const std::vector<MapBlock *> &blocks)
 	{
 		if(m_aabms.empty())
 			return;
 
 		ServerMap *map = &m_env->getServerMap();
 
+		std::vector<ABMScanJob> jobs;
+		for(std::vector<MapBlock *>::const_iterator
+				i = blocks.begin(); i != blocks.end(); ++i) {
+			MapBlock *block = *i;
+			// Most blocks contain none of the trigger contents
+			if(!hasTriggerContents(block))
+				continue;
+
+			ABMScanJob job;
+			job.blockpos = block->getPos();
+			v3s16 d;
+			for(d.X = -1; d.X <= 1; d.X++)
+			for(d.Y = -1; d.Y <= 1; d.Y++)
+			for(d.Z = -1; d.Z <= 1; d.Z++) {
+				job.blocks[ABMScanJob::getNeighbourIndex(d)] =
+					map->getBlockNoCreateNoEx(job.blockpos + d);
+			}
+			job.seed = ((u64)myrand() << 32) | myrand();
+			jobs.push_back(job);
+		}
+
+		{
+			ScopeProfiler sp(g_profiler, "SEnv: ABM scan avg", SPT_AVG);
+			m_env->getABMScanner()->scan(m_aabms, jobs);
+		}
+
+		for(std::vector<ABMScanJob>::iterator
+				i = jobs.begin(); i != jobs.end(); ++i)
+			trigger(*i);
+	}
+	void trigger(const ABMScanJob &job)
+	{
+		if(job.candidates.empty())
+			return;
+
+		ServerMap *map = &m_env->getServerMap();
+
+		// Previous triggers may have removed the block
+		MapBlock *block = map->getBlockNoCreateNoEx(job.blockpos);
+		if(block == NULL || block->isDummy())
+			return;
+
 		u32 active_object_count_wider;
 		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
 		m_env->m_added_objects = 0;
 
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
-			MapNode n = block->getNodeNoEx(p0);
-			content_t c = n.getContent();
-			v3s16 p = p0 + block->getPosRelative();
-
-			std::map<content_t, std::vector<ActiveABM> >::iterator j;
-			j = m_aabms.find(c);
-			if(j == m_aabms.end())
+		for(std::vector<ABMCandidate>::const_iterator
+				i = job.candidates.begin(); i != job.candidates.end(); ++i) {
+			// Skip nodes replaced by the triggers run before
+			MapNode n = block->getNodeNoEx(i->p0);
+			if(n.getContent() != i->content)
 				continue;
 
-			for(std::vector<ActiveABM>::iterator
-					i = j->second.begin(); i != j->second.end(); ++i) {
-				if(myrand() % i->chance != 0)
-					continue;
-
-				// Check neighbors
-				if(!i->required_neighbors.empty())
-				{
-					v3s16 p1;
-					for(p1.X = p.X-1; p1.X <= p.X+1; p1.X++)
-					for(p1.Y = p.Y-1; p1.Y <= p.Y+1; p1.Y++)
-					for(p1.Z = p.Z-1; p1.Z <= p.Z+1; p1.Z++)
-					{
-						if(p1 == p)
-							continue;
-						MapNode n = map->getNodeNoEx(p1);
-						content_t c = n.getContent();
-						std::set<content_t>::const_iterator k;
-						k = i->required_neighbors.find(c);
-						if(k != i->required_neighbors.end()){
-							goto neighbor_found;
-						}
-					}
-					// No required neighbor found
-					continue;
-				}
-neighbor_found:
+			v3s16 p = i->p0 + block->getPosRelative();
+			ActiveBlockModifier *abm = i->aabm->abm;
 
-				// Call all the trigger variations
-				i->abm->trigger(m_env, p, n);
-				i->abm->trigger(m_env, p, n,
-						active_object_count, active_object_count_wider);
+			// Call all the trigger variations
+			abm->trigger(m_env, p, n);
+			abm->trigger(m_env, p, n,
+					active_object_count, active_object_count_wider);
 
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
 			}
 		}
 	}
@@ -987,6 +1151,88 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	abmhandler.apply(block);
 }
 
+void ServerEnvironment::stepActiveObjects(float dtime, bool send_recommended)
+{
+	m_object_step_counter++;
+
+	std::vector<v3f> player_positions;
+	if (!m_entity_step_tiers.empty()) {
+		for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
+				i != m_players.end(); ++i) {
+			PlayerSAO *playersao = (*i)->getPlayerSAO();
+			if ((*i)->peer_id == 0 || playersao == NULL)
+				continue;
+			player_positions.push_back(playersao->getBasePosition());
+		}
+	}
+
+	u32 skipped_count = 0;
+	for (ActiveObjectMap::iterator i = m_active_objects.begin();
+			i != m_active_objects.end(); ++i) {
+		ServerActiveObject* obj = i->second;
+		// Don't step if is to be removed or stored statically
+		if (obj->m_removed || obj->m_pending_deactivation)
+			continue;
+
+		float obj_dtime = dtime;
+		bool obj_send_recommended = send_recommended;
+		if (obj->getType() == ACTIVEOBJECT_TYPE_LUAENTITY) {
+			u32 interval = getEntityStepInterval(obj->getBasePosition(),
+					player_positions);
+			// Spread the entities of a tier over its interval
+			if ((m_object_step_counter + i->first) % interval != 0) {
+				obj->m_skipped_dtime += dtime;
+				obj->m_skipped_send |= send_recommended;
+				skipped_count++;
+				continue;
+			}
+			obj_dtime += obj->m_skipped_dtime;
+			obj_send_recommended |= obj->m_skipped_send;
+			obj->m_skipped_dtime = 0;
+			obj->m_skipped_send = false;
+		}
+
+		// Step object
+		obj->step(obj_dtime, obj_send_recommended);
+		// Objects may move themselves without setBasePosition()
+		m_active_object_index.update(i->first, obj->getBasePosition());
+		// Read messages from object
+		while (!obj->m_messages_out.empty()) {
+			m_active_object_messages.push(
+					obj->m_messages_out.front());
+			obj->m_messages_out.pop();
+		}
+	}
+
+	g_profiler->avg("SEnv: num of objects skipped", skipped_count);
+}
+
+u32 ServerEnvironment::getEntityStepInterval(v3f pos,
+		const std::vector<v3f> &player_positions)
+{
+	if (m_entity_step_tiers.empty())
+		return 1;
+
+	// Without players, everything is far away
+	f32 nearest = -1;
+	for (std::vector<v3f>::const_iterator i = player_positions.begin();
+			i != player_positions.end(); ++i) {
+		f32 d = pos.getDistanceFromSQ(*i);
+		if (nearest < 0 || d < nearest)
+			nearest = d;
+	}
+
+	u32 interval = 1;
+	for (std::vector<std::pair<f32, u32> >::const_iterator
+			i = m_entity_step_tiers.begin();
+			i != m_entity_step_tiers.end(); ++i) {
+		if (nearest >= 0 && nearest <= i->first * i->first)
+			break;
+		interval = i->second;
+	}
+	return interval;
+}
+
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
 {
 	m_abms.push_back(ABMWithState(abm));
@@ -1062,17 +1308,47 @@ bool ServerEnvironment::swapNode(v3s16 p, const MapNode &n)
 
 void ServerEnvironment::getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius)
 {
-	for (ActiveObjectMap::iterator i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i) {
-		ServerActiveObject* obj = i->second;
-		u16 id = i->first;
+	std::vector<u16> candidates;
+	v3f extent(radius, radius, radius);
+	m_active_object_index.getObjectsInArea(pos - extent, pos + extent, candidates);
+
+	for (std::vector<u16>::iterator i = candidates.begin();
+			i != candidates.end(); ++i) {
+		ServerActiveObject *obj = getActiveObject(*i);
+		if (obj == NULL)
+			continue;
 		v3f objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFrom(pos) > radius)
 			continue;
-		objects.push_back(id);
+		objects.push_back(*i);
+	}
+}
+
+void ServerEnvironment::getObjectsInArea(std::vector<u16> &objects, const aabb3f &box)
+{
+	std::vector<u16> candidates;
+	m_active_object_index.getObjectsInArea(box.MinEdge, box.MaxEdge, candidates);
+
+	for (std::vector<u16>::iterator i = candidates.begin();
+			i != candidates.end(); ++i) {
+		ServerActiveObject *obj = getActiveObject(*i);
+		if (obj == NULL)
+			continue;
+		if (!box.isPointInside(obj->getBasePosition()))
+			continue;
+		objects.push_back(*i);
 	}
 }
 
+void ServerEnvironment::updateActiveObjectPosition(ServerActiveObject *obj)
+{
+	// Objects which are not (yet) part of the environment aren't indexed
+	if (getActiveObject(obj->getId()) != obj)
+		return;
+
+	m_active_object_index.update(obj->getId(), obj->getBasePosition());
+}
+
 void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 {
 	infostream << "ServerEnvironment::clearObjects(): "
@@ -1117,6 +1393,8 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 	for (std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_index.remove(*i);
+		m_active_object_ids.release(*i);
 	}
 
 	// Get list of loaded blocks
@@ -1330,7 +1608,7 @@ void ServerEnvironment::step(float dtime)
 
 			MapBlock *block = m_map->getBlockOrEmerge(p);
 			if(block==NULL){
-				m_active_blocks.m_list.erase(p);
+				m_active_blocks.retryLater(p);
 				continue;
 			}
 
@@ -1403,6 +1681,7 @@ void ServerEnvironment::step(float dtime)
 		// Initialize handling of ActiveBlockModifiers
 		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
 
+		std::vector<MapBlock *> blocks;
 		for(std::set<v3s16>::iterator
 				i = m_active_blocks.m_list.begin();
 				i != m_active_blocks.m_list.end(); ++i)
@@ -1419,10 +1698,12 @@ void ServerEnvironment::step(float dtime)
 			// Set current time as timestamp
 			block->setTimestampNoChangedFlag(m_game_time);
 
-			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block);
+			blocks.push_back(block);
 		}
 
+		/* Handle ActiveBlockModifiers */
+		abmhandler.apply(blocks);
+
 		u32 time_ms = timer.stop(true);
 		u32 max_time_ms = 200;
 		if(time_ms > max_time_ms){
@@ -1446,6 +1727,8 @@ void ServerEnvironment::step(float dtime)
 		//TimeTaker timer("Step active objects");
 
 		g_profiler->avg("SEnv: num of objects", m_active_objects.size());
+		g_profiler->avg("SEnv: object ids used",
+				m_active_object_ids.getUsedCount());
 
 		// This helps the objects to send data at the same time
 		bool send_recommended = false;
@@ -1456,22 +1739,7 @@ void ServerEnvironment::step(float dtime)
 			send_recommended = true;
 		}
 
-		for(ActiveObjectMap::iterator i = m_active_objects.begin();
-				i != m_active_objects.end(); ++i) {
-			ServerActiveObject* obj = i->second;
-			// Don't step if is to be removed or stored statically
-			if(obj->m_removed || obj->m_pending_deactivation)
-				continue;
-			// Step object
-			obj->step(dtime, send_recommended);
-			// Read messages from object
-			while(!obj->m_messages_out.empty())
-			{
-				m_active_object_messages.push(
-						obj->m_messages_out.front());
-				obj->m_messages_out.pop();
-			}
-		}
+		stepActiveObjects(dtime, send_recommended);
 	}
 
 	/*
@@ -1554,30 +1822,6 @@ ServerActiveObject* ServerEnvironment::getActiveObject(u16 id)
 	return (n != m_active_objects.end() ? n->second : NULL);
 }
 
-bool isFreeServerActiveObjectId(u16 id, ActiveObjectMap &objects)
-{
-	if (id == 0)
-		return false;
-
-	return objects.find(id) == objects.end();
-}
-
-u16 getFreeServerActiveObjectId(ActiveObjectMap &objects)
-{
-	//try to reuse id's as late as possible
-	static u16 last_used_id = 0;
-	u16 startid = last_used_id;
-	for(;;)
-	{
-		last_used_id ++;
-		if(isFreeServerActiveObjectId(last_used_id, objects))
-			return last_used_id;
-
-		if(last_used_id == startid)
-			return 0;
-	}
-}
-
 u16 ServerEnvironment::addActiveObject(ServerActiveObject *object)
 {
 	assert(object);	// Pre-condition
@@ -1600,19 +1844,50 @@ void ServerEnvironment::getAddedActiveObjects(PlayerSAO *playersao, s16 radius,
 
 	if (player_radius_f < 0)
 		player_radius_f = 0;
+
+	/*
+		Collect the objects near the player from the spatial index.
+		Players are always in range if player_radius is 0, so in that
+		case they are taken from the player list instead.
+	*/
+	v3f pos = playersao->getBasePosition();
+	f32 query_radius_f = MYMAX(radius_f, player_radius_f);
+	v3f extent(query_radius_f, query_radius_f, query_radius_f);
+	std::vector<u16> candidates;
+	m_active_object_index.getObjectsInArea(pos - extent, pos + extent, candidates);
+
+	if (player_radius_f == 0) {
+		for (std::vector<u16>::iterator i = candidates.begin();
+				i != candidates.end();) {
+			ServerActiveObject *object = getActiveObject(*i);
+			if (object && object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
+				*i = candidates.back();
+				candidates.pop_back();
+			} else {
+				++i;
+			}
+		}
+		for (std::vector<RemotePlayer *>::iterator i = m_players.begin();
+				i != m_players.end(); ++i) {
+			PlayerSAO *sao = (*i)->getPlayerSAO();
+			if (sao && getActiveObject(sao->getId()) == sao)
+				candidates.push_back(sao->getId());
+		}
+	}
+
 	/*
-		Go through the object list,
+		Go through the candidates,
 		- discard m_removed objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (ActiveObjectMap::iterator i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i) {
-		u16 id = i->first;
+	for (std::vector<u16>::iterator i = candidates.begin();
+			i != candidates.end(); ++i) {
+		u16 id = *i;
 
 		// Get object
-		ServerActiveObject *object = i->second;
+		ServerActiveObject *object = getActiveObject(id);
 		if (object == NULL)
 			continue;
 
@@ -1737,11 +2012,14 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 {
 	assert(object); // Pre-condition
 	if(object->getId() == 0){
-		u16 new_id = getFreeServerActiveObjectId(m_active_objects);
+		u16 new_id = m_active_object_ids.allocate();
 		if(new_id == 0)
 		{
+			g_profiler->add("SEnv: object id space exhausted", 1);
 			errorstream<<"ServerEnvironment::addActiveObjectRaw(): "
-					<<"no free ids available"<<std::endl;
+					<<"no free ids available ("
+					<<m_active_object_ids.getFailedCount()
+					<<" objects refused so far)"<<std::endl;
 			if(object->environmentDeletes())
 				delete object;
 			return 0;
@@ -1751,14 +2029,13 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 	else{
 		verbosestream<<"ServerEnvironment::addActiveObjectRaw(): "
 				<<"supplied with id "<<object->getId()<<std::endl;
-	}
-
-	if(!isFreeServerActiveObjectId(object->getId(), m_active_objects)) {
-		errorstream<<"ServerEnvironment::addActiveObjectRaw(): "
-				<<"id is not free ("<<object->getId()<<")"<<std::endl;
-		if(object->environmentDeletes())
-			delete object;
-		return 0;
+		if(!m_active_object_ids.reserve(object->getId())) {
+			errorstream<<"ServerEnvironment::addActiveObjectRaw(): "
+					<<"id is not free ("<<object->getId()<<")"<<std::endl;
+			if(object->environmentDeletes())
+				delete object;
+			return 0;
+		}
 	}
 
 	if (objectpos_over_limit(object->getBasePosition())) {
@@ -1766,6 +2043,7 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 		errorstream << "ServerEnvironment::addActiveObjectRaw(): "
 			<< "object position (" << p.X << "," << p.Y << "," << p.Z
 			<< ") outside maximum range" << std::endl;
+		m_active_object_ids.release(object->getId());
 		if (object->environmentDeletes())
 			delete object;
 		return 0;
@@ -1775,6 +2053,7 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 			<<"added (id="<<object->getId()<<")"<<std::endl;*/
 
 	m_active_objects[object->getId()] = object;
+	m_active_object_index.insert(object->getId(), object->getBasePosition());
 
 	verbosestream<<"ServerEnvironment::addActiveObjectRaw(): "
 			<<"Added id="<<object->getId()<<"; there are now "
@@ -1900,6 +2179,8 @@ void ServerEnvironment::removeRemovedObjects()
 	for(std::vector<u16>::iterator i = objects_to_remove.begin();
 			i != objects_to_remove.end(); ++i) {
 		m_active_objects.erase(*i);
+		m_active_object_index.remove(*i);
+		m_active_object_ids.release(*i);
 	}
 }
 
@@ -2025,6 +2306,60 @@ void ServerEnvironment::activateObjects(MapBlock *block, u32 dtime_s)
 	*/
 }
 
+/*
+	Blocks touched by deactivateFarObjects(). Every block is looked up
+	once, and marked as modified once with all the reasons, after all
+	the objects have been stored.
+*/
+class StaticDataBatch
+{
+public:
+	StaticDataBatch(ServerMap *map) :
+		max_objects_per_block(g_settings->getU16("max_objects_per_block")),
+		m_map(map)
+	{}
+
+	const u16 max_objects_per_block;
+
+	// Like ServerMap::emergeBlock(), NULL if the block can't be had
+	MapBlock *getBlock(v3s16 p, bool create)
+	{
+		std::map<v3s16, MapBlock *>::iterator it = m_blocks.find(p);
+		if (it != m_blocks.end() && (it->second || !create))
+			return it->second;
+
+		MapBlock *block = NULL;
+		try {
+			block = m_map->emergeBlock(p, create);
+		} catch (InvalidPositionException &e) {
+			// Handled via NULL pointer
+		}
+		m_blocks[p] = block;
+		return block;
+	}
+
+	void raiseModified(MapBlock *block, u32 reason)
+	{
+		m_modified[block] |= reason;
+	}
+
+	// Returns the number of blocks marked as modified
+	u32 flush()
+	{
+		for (std::map<MapBlock *, u32>::iterator it = m_modified.begin();
+				it != m_modified.end(); ++it)
+			it->first->raiseModified(MOD_STATE_WRITE_NEEDED, it->second);
+		u32 count = m_modified.size();
+		m_modified.clear();
+		return count;
+	}
+
+private:
+	ServerMap *m_map;
+	std::map<v3s16, MapBlock *> m_blocks;
+	std::map<MapBlock *, u32> m_modified;
+};
+
 /*
 	Convert objects that are not standing inside active blocks to static.
 
@@ -2034,233 +2369,252 @@ void ServerEnvironment::activateObjects(MapBlock *block, u32 dtime_s)
 	If force_delete is set, active object is deleted nevertheless. It
 	shall only be set so in the destructor of the environment.
 
-	If block wasn't generated (not in memory or on disk),
+	The objects are handled block by block through the spatial index,
+	so that the static data of a block is updated in a row.
 */
 void ServerEnvironment::deactivateFarObjects(bool force_delete)
 {
 	std::vector<u16> objects_to_remove;
-	for(ActiveObjectMap::iterator i = m_active_objects.begin();
-			i != m_active_objects.end(); ++i) {
-		ServerActiveObject* obj = i->second;
-		assert(obj);
+	StaticDataBatch batch(m_map);
+
+	std::vector<v3s16> occupied_blocks;
+	m_active_object_index.getOccupiedBlocks(occupied_blocks);
+	std::vector<u16> ids;
+	for (std::vector<v3s16>::iterator b = occupied_blocks.begin();
+			b != occupied_blocks.end(); ++b) {
+		ids.clear();
+		m_active_object_index.getObjectsInBlock(*b, ids);
+
+		for (std::vector<u16>::iterator i = ids.begin(); i != ids.end(); ++i) {
+			ServerActiveObject *obj = getActiveObject(*i);
+			if (!obj || !deactivateFarObject(obj, force_delete, batch))
+				continue;
+			// The object has been deleted. getStaticData() may have moved
+			// it into a block that is visited later, so drop the
+			// references to it right away.
+			m_active_objects.erase(*i);
+			m_active_object_index.remove(*i);
+			objects_to_remove.push_back(*i);
+		}
+	}
 
-		// Do not deactivate if static data creation not allowed
-		if(!force_delete && !obj->isStaticAllowed())
-			continue;
+	g_profiler->avg("SEnv: blocks with static data saved", batch.flush());
 
-		// If pending deactivation, let removeRemovedObjects() do it
-		if(!force_delete && obj->m_pending_deactivation)
-			continue;
+	// Release the ids only now, so that objects added by the callbacks
+	// above can not reuse an id that is still in the snapshot
+	for(std::vector<u16>::iterator i = objects_to_remove.begin();
+			i != objects_to_remove.end(); ++i)
+		m_active_object_ids.release(*i);
+}
 
-		u16 id = i->first;
-		v3f objectpos = obj->getBasePosition();
+/*
+	Converts a single object of deactivateFarObjects() to static.
+	Returns true if the object has been deleted.
+*/
+bool ServerEnvironment::deactivateFarObject(ServerActiveObject *obj,
+		bool force_delete, StaticDataBatch &batch)
+{
+	u16 id = obj->getId();
 
-		// The block in which the object resides in
-		v3s16 blockpos_o = getNodeBlockPos(floatToInt(objectpos, BS));
+	// Do not deactivate if static data creation not allowed
+	if(!force_delete && !obj->isStaticAllowed())
+		return false;
 
-		// If object's static data is stored in a deactivated block and object
-		// is actually located in an active block, re-save to the block in
-		// which the object is actually located in.
-		if(!force_delete &&
-				obj->m_static_exists &&
-				!m_active_blocks.contains(obj->m_static_block) &&
-				 m_active_blocks.contains(blockpos_o))
-		{
-			v3s16 old_static_block = obj->m_static_block;
-
-			// Save to block where object is located
-			MapBlock *block = m_map->emergeBlock(blockpos_o, false);
-			if(!block){
-				errorstream<<"ServerEnvironment::deactivateFarObjects(): "
-						<<"Could not save object id="<<id
-						<<" to it's current block "<<PP(blockpos_o)
-						<<std::endl;
-				continue;
-			}
-			std::string staticdata_new = obj->getStaticData();
-			StaticObject s_obj(obj->getType(), objectpos, staticdata_new);
-			block->m_static_objects.insert(id, s_obj);
-			obj->m_static_block = blockpos_o;
-			block->raiseModified(MOD_STATE_WRITE_NEEDED,
-				MOD_REASON_STATIC_DATA_ADDED);
-
-			// Delete from block where object was located
-			block = m_map->emergeBlock(old_static_block, false);
-			if(!block){
-				errorstream<<"ServerEnvironment::deactivateFarObjects(): "
-						<<"Could not delete object id="<<id
-						<<" from it's previous block "<<PP(old_static_block)
-						<<std::endl;
-				continue;
-			}
-			block->m_static_objects.remove(id);
-			block->raiseModified(MOD_STATE_WRITE_NEEDED,
-				MOD_REASON_STATIC_DATA_REMOVED);
-			continue;
+	// If pending deactivation, let removeRemovedObjects() do it
+	if(!force_delete && obj->m_pending_deactivation)
+		return false;
+
+	v3f objectpos = obj->getBasePosition();
+
+	// The block in which the object resides in
+	v3s16 blockpos_o = getNodeBlockPos(floatToInt(objectpos, BS));
+
+	// If object's static data is stored in a deactivated block and object
+	// is actually located in an active block, re-save to the block in
+	// which the object is actually located in.
+	if(!force_delete &&
+			obj->m_static_exists &&
+			!m_active_blocks.contains(obj->m_static_block) &&
+			 m_active_blocks.contains(blockpos_o))
+	{
+		v3s16 old_static_block = obj->m_static_block;
+
+		// Save to block where object is located
+		MapBlock *block = batch.getBlock(blockpos_o, false);
+		if(!block){
+			errorstream<<"ServerEnvironment::deactivateFarObjects(): "
+					<<"Could not save object id="<<id
+					<<" to it's current block "<<PP(blockpos_o)
+					<<std::endl;
+			return false;
 		}
+		std::string staticdata_new = obj->getStaticData();
+		StaticObject s_obj(obj->getType(), objectpos, staticdata_new);
+		block->m_static_objects.insert(id, s_obj);
+		obj->m_static_block = blockpos_o;
+		batch.raiseModified(block, MOD_REASON_STATIC_DATA_ADDED);
+
+		// Delete from block where object was located
+		block = batch.getBlock(old_static_block, false);
+		if(!block){
+			errorstream<<"ServerEnvironment::deactivateFarObjects(): "
+					<<"Could not delete object id="<<id
+					<<" from it's previous block "<<PP(old_static_block)
+					<<std::endl;
+			return false;
+		}
+		block->m_static_objects.remove(id);
+		batch.raiseModified(block, MOD_REASON_STATIC_DATA_REMOVED);
+		return false;
+	}
 
-		// If block is active, don't remove
-		if(!force_delete && m_active_blocks.contains(blockpos_o))
-			continue;
+	// If block is active, don't remove
+	if(!force_delete && m_active_blocks.contains(blockpos_o))
+		return false;
 
-		verbosestream<<"ServerEnvironment::deactivateFarObjects(): "
-				<<"deactivating object id="<<id<<" on inactive block "
-				<<PP(blockpos_o)<<std::endl;
+	verbosestream<<"ServerEnvironment::deactivateFarObjects(): "
+			<<"deactivating object id="<<id<<" on inactive block "
+			<<PP(blockpos_o)<<std::endl;
 
-		// If known by some client, don't immediately delete.
-		bool pending_delete = (obj->m_known_by_count > 0 && !force_delete);
+	// If known by some client, don't immediately delete.
+	bool pending_delete = (obj->m_known_by_count > 0 && !force_delete);
+	bool delete_object = force_delete;
 
-		/*
-			Update the static data
-		*/
+	/*
+		Update the static data
+	*/
 
-		if(obj->isStaticAllowed())
-		{
-			// Create new static object
-			std::string staticdata_new = obj->getStaticData();
-			StaticObject s_obj(obj->getType(), objectpos, staticdata_new);
+	if(obj->isStaticAllowed())
+	{
+		// Create new static object
+		std::string staticdata_new = obj->getStaticData();
+		StaticObject s_obj(obj->getType(), objectpos, staticdata_new);
 
-			bool stays_in_same_block = false;
-			bool data_changed = true;
+		bool stays_in_same_block = false;
+		bool data_changed = true;
 
-			if (obj->m_static_exists) {
-				if (obj->m_static_block == blockpos_o)
-					stays_in_same_block = true;
+		if (obj->m_static_exists) {
+			if (obj->m_static_block == blockpos_o)
+				stays_in_same_block = true;
 
-				MapBlock *block = m_map->emergeBlock(obj->m_static_block, false);
+			MapBlock *block = batch.getBlock(obj->m_static_block, false);
 
-				if (block) {
-					std::map<u16, StaticObject>::iterator n =
-						block->m_static_objects.m_active.find(id);
-					if (n != block->m_static_objects.m_active.end()) {
-						StaticObject static_old = n->second;
-
-						float save_movem = obj->getMinimumSavedMovement();
-
-						if (static_old.data == staticdata_new &&
-								(static_old.pos - objectpos).getLength() < save_movem)
-							data_changed = false;
-					} else {
-						errorstream<<"ServerEnvironment::deactivateFarObjects(): "
-							<<"id="<<id<<" m_static_exists=true but "
-							<<"static data doesn't actually exist in "
-							<<PP(obj->m_static_block)<<std::endl;
-					}
-				}
-			}
+			if (block) {
+				std::map<u16, StaticObject>::iterator n =
+					block->m_static_objects.m_active.find(id);
+				if (n != block->m_static_objects.m_active.end()) {
+					StaticObject static_old = n->second;
 
-			bool shall_be_written = (!stays_in_same_block || data_changed);
+					float save_movem = obj->getMinimumSavedMovement();
 
-			// Delete old static object
-			if(obj->m_static_exists)
-			{
-				MapBlock *block = m_map->emergeBlock(obj->m_static_block, false);
-				if(block)
-				{
-					block->m_static_objects.remove(id);
-					obj->m_static_exists = false;
-					// Only mark block as modified if data changed considerably
-					if(shall_be_written)
-						block->raiseModified(MOD_STATE_WRITE_NEEDED,
-							MOD_REASON_STATIC_DATA_CHANGED);
+					if (static_old.data == staticdata_new &&
+							(static_old.pos - objectpos).getLength() < save_movem)
+						data_changed = false;
+				} else {
+					errorstream<<"ServerEnvironment::deactivateFarObjects(): "
+						<<"id="<<id<<" m_static_exists=true but "
+						<<"static data doesn't actually exist in "
+						<<PP(obj->m_static_block)<<std::endl;
 				}
 			}
+		}
 
-			// Add to the block where the object is located in
-			v3s16 blockpos = getNodeBlockPos(floatToInt(objectpos, BS));
-			// Get or generate the block
-			MapBlock *block = NULL;
-			try{
-				block = m_map->emergeBlock(blockpos);
-			} catch(InvalidPositionException &e){
-				// Handled via NULL pointer
-				// NOTE: emergeBlock's failure is usually determined by it
-				//       actually returning NULL
-			}
+		bool shall_be_written = (!stays_in_same_block || data_changed);
 
+		// Delete old static object
+		if(obj->m_static_exists)
+		{
+			MapBlock *block = batch.getBlock(obj->m_static_block, false);
 			if(block)
 			{
-				if (block->m_static_objects.m_stored.size() >= g_settings->getU16("max_objects_per_block")) {
-					warningstream << "ServerEnv: Trying to store id = " << obj->getId()
-							<< " statically but block " << PP(blockpos)
-							<< " already contains "
-							<< block->m_static_objects.m_stored.size()
-							<< " objects."
-							<< " Forcing delete." << std::endl;
-					force_delete = true;
-				} else {
-					// If static counterpart already exists in target block,
-					// remove it first.
-					// This shouldn't happen because the object is removed from
-					// the previous block before this according to
-					// obj->m_static_block, but happens rarely for some unknown
-					// reason. Unsuccessful attempts have been made to find
-					// said reason.
-					if(id && block->m_static_objects.m_active.find(id) != block->m_static_objects.m_active.end()){
-						warningstream<<"ServerEnv: Performing hack #83274"
-								<<std::endl;
-						block->m_static_objects.remove(id);
-					}
-					// Store static data
-					u16 store_id = pending_delete ? id : 0;
-					block->m_static_objects.insert(store_id, s_obj);
-
-					// Only mark block as modified if data changed considerably
-					if(shall_be_written)
-						block->raiseModified(MOD_STATE_WRITE_NEEDED,
-							MOD_REASON_STATIC_DATA_CHANGED);
-
-					obj->m_static_exists = true;
-					obj->m_static_block = block->getPos();
-				}
-			}
-			else{
-				if(!force_delete){
-					v3s16 p = floatToInt(objectpos, BS);
-					errorstream<<"ServerEnv: Could not find or generate "
-							<<"a block for storing id="<<obj->getId()
-							<<" statically (pos="<<PP(p)<<")"<<std::endl;
-					continue;
-				}
+				block->m_static_objects.remove(id);
+				obj->m_static_exists = false;
+				// Only mark block as modified if data changed considerably
+				if(shall_be_written)
+					batch.raiseModified(block,
+						MOD_REASON_STATIC_DATA_CHANGED);
 			}
 		}
 
-		/*
-			If known by some client, set pending deactivation.
-			Otherwise delete it immediately.
-		*/
+		// Add to the block where the object is located in,
+		// get or generate the block
+		MapBlock *block = batch.getBlock(blockpos_o, true);
 
-		if(pending_delete && !force_delete)
+		if(block)
 		{
-			verbosestream<<"ServerEnvironment::deactivateFarObjects(): "
-					<<"object id="<<id<<" is known by clients"
-					<<"; not deleting yet"<<std::endl;
+			if (block->m_static_objects.m_stored.size() >= batch.max_objects_per_block) {
+				warningstream << "ServerEnv: Trying to store id = " << obj->getId()
+						<< " statically but block " << PP(blockpos_o)
+						<< " already contains "
+						<< block->m_static_objects.m_stored.size()
+						<< " objects."
+						<< " Forcing delete." << std::endl;
+				delete_object = true;
+			} else {
+				// If static counterpart already exists in target block,
+				// remove it first.
+				// This shouldn't happen because the object is removed from
+				// the previous block before this according to
+				// obj->m_static_block, but happens rarely for some unknown
+				// reason. Unsuccessful attempts have been made to find
+				// said reason.
+				if(id && block->m_static_objects.m_active.find(id) != block->m_static_objects.m_active.end()){
+					warningstream<<"ServerEnv: Performing hack #83274"
+							<<std::endl;
+					block->m_static_objects.remove(id);
+				}
+				// Store static data
+				u16 store_id = pending_delete ? id : 0;
+				block->m_static_objects.insert(store_id, s_obj);
 
-			obj->m_pending_deactivation = true;
-			continue;
+				// Only mark block as modified if data changed considerably
+				if(shall_be_written)
+					batch.raiseModified(block,
+						MOD_REASON_STATIC_DATA_CHANGED);
+
+				obj->m_static_exists = true;
+				obj->m_static_block = block->getPos();
+			}
+		}
+		else{
+			if(!delete_object){
+				v3s16 p = floatToInt(objectpos, BS);
+				errorstream<<"ServerEnv: Could not find or generate "
+						<<"a block for storing id="<<obj->getId()
+						<<" statically (pos="<<PP(p)<<")"<<std::endl;
+				return false;
+			}
 		}
+	}
 
-		verbosestream<<"ServerEnvironment::deactivateFarObjects(): "
-				<<"object id="<<id<<" is not known by clients"
-				<<"; deleting"<<std::endl;
+	/*
+		If known by some client, set pending deactivation.
+		Otherwise delete it immediately.
+	*/
 
-		// Tell the object about removal
-		obj->removingFromEnvironment();
-		// Deregister in scripting api
-		m_script->removeObjectReference(obj);
+	if(pending_delete && !delete_object)
+	{
+		verbosestream<<"ServerEnvironment::deactivateFarObjects(): "
+				<<"object id="<<id<<" is known by clients"
+				<<"; not deleting yet"<<std::endl;
 
-		// Delete active object
-		if(obj->environmentDeletes())
-			delete obj;
-		// Id to be removed from m_active_objects
-		objects_to_remove.push_back(id);
+		obj->m_pending_deactivation = true;
+		return false;
 	}
 
-	// Remove references from m_active_objects
-	for(std::vector<u16>::iterator i = objects_to_remove.begin();
-			i != objects_to_remove.end(); ++i) {
-		m_active_objects.erase(*i);
-	}
+	verbosestream<<"ServerEnvironment::deactivateFarObjects(): "
+			<<"object id="<<id<<" is not known by clients"
+			<<"; deleting"<<std::endl;
+
+	// Tell the object about removal
+	obj->removingFromEnvironment();
+	// Deregister in scripting api
+	m_script->removeObjectReference(obj);
+
+	// Delete active object
+	if(obj->environmentDeletes())
+		delete obj;
+	return true;
 }
 
 #ifndef SERVER
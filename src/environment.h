@@ -39,12 +39,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/numeric.h"
 #include "mapnode.h"
 #include "mapblock.h"
+#include "activeobjectindex.h"
+#include "activeobjectidallocator.h"
 #include "threading/mutex.h"
 #include "threading/atomic.h"
 #include "network/networkprotocol.h" // for AccessDeniedCode
 
 class ServerEnvironment;
 class ActiveBlockModifier;
+class ABMScanner;
 class ServerActiveObject;
 class ITextureSource;
 class IGameDef;
@@ -55,6 +58,7 @@ class GameScripting;
 class Player;
 class RemotePlayer;
 class PlayerSAO;
+class StaticDataBatch;
 
 class Environment
 {
@@ -248,9 +252,21 @@ class LBMManager
 	List of active blocks, used by ServerEnvironment
 */
 
+/*
+	List of active blocks, kept up to date incrementally.
+
+	Every block counts the player positions and forceloaded blocks it is
+	in range of. update() only walks the blocks entering or leaving the
+	range of the positions that changed since the last call, so its cost
+	depends on how much the players moved instead of on their number.
+*/
 class ActiveBlockList
 {
 public:
+	ActiveBlockList():
+		m_radius(-1)
+	{}
+
 	void update(std::vector<v3s16> &active_positions,
 			s16 radius,
 			std::set<v3s16> &blocks_removed,
@@ -260,14 +276,40 @@ class ActiveBlockList
 		return (m_list.find(p) != m_list.end());
 	}
 
+	// Takes p off the list until the next update(), which reports it as
+	// added again if it is still in range. Used for blocks that could
+	// not be activated yet.
+	void retryLater(v3s16 p){
+		if (m_list.erase(p) != 0)
+			m_retry.insert(p);
+	}
+
 	void clear(){
 		m_list.clear();
+		m_retry.clear();
+		m_refcount.clear();
+		m_positions.clear();
+		m_forceloaded.clear();
+		m_radius = -1;
 	}
 
 	std::set<v3s16> m_list;
 	std::set<v3s16> m_forceloaded_list;
 
 private:
+	typedef std::map<v3s16, s32> ChangeMap;
+
+	static void addRange(v3s16 p0, s16 r, const v3s16 *skip, s32 change,
+			ChangeMap &changes);
+
+	// Block -> number of positions it is in range of
+	std::map<v3s16, u32> m_refcount;
+	// In range, but taken off m_list by retryLater()
+	std::set<v3s16> m_retry;
+	// Sorted positions and forceloaded blocks of the last update
+	std::vector<v3s16> m_positions;
+	std::set<v3s16> m_forceloaded;
+	s16 m_radius;
 };
 
 /*
@@ -308,6 +350,9 @@ class ServerEnvironment : public Environment
 	IGameDef *getGameDef()
 		{ return m_gamedef; }
 
+	ABMScanner *getABMScanner()
+		{ return m_abm_scanner; }
+
 	float getSendRecommendedInterval()
 		{ return m_recommended_send_interval; }
 
@@ -319,6 +364,9 @@ class ServerEnvironment : public Environment
 	RemotePlayer *loadPlayer(const std::string &playername, PlayerSAO *sao);
 	void addPlayer(RemotePlayer *player);
 	void removePlayer(RemotePlayer *player);
+	// Use this instead of setting player->peer_id, it keeps the
+	// peer id lookup up to date
+	void setPlayerPeerId(RemotePlayer *player, u16 peer_id);
 
 	/*
 		Save and load time of day and game timer
@@ -410,6 +458,12 @@ class ServerEnvironment : public Environment
 	// Find all active objects inside a radius around a point
 	void getObjectsInsideRadius(std::vector<u16> &objects, v3f pos, float radius);
 
+	// Find all active objects whose base position is inside a box
+	void getObjectsInArea(std::vector<u16> &objects, const aabb3f &box);
+
+	// Update the spatial index after the position of an object has changed
+	void updateActiveObjectPosition(ServerActiveObject *obj);
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -472,6 +526,18 @@ class ServerEnvironment : public Environment
 		shall only be set so in the destructor of the environment.
 	*/
 	void deactivateFarObjects(bool force_delete);
+	// Returns true if the object has been deleted
+	bool deactivateFarObject(ServerActiveObject *obj, bool force_delete,
+			StaticDataBatch &batch);
+
+	/*
+		Step all active objects. Entities far from every player are
+		stepped less often, with the dtime they missed.
+	*/
+	void stepActiveObjects(float dtime, bool send_recommended);
+
+	// How many steps an entity at pos waits between being stepped
+	u32 getEntityStepInterval(v3f pos, const std::vector<v3f> &player_positions);
 
 	/*
 		Member variables
@@ -487,6 +553,10 @@ class ServerEnvironment : public Environment
 	const std::string m_path_world;
 	// Active object list
 	ActiveObjectMap m_active_objects;
+	// Spatial index of m_active_objects
+	ActiveObjectIndex m_active_object_index;
+	// Ids of the objects in m_active_objects
+	ActiveObjectIdAllocator m_active_object_ids;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
 	// Some timers
@@ -508,15 +578,24 @@ class ServerEnvironment : public Environment
 	u32 m_last_clear_objects_time;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	// Worker threads finding the nodes ABMs trigger on
+	ABMScanner *m_abm_scanner;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval;
 	// Estimate for general maximum lag as determined by server.
 	// Can raise to high values like 15s with eg. map generation mods.
 	float m_max_lag_estimate;
+	// (distance, interval) pairs sorted by distance: entities further
+	// than distance from every player are stepped every interval steps
+	std::vector<std::pair<f32, u32> > m_entity_step_tiers;
+	u32 m_object_step_counter;
 
 	// peer_ids in here should be unique, except that there may be many 0s
 	std::vector<RemotePlayer*> m_players;
+	// Lookups of m_players. Players with peer_id 0 are not in the former.
+	UNORDERED_MAP<u16, RemotePlayer *> m_players_by_peer_id;
+	UNORDERED_MAP<std::string, RemotePlayer *> m_players_by_name;
 
 	// Particles
 	IntervalLimiter m_particle_management_interval;
@@ -43,6 +43,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "fontengine.h"
 #include "gameparams.h"
 #include "database.h"
+#include "mapmigrator.h"
+#include "threading/thread.h"
+#include "serialization.h"
+#include "util/serialize.h"
 #include "config.h"
 #if USE_CURSES
 	#include "terminal_chat_console.h"
@@ -105,6 +109,7 @@ static bool determine_subgame(GameParams *game_params);
 
 static bool run_dedicated_server(const GameParams &game_params, const Settings &cmd_args);
 static bool migrate_database(const GameParams &game_params, const Settings &cmd_args);
+static bool benchmark_map_compression(const GameParams &game_params);
 
 /**********************************************************************/
 
@@ -288,6 +293,8 @@ static void set_allowed_options(OptionList *allowed_options)
 			_("Set gameid (\"--gameid list\" prints available ones)"))));
 	allowed_options->insert(std::make_pair("migrate", ValueSpec(VALUETYPE_STRING,
 			_("Migrate from current map backend to another (Only works when using minetestserver or with --server)"))));
+	allowed_options->insert(std::make_pair("benchmark-map-compression", ValueSpec(VALUETYPE_FLAG,
+			_("Compare the map compression codecs on blocks of the world (Only works when using minetestserver or with --server)"))));
 	allowed_options->insert(std::make_pair("terminal", ValueSpec(VALUETYPE_FLAG,
 			_("Feature an interactive terminal (Only works when using minetestserver or with --server)"))));
 #ifndef SERVER
@@ -824,6 +831,9 @@ static bool run_dedicated_server(const GameParams &game_params, const Settings &
 	if (cmd_args.exists("migrate"))
 		return migrate_database(game_params, cmd_args);
 
+	if (cmd_args.getFlag("benchmark-map-compression"))
+		return benchmark_map_compression(game_params);
+
 	if (cmd_args.exists("terminal")) {
 #if USE_CURSES
 		bool name_ok = true;
@@ -918,7 +928,7 @@ static bool migrate_database(const GameParams &game_params, const Settings &cmd_
 	if (!world_mt.exists("backend")) {
 		errorstream << "Please specify your current backend in world.mt:"
 			<< std::endl
-			<< "	backend = {sqlite3|leveldb|redis|dummy}"
+			<< "	backend = {sqlite3|leveldb|redis|blocklog|dummy}"
 			<< std::endl;
 		return false;
 	}
@@ -928,40 +938,45 @@ static bool migrate_database(const GameParams &game_params, const Settings &cmd_
 			<< " as the old one" << std::endl;
 		return false;
 	}
+	// Read the old database from several threads if it allows to
+	u32 read_threads = MYMAX(MYMIN(Thread::getNumberOfProcessors(), 4), 1);
+	if (backend == "sqlite3" && g_settings->getU16("sqlite_read_connections") == 0)
+		g_settings->setU16("sqlite_read_connections", read_threads);
+
 	Database *old_db = ServerMap::createDatabase(backend, game_params.world_path, world_mt),
 		*new_db = ServerMap::createDatabase(migrate_to, game_params.world_path, world_mt);
 
-	u32 count = 0;
-	time_t last_update_time = 0;
+	// An interrupted migration to the same backend is resumed
+	std::string checkpoint_path = game_params.world_path + DIR_DELIM
+		+ "migrate_" + migrate_to + ".checkpoint";
 	bool &kill = *porting::signal_handler_killstatus();
 
-	std::vector<v3s16> blocks;
-	old_db->listAllLoadableBlocks(blocks);
-	new_db->beginSave();
-	for (std::vector<v3s16>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
-		if (kill) return false;
-
-		std::string data;
-		old_db->loadBlock(*it, &data);
-		if (!data.empty()) {
-			new_db->saveBlock(*it, data);
-		} else {
-			errorstream << "Failed to load block " << PP(*it) << ", skipping it." << std::endl;
-		}
-		if (++count % 0xFF == 0 && time(NULL) - last_update_time >= 1) {
-			std::cerr << " Migrated " << count << " blocks, "
-				<< (100.0 * count / blocks.size()) << "% completed.\r";
-			new_db->endSave();
-			new_db->beginSave();
-			last_update_time = time(NULL);
-		}
-	}
-	std::cerr << std::endl;
-	new_db->endSave();
+	MapMigrator migrator(old_db, new_db, checkpoint_path, read_threads);
+	bool completed = migrator.run(&kill, &std::cerr);
 	delete old_db;
 	delete new_db;
 
-	actionstream << "Successfully migrated " << count << " blocks" << std::endl;
+	if (migrator.getFailedSaves() > 0) {
+		errorstream << "Migration stopped, " << migrator.getFailedSaves()
+			<< " blocks could not be saved to the " << migrate_to
+			<< " backend; world.mt was not changed" << std::endl;
+		return false;
+	}
+	if (!completed) {
+		actionstream << "Migration interrupted after " << migrator.getCopiedBlocks()
+			<< " blocks, run it again to resume" << std::endl;
+		return false;
+	}
+
+	u32 count = migrator.getCopiedBlocks();
+	actionstream << "Successfully migrated " << count << " blocks";
+	if (migrator.getResumedBlocks() > 0)
+		actionstream << " (plus " << migrator.getResumedBlocks()
+			<< " in an earlier run)";
+	if (migrator.getFailedBlocks() > 0)
+		actionstream << ", " << migrator.getFailedBlocks()
+			<< " could not be loaded";
+	actionstream << std::endl;
 	world_mt.set("backend", migrate_to);
 	if (!world_mt.updateConfigFile(world_mt_path.c_str()))
 		errorstream << "Failed to update world.mt!" << std::endl;
@@ -971,3 +986,100 @@ static bool migrate_database(const GameParams &game_params, const Settings &cmd_
 	return true;
 }
 
+
+// Appends the uncompressed node data and node metadata of a block
+static void get_block_payloads(const std::string &blob,
+		std::vector<std::string> *payloads)
+{
+	std::istringstream is(blob, std::ios_base::binary);
+	u8 version = readU8(is);
+	if (version < 22 || !ser_ver_supported(version))
+		throw SerializationError("unsupported block version");
+
+	readU8(is); // flags
+	u8 compression = MAP_COMPRESSION_ZLIB;
+	if (version >= SER_FMT_VER_MAP_COMPRESSION)
+		compression = readU8(is);
+	readU8(is); // content_width
+	readU8(is); // params_width
+
+	for (u32 i = 0; i < 2; i++) {
+		std::ostringstream os(std::ios_base::binary);
+		decompressMapData(is, os, compression);
+		payloads->push_back(os.str());
+	}
+}
+
+static bool benchmark_map_compression(const GameParams &game_params)
+{
+	Settings world_mt;
+	std::string world_mt_path = game_params.world_path + DIR_DELIM + "world.mt";
+	if (!world_mt.readConfigFile(world_mt_path.c_str())) {
+		errorstream << "Cannot read world.mt!" << std::endl;
+		return false;
+	}
+	std::string backend = world_mt.exists("backend") ?
+		world_mt.get("backend") : "sqlite3";
+	Database *db = ServerMap::createDatabase(backend, game_params.world_path, world_mt);
+
+	std::vector<v3s16> blocks;
+	db->listAllLoadableBlocks(blocks);
+	// Spread the samples over the whole world
+	const size_t max_blocks = 10000;
+	size_t step = blocks.size() / max_blocks + 1;
+
+	std::vector<std::string> payloads;
+	u64 raw_size = 0;
+	for (size_t i = 0; i < blocks.size(); i += step) {
+		std::string data;
+		db->loadBlock(blocks[i], &data);
+		try {
+			get_block_payloads(data, &payloads);
+		} catch (SerializationError &e) {
+			errorstream << "Skipping block " << PP(blocks[i])
+				<< ": " << e.what() << std::endl;
+		}
+	}
+	delete db;
+	for (size_t i = 0; i < payloads.size(); i++)
+		raw_size += payloads[i].size();
+
+	if (raw_size == 0) {
+		errorstream << "No blocks to compress" << std::endl;
+		return false;
+	}
+	actionstream << "Compressing " << payloads.size() / 2 << " blocks, "
+		<< raw_size / 1024 << " KiB of node data and metadata" << std::endl;
+
+	const char *names[] = {"zlib", "lz4"};
+	for (u8 compression = MAP_COMPRESSION_ZLIB;
+			compression <= MAP_COMPRESSION_LZ4; compression++) {
+		std::vector<std::string> compressed(payloads.size());
+		u64 compressed_size = 0;
+
+		u64 start_us = porting::getTimeUs();
+		for (size_t i = 0; i < payloads.size(); i++) {
+			std::ostringstream os(std::ios_base::binary);
+			compressMapData(payloads[i], os, compression);
+			compressed[i] = os.str();
+			compressed_size += compressed[i].size();
+		}
+		u64 compress_us = porting::getTimeUs() - start_us;
+
+		start_us = porting::getTimeUs();
+		for (size_t i = 0; i < compressed.size(); i++) {
+			std::istringstream is(compressed[i], std::ios_base::binary);
+			std::ostringstream os(std::ios_base::binary);
+			decompressMapData(is, os, compression);
+		}
+		u64 decompress_us = porting::getTimeUs() - start_us;
+
+		// Bytes per microsecond are MB/s
+		actionstream << names[compression] << ": ratio "
+			<< (float)raw_size / compressed_size << ", compression "
+			<< (float)raw_size / MYMAX(compress_us, 1) << " MB/s, decompression "
+			<< (float)raw_size / MYMAX(decompress_us, 1) << " MB/s" << std::endl;
+	}
+
+	return true;
+}
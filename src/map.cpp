@@ -42,10 +42,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "config.h"
 #include "server.h"
 #include "database.h"
+#include "database-blocklog.h"
+#include "database-cache.h"
 #include "database-dummy.h"
 #include "database-sqlite3.h"
+#include "mapsaver.h"
+#include "threading/mutex_auto_lock.h"
+#include "threads.h"
 #include <deque>
-#include <queue>
 #if USE_LEVELDB
 #include "database-leveldb.h"
 #endif
@@ -70,7 +74,8 @@ Map::Map(std::ostream &dout, IGameDef *gamedef):
 	m_transforming_liquid_loop_count_multiplier(1.0f),
 	m_unprocessed_count(0),
 	m_inc_trending_up_start_time(0),
-	m_queue_size_timer_started(false)
+	m_queue_size_timer_started(false),
+	m_bulk_edit_depth(0)
 {
 }
 
@@ -141,16 +146,63 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 	return sector;
 }
 
+/*
+	Last block found by getBlockNoCreateNoEx() in the current thread.
+	Consecutive node accesses mostly hit the same block. The generation
+	identifies the index (and so the map) the block was found in, and
+	changes as soon as any block is removed from it.
+*/
+struct LastBlockCache {
+	u32 generation;
+	s16 x, y, z;
+	MapBlock *block;
+};
+
+static THREAD_LOCAL LastBlockCache g_last_block = { 0, 0, 0, 0, NULL };
+
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerateNoEx(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
+	LastBlockCache &cache = g_last_block;
+	if (cache.block != NULL
+			&& cache.generation == m_block_index.getGeneration()
+			&& cache.x == p3d.X && cache.y == p3d.Y && cache.z == p3d.Z)
+		return cache.block;
+
+	MapBlock *block = m_block_index.get(p3d);
+	if (block != NULL) {
+		cache.generation = m_block_index.getGeneration();
+		cache.x = p3d.X;
+		cache.y = p3d.Y;
+		cache.z = p3d.Z;
+		cache.block = block;
+	}
 	return block;
 }
 
+void Map::indexBlock(MapBlock *block)
+{
+	bool inserted = m_block_index.insert(block->getPos(), block);
+	sanity_check(inserted);
+	m_block_lru.insert(block);
+}
+
+void Map::unindexBlock(MapBlock *block)
+{
+	m_block_index.remove(block->getPos());
+	m_block_lru.remove(block);
+}
+
+void Map::touchBlock(MapBlock *block)
+{
+	m_block_lru.touch(block);
+}
+
+void Map::updateBlockMemoryUsage(MapBlock *block)
+{
+	if (MapBlockLRU::contains(block))
+		m_block_lru.updateMemoryUsage(block);
+}
+
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -236,557 +288,12 @@ void Map::setNode(v3s16 p, MapNode & n)
 	block->setNodeNoCheck(relpos, n);
 }
 
-/*
-	Goes recursively through the neighbours of the node.
-
-	Alters only transparent nodes.
-
-	If the lighting of the neighbour is lower than the lighting of
-	the node was (before changing it to 0 at the step before), the
-	lighting of the neighbour is set to 0 and then the same stuff
-	repeats for the neighbour.
-
-	The ending nodes of the routine are stored in light_sources.
-	This is useful when a light is removed. In such case, this
-	routine can be called for the light node and then again for
-	light_sources to re-light the area without the removed light.
-
-	values of from_nodes are lighting values.
-*/
-void Map::unspreadLight(enum LightBank bank,
-		std::map<v3s16, u8> & from_nodes,
-		std::set<v3s16> & light_sources,
-		std::map<v3s16, MapBlock*>  & modified_blocks)
-{
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
-	if(from_nodes.empty())
-		return;
-
-	u32 blockchangecount = 0;
-
-	std::map<v3s16, u8> unlighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-	// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
-	for(std::map<v3s16, u8>::iterator j = from_nodes.begin();
-		j != from_nodes.end(); ++j)
-	{
-		v3s16 pos = j->first;
-		v3s16 blockpos = getNodeBlockPos(pos);
-
-		// Only fetch a new block if the block position has changed
-		try{
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreate(blockpos);
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-		}
-		catch(InvalidPositionException &e)
-		{
-			continue;
-		}
-
-		if(block->isDummy())
-			continue;
-
-		// Calculate relative position in block
-		//v3s16 relpos = pos - blockpos_last * MAP_BLOCKSIZE;
-
-		// Get node straight from the block
-		//MapNode n = block->getNode(relpos);
-
-		u8 oldlight = j->second;
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++)
-		{
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos, relpos;
-			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
-
-			// Only fetch a new block if the block position has changed
-			try {
-				if(block == NULL || blockpos != blockpos_last){
-					block = getBlockNoCreate(blockpos);
-					blockpos_last = blockpos;
-
-					block_checked_in_modified = false;
-					blockchangecount++;
-				}
-			}
-			catch(InvalidPositionException &e) {
-				continue;
-			}
-
-			// Get node straight from the block
-			bool is_valid_position;
-			MapNode n2 = block->getNode(relpos, &is_valid_position);
-			if (!is_valid_position)
-				continue;
-
-			bool changed = false;
-
-			//TODO: Optimize output by optimizing light_sources?
-
-			/*
-				If the neighbor is dimmer than what was specified
-				as oldlight (the light of the previous node)
-			*/
-			if(n2.getLight(bank, nodemgr) < oldlight)
-			{
-				/*
-					And the neighbor is transparent and it has some light
-				*/
-				if(nodemgr->get(n2).light_propagates
-						&& n2.getLight(bank, nodemgr) != 0)
-				{
-					/*
-						Set light to 0 and add to queue
-					*/
-
-					u8 current_light = n2.getLight(bank, nodemgr);
-					n2.setLight(bank, 0, nodemgr);
-					block->setNode(relpos, n2);
-
-					unlighted_nodes[n2pos] = current_light;
-					changed = true;
-
-					/*
-						Remove from light_sources if it is there
-						NOTE: This doesn't happen nearly at all
-					*/
-					/*if(light_sources.find(n2pos))
-					{
-						infostream<<"Removed from light_sources"<<std::endl;
-						light_sources.remove(n2pos);
-					}*/
-				}
-
-				/*// DEBUG
-				if(light_sources.find(n2pos) != NULL)
-					light_sources.remove(n2pos);*/
-			}
-			else{
-				light_sources.insert(n2pos);
-			}
-
-			// Add to modified_blocks
-			if(changed == true && block_checked_in_modified == false)
-			{
-				// If the block is not found in modified_blocks, add.
-				if(modified_blocks.find(blockpos) == modified_blocks.end())
-				{
-					modified_blocks[blockpos] = block;
-				}
-				block_checked_in_modified = true;
-			}
-		}
-	}
-
-	/*infostream<<"unspreadLight(): Changed block "
-	<<blockchangecount<<" times"
-	<<" for "<<from_nodes.size()<<" nodes"
-	<<std::endl;*/
-
-	if(!unlighted_nodes.empty())
-		unspreadLight(bank, unlighted_nodes, light_sources, modified_blocks);
-}
-
-/*
-	Lights neighbors of from_nodes, collects all them and then
-	goes on recursively.
-*/
-void Map::spreadLight(enum LightBank bank,
-		std::set<v3s16> & from_nodes,
-		std::map<v3s16, MapBlock*> & modified_blocks)
-{
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	const v3s16 dirs[6] = {
-		v3s16(0,0,1), // back
-		v3s16(0,1,0), // top
-		v3s16(1,0,0), // right
-		v3s16(0,0,-1), // front
-		v3s16(0,-1,0), // bottom
-		v3s16(-1,0,0), // left
-	};
-
-	if(from_nodes.empty())
-		return;
-
-	u32 blockchangecount = 0;
-
-	std::set<v3s16> lighted_nodes;
-
-	/*
-		Initialize block cache
-	*/
-	v3s16 blockpos_last;
-	MapBlock *block = NULL;
-		// Cache this a bit, too
-	bool block_checked_in_modified = false;
-
-	for(std::set<v3s16>::iterator j = from_nodes.begin();
-		j != from_nodes.end(); ++j)
-	{
-		v3s16 pos = *j;
-		v3s16 blockpos, relpos;
-
-		getNodeBlockPosWithOffset(pos, blockpos, relpos);
-
-		// Only fetch a new block if the block position has changed
-		try {
-			if(block == NULL || blockpos != blockpos_last){
-				block = getBlockNoCreate(blockpos);
-				blockpos_last = blockpos;
-
-				block_checked_in_modified = false;
-				blockchangecount++;
-			}
-		}
-		catch(InvalidPositionException &e) {
-			continue;
-		}
-
-		if(block->isDummy())
-			continue;
-
-		// Get node straight from the block
-		bool is_valid_position;
-		MapNode n = block->getNode(relpos, &is_valid_position);
-
-		u8 oldlight = is_valid_position ? n.getLight(bank, nodemgr) : 0;
-		u8 newlight = diminish_light(oldlight);
-
-		// Loop through 6 neighbors
-		for(u16 i=0; i<6; i++){
-			// Get the position of the neighbor node
-			v3s16 n2pos = pos + dirs[i];
-
-			// Get the block where the node is located
-			v3s16 blockpos, relpos;
-			getNodeBlockPosWithOffset(n2pos, blockpos, relpos);
-
-			// Only fetch a new block if the block position has changed
-			try {
-				if(block == NULL || blockpos != blockpos_last){
-					block = getBlockNoCreate(blockpos);
-					blockpos_last = blockpos;
-
-					block_checked_in_modified = false;
-					blockchangecount++;
-				}
-			}
-			catch(InvalidPositionException &e) {
-				continue;
-			}
-
-			// Get node straight from the block
-			MapNode n2 = block->getNode(relpos, &is_valid_position);
-			if (!is_valid_position)
-				continue;
-
-			bool changed = false;
-			/*
-				If the neighbor is brighter than the current node,
-				add to list (it will light up this node on its turn)
-			*/
-			if(n2.getLight(bank, nodemgr) > undiminish_light(oldlight))
-			{
-				lighted_nodes.insert(n2pos);
-				changed = true;
-			}
-			/*
-				If the neighbor is dimmer than how much light this node
-				would spread on it, add to list
-			*/
-			if(n2.getLight(bank, nodemgr) < newlight)
-			{
-				if(nodemgr->get(n2).light_propagates)
-				{
-					n2.setLight(bank, newlight, nodemgr);
-					block->setNode(relpos, n2);
-					lighted_nodes.insert(n2pos);
-					changed = true;
-				}
-			}
-
-			// Add to modified_blocks
-			if(changed == true && block_checked_in_modified == false)
-			{
-				// If the block is not found in modified_blocks, add.
-				if(modified_blocks.find(blockpos) == modified_blocks.end())
-				{
-					modified_blocks[blockpos] = block;
-				}
-				block_checked_in_modified = true;
-			}
-		}
-	}
-
-	/*infostream<<"spreadLight(): Changed block "
-			<<blockchangecount<<" times"
-			<<" for "<<from_nodes.size()<<" nodes"
-			<<std::endl;*/
-
-	if(!lighted_nodes.empty())
-		spreadLight(bank, lighted_nodes, modified_blocks);
-}
-
 void Map::updateLighting(enum LightBank bank,
 		std::map<v3s16, MapBlock*> & a_blocks,
 		std::map<v3s16, MapBlock*> & modified_blocks)
 {
-	INodeDefManager *nodemgr = m_gamedef->ndef();
-
-	/*m_dout<<"Map::updateLighting(): "
-			<<a_blocks.size()<<" blocks."<<std::endl;*/
-
-	//TimeTaker timer("updateLighting");
-
-	// For debugging
-	//bool debug=true;
-	//u32 count_was = modified_blocks.size();
-
-	//std::map<v3s16, MapBlock*> blocks_to_update;
-
-	std::set<v3s16> light_sources;
-
-	std::map<v3s16, u8> unlight_from;
-
-	int num_bottom_invalid = 0;
-
-	{
-	//TimeTaker t("first stuff");
-
-	for(std::map<v3s16, MapBlock*>::iterator i = a_blocks.begin();
-		i != a_blocks.end(); ++i)
-	{
-		MapBlock *block = i->second;
-
-		for(;;)
-		{
-			// Don't bother with dummy blocks.
-			if(block->isDummy())
-				break;
-
-			v3s16 pos = block->getPos();
-			v3s16 posnodes = block->getPosRelative();
-			modified_blocks[pos] = block;
-			//blocks_to_update[pos] = block;
-
-			/*
-				Clear all light from block
-			*/
-			for(s16 z=0; z<MAP_BLOCKSIZE; z++)
-			for(s16 x=0; x<MAP_BLOCKSIZE; x++)
-			for(s16 y=0; y<MAP_BLOCKSIZE; y++)
-			{
-				v3s16 p(x,y,z);
-				bool is_valid_position;
-				MapNode n = block->getNode(p, &is_valid_position);
-				if (!is_valid_position) {
-					/* This would happen when dealing with a
-					   dummy block.
-					*/
-					infostream<<"updateLighting(): InvalidPositionException"
-							<<std::endl;
-					continue;
-				}
-				u8 oldlight = n.getLight(bank, nodemgr);
-				n.setLight(bank, 0, nodemgr);
-				block->setNode(p, n);
-
-				// If node sources light, add to list
-				u8 source = nodemgr->get(n).light_source;
-				if(source != 0)
-					light_sources.insert(p + posnodes);
-
-				// Collect borders for unlighting
-				if((x==0 || x == MAP_BLOCKSIZE-1
-						|| y==0 || y == MAP_BLOCKSIZE-1
-						|| z==0 || z == MAP_BLOCKSIZE-1)
-						&& oldlight != 0)
-				{
-					v3s16 p_map = p + posnodes;
-					unlight_from[p_map] = oldlight;
-				}
-
-
-			}
-
-			if(bank == LIGHTBANK_DAY)
-			{
-				bool bottom_valid = block->propagateSunlight(light_sources);
-
-				if(!bottom_valid)
-					num_bottom_invalid++;
-
-				// If bottom is valid, we're done.
-				if(bottom_valid)
-					break;
-			}
-			else if(bank == LIGHTBANK_NIGHT)
-			{
-				// For night lighting, sunlight is not propagated
-				break;
-			}
-			else
-			{
-				assert("Invalid lighting bank" == NULL);
-			}
-
-			/*infostream<<"Bottom for sunlight-propagated block ("
-					<<pos.X<<","<<pos.Y<<","<<pos.Z<<") not valid"
-					<<std::endl;*/
-
-			// Bottom sunlight is not valid; get the block and loop to it
-
-			pos.Y--;
-			try{
-				block = getBlockNoCreate(pos);
-			}
-			catch(InvalidPositionException &e)
-			{
-				FATAL_ERROR("Invalid position");
-			}
-
-		}
-	}
-
-	}
-
-	/*
-		Enable this to disable proper lighting for speeding up map
-		generation for testing or whatever
-	*/
-#if 0
-	//if(g_settings->get(""))
-	{
-		core::map<v3s16, MapBlock*>::Iterator i;
-		i = blocks_to_update.getIterator();
-		for(; i.atEnd() == false; i++)
-		{
-			MapBlock *block = i.getNode()->getValue();
-			v3s16 p = block->getPos();
-			block->setLightingExpired(false);
-		}
-		return;
-	}
-#endif
-
-#if 1
-	{
-		//TimeTaker timer("unspreadLight");
-		unspreadLight(bank, unlight_from, light_sources, modified_blocks);
-	}
-
-	/*if(debug)
-	{
-		u32 diff = modified_blocks.size() - count_was;
-		count_was = modified_blocks.size();
-		infostream<<"unspreadLight modified "<<diff<<std::endl;
-	}*/
-
-	{
-		//TimeTaker timer("spreadLight");
-		spreadLight(bank, light_sources, modified_blocks);
-	}
-
-	/*if(debug)
-	{
-		u32 diff = modified_blocks.size() - count_was;
-		count_was = modified_blocks.size();
-		infostream<<"spreadLight modified "<<diff<<std::endl;
-	}*/
-#endif
-
-#if 0
-	{
-		//MapVoxelManipulator vmanip(this);
-
-		// Make a manual voxel manipulator and load all the blocks
-		// that touch the requested blocks
-		ManualMapVoxelManipulator vmanip(this);
-
-		{
-		//TimeTaker timer("initialEmerge");
-
-		core::map<v3s16, MapBlock*>::Iterator i;
-		i = blocks_to_update.getIterator();
-		for(; i.atEnd() == false; i++)
-		{
-			MapBlock *block = i.getNode()->getValue();
-			v3s16 p = block->getPos();
-
-			// Add all surrounding blocks
-			vmanip.initialEmerge(p - v3s16(1,1,1), p + v3s16(1,1,1));
-
-			/*
-				Add all surrounding blocks that have up-to-date lighting
-				NOTE: This doesn't quite do the job (not everything
-					  appropriate is lighted)
-			*/
-			/*for(s16 z=-1; z<=1; z++)
-			for(s16 y=-1; y<=1; y++)
-			for(s16 x=-1; x<=1; x++)
-			{
-				v3s16 p2 = p + v3s16(x,y,z);
-				MapBlock *block = getBlockNoCreateNoEx(p2);
-				if(block == NULL)
-					continue;
-				if(block->isDummy())
-					continue;
-				if(block->getLightingExpired())
-					continue;
-				vmanip.initialEmerge(p2, p2);
-			}*/
-
-			// Lighting of block will be updated completely
-			block->setLightingExpired(false);
-		}
-		}
-
-		{
-			//TimeTaker timer("unSpreadLight");
-			vmanip.unspreadLight(bank, unlight_from, light_sources, nodemgr);
-		}
-		{
-			//TimeTaker timer("spreadLight");
-			vmanip.spreadLight(bank, light_sources, nodemgr);
-		}
-		{
-			//TimeTaker timer("blitBack");
-			vmanip.blitBack(modified_blocks);
-		}
-		/*infostream<<"emerge_time="<<emerge_time<<std::endl;
-		emerge_time = 0;*/
-	}
-#endif
-
-	//m_dout<<"Done ("<<getTimestamp()<<")"<<std::endl;
+	voxalgo::update_lighting_blocks(this, m_gamedef->ndef(), bank, a_blocks,
+		modified_blocks);
 }
 
 void Map::updateLighting(std::map<v3s16, MapBlock*> & a_blocks,
@@ -830,16 +337,24 @@ void Map::addNodeAndUpdate(v3s16 p, MapNode n,
 	n.setLight(LIGHTBANK_NIGHT, 0, ndef);
 	setNode(p, n);
 
-	// Update lighting
-	std::vector<std::pair<v3s16, MapNode> > oldnodes;
-	oldnodes.push_back(std::pair<v3s16, MapNode>(p, oldnode));
-	voxalgo::update_lighting_nodes(this, ndef, oldnodes, modified_blocks);
+	if (m_bulk_edit_depth > 0) {
+		// Lighting is updated by endBulkEdit(), which needs the node
+		// that was here before the bulk edit
+		m_bulk_edit_oldnodes.insert(std::make_pair(p, oldnode));
+		v3s16 blockpos = getNodeBlockPos(p);
+		modified_blocks[blockpos] = getBlockNoCreate(blockpos);
+	} else {
+		// Update lighting
+		std::vector<std::pair<v3s16, MapNode> > oldnodes;
+		oldnodes.push_back(std::pair<v3s16, MapNode>(p, oldnode));
+		voxalgo::update_lighting_nodes(this, ndef, oldnodes, modified_blocks);
 
-	for(std::map<v3s16, MapBlock*>::iterator
-			i = modified_blocks.begin();
-			i != modified_blocks.end(); ++i)
-	{
-		i->second->expireDayNightDiff();
+		for(std::map<v3s16, MapBlock*>::iterator
+				i = modified_blocks.begin();
+				i != modified_blocks.end(); ++i)
+		{
+			i->second->expireDayNightDiff();
+		}
 	}
 
 	// Report for rollback
@@ -941,6 +456,41 @@ bool Map::removeNodeWithEvent(v3s16 p)
 	return succeeded;
 }
 
+void Map::beginBulkEdit()
+{
+	m_bulk_edit_depth++;
+}
+
+void Map::endBulkEdit()
+{
+	assert(m_bulk_edit_depth > 0);
+	if (--m_bulk_edit_depth > 0 || m_bulk_edit_oldnodes.empty())
+		return;
+
+	INodeDefManager *ndef = m_gamedef->ndef();
+
+	std::vector<std::pair<v3s16, MapNode> > oldnodes(
+		m_bulk_edit_oldnodes.begin(), m_bulk_edit_oldnodes.end());
+	m_bulk_edit_oldnodes.clear();
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	voxalgo::update_lighting_nodes(this, ndef, oldnodes, modified_blocks);
+
+	for(std::map<v3s16, MapBlock*>::iterator
+			i = modified_blocks.begin();
+			i != modified_blocks.end(); ++i)
+	{
+		i->second->expireDayNightDiff();
+	}
+
+	MapEditEvent event;
+	event.type = MEET_OTHER;
+	for (std::map<v3s16, MapBlock*>::iterator it = modified_blocks.begin();
+			it != modified_blocks.end(); ++it)
+		event.modified_blocks.insert(it->first);
+	dispatchEvent(&event);
+}
+
 bool Map::getDayNightDiff(v3s16 blockpos)
 {
 	try{
@@ -998,26 +548,11 @@ bool Map::getDayNightDiff(v3s16 blockpos)
 	return false;
 }
 
-struct TimeOrderedMapBlock {
-	MapSector *sect;
-	MapBlock *block;
-
-	TimeOrderedMapBlock(MapSector *sect, MapBlock *block) :
-		sect(sect),
-		block(block)
-	{}
-
-	bool operator<(const TimeOrderedMapBlock &b) const
-	{
-		return block->getUsageTimer() < b.block->getUsageTimer();
-	};
-};
-
 /*
 	Updates usage timers
 */
 void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
-		std::vector<v3s16> *unloaded_blocks)
+		u64 memory_budget, std::vector<v3s16> *unloaded_blocks)
 {
 	bool save_before_unloading = (mapType() == MAPTYPE_SERVER);
 
@@ -1027,112 +562,53 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 	std::vector<v2s16> sector_deletion_queue;
 	u32 deleted_blocks_count = 0;
 	u32 saved_blocks_count = 0;
-	u32 block_count_all = 0;
-
-	beginSave();
-
-	// If there is no practical limit, we spare creation of mapblock_queue
-	if (max_loaded_blocks == U32_MAX) {
-		for (std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
-				si != m_sectors.end(); ++si) {
-			MapSector *sector = si->second;
-
-			bool all_blocks_deleted = true;
-
-			MapBlockVect blocks;
-			sector->getBlocks(blocks);
 
-			for (MapBlockVect::iterator i = blocks.begin();
-					i != blocks.end(); ++i) {
-				MapBlock *block = (*i);
-
-				block->incrementUsageTimer(dtime);
-
-				if (block->refGet() == 0
-						&& block->getUsageTimer() > unload_timeout) {
-					v3s16 p = block->getPos();
-
-					// Save if modified
-					if (block->getModified() != MOD_STATE_CLEAN
-							&& save_before_unloading) {
-						modprofiler.add(block->getModifiedReasonString(), 1);
-						if (!saveBlock(block))
-							continue;
-						saved_blocks_count++;
-					}
-
-					// Delete from memory
-					sector->deleteBlock(block);
-
-					if (unloaded_blocks)
-						unloaded_blocks->push_back(p);
-
-					deleted_blocks_count++;
-				} else {
-					all_blocks_deleted = false;
-					block_count_all++;
-				}
-			}
-
-			if (all_blocks_deleted) {
-				sector_deletion_queue.push_back(si->first);
-			}
-		}
-	} else {
-		std::priority_queue<TimeOrderedMapBlock> mapblock_queue;
-		for (std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
-				si != m_sectors.end(); ++si) {
-			MapSector *sector = si->second;
+	m_block_lru.step(dtime);
 
-			MapBlockVect blocks;
-			sector->getBlocks(blocks);
+	beginSave();
 
-			for(MapBlockVect::iterator i = blocks.begin();
-					i != blocks.end(); ++i) {
-				MapBlock *block = (*i);
+	// Only the blocks that are to be unloaded and the referenced ones
+	// among them are visited, starting from the least recently used
+	MapBlock *block = m_block_lru.getLeastRecentlyUsed();
+	while (block != NULL) {
+		MapBlock *newer = MapBlockLRU::getNewer(block);
+
+		bool over_limit = m_block_lru.size() > max_loaded_blocks
+			|| (memory_budget != 0
+				&& m_block_lru.getMemoryUsage() > memory_budget);
+		// All the remaining blocks were used more recently
+		if (!over_limit && m_block_lru.getUnusedTime(block) <= unload_timeout)
+			break;
 
-				block->incrementUsageTimer(dtime);
-				mapblock_queue.push(TimeOrderedMapBlock(sector, block));
-			}
+		if (block->refGet() != 0) {
+			block = newer;
+			continue;
 		}
-		block_count_all = mapblock_queue.size();
-		// Delete old blocks, and blocks over the limit from the memory
-		while (!mapblock_queue.empty() && (mapblock_queue.size() > max_loaded_blocks
-				|| mapblock_queue.top().block->getUsageTimer() > unload_timeout)) {
-			TimeOrderedMapBlock b = mapblock_queue.top();
-			mapblock_queue.pop();
 
-			MapBlock *block = b.block;
+		v3s16 p = block->getPos();
 
-			if (block->refGet() != 0)
+		// Save if modified
+		if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
+			modprofiler.add(block->getModifiedReasonString(), 1);
+			if (!saveBlock(block)) {
+				block = newer;
 				continue;
-
-			v3s16 p = block->getPos();
-
-			// Save if modified
-			if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
-				modprofiler.add(block->getModifiedReasonString(), 1);
-				if (!saveBlock(block))
-					continue;
-				saved_blocks_count++;
 			}
+			saved_blocks_count++;
+		}
 
-			// Delete from memory
-			b.sect->deleteBlock(block);
+		// Delete from memory
+		v2s16 p2d(p.X, p.Z);
+		MapSector *sector = getSectorNoGenerateNoEx(p2d);
+		sector->deleteBlock(block);
+		if (sector->empty())
+			sector_deletion_queue.push_back(p2d);
 
-			if (unloaded_blocks)
-				unloaded_blocks->push_back(p);
+		if (unloaded_blocks)
+			unloaded_blocks->push_back(p);
 
-			deleted_blocks_count++;
-			block_count_all--;
-		}
-		// Delete empty sectors
-		for (std::map<v2s16, MapSector*>::iterator si = m_sectors.begin();
-			si != m_sectors.end(); ++si) {
-			if (si->second->empty()) {
-				sector_deletion_queue.push_back(si->first);
-			}
-		}
+		deleted_blocks_count++;
+		block = newer;
 	}
 	endSave();
 
@@ -1146,7 +622,8 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 				<<" blocks from memory";
 		if(save_before_unloading)
 			infostream<<", of which "<<saved_blocks_count<<" were written";
-		infostream<<", "<<block_count_all<<" blocks in memory";
+		infostream<<", "<<m_block_lru.size()<<" blocks in memory using "
+				<<(m_block_lru.getMemoryUsage() / 1024)<<" KiB";
 		infostream<<"."<<std::endl;
 		if(saved_blocks_count != 0){
 			PrintInfo(infostream); // ServerMap/ClientMap:
@@ -1158,7 +635,7 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 
 void Map::unloadUnreferencedBlocks(std::vector<v3s16> *unloaded_blocks)
 {
-	timerUpdate(0.0, -1.0, 0, unloaded_blocks);
+	timerUpdate(0.0, -1.0, 0, 0, unloaded_blocks);
 }
 
 void Map::deleteSectors(std::vector<v2s16> &sectorList)
@@ -1664,6 +1141,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
 	return true;
 }
 
@@ -1679,6 +1157,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
 }
 
 NodeTimer Map::getNodeTimer(v3s16 p)
@@ -1742,7 +1221,9 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 	Map(dout_server, gamedef),
 	settings_mgr(g_settings, savedir + DIR_DELIM + "map_meta.txt"),
 	m_emerge(emerge),
-	m_map_metadata_changed(true)
+	m_map_metadata_changed(true),
+	m_saver(NULL),
+	m_map_compression(MAP_COMPRESSION_ZLIB)
 {
 	verbosestream<<FUNCTION_NAME<<std::endl;
 
@@ -1763,10 +1244,32 @@ ServerMap::ServerMap(std::string savedir, IGameDef *gamedef, EmergeManager *emer
 	}
 	std::string backend = conf.get("backend");
 	dbase = createDatabase(backend, savedir, conf);
+	u64 cache_size = g_settings->getU64("map_database_cache_size");
+	if (cache_size > 0)
+		dbase = new Database_Cache(dbase, cache_size);
 
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
 
+	// Blocks of any codec can be read, this is only used for saving
+	if (conf.exists("map_compression")) {
+		std::string compression = conf.get("map_compression");
+		if (compression == "lz4") {
+			m_map_compression = MAP_COMPRESSION_LZ4;
+		} else if (compression != "zlib") {
+			warningstream << "ServerMap: Unknown map_compression \""
+				<< compression << "\" in world.mt, using zlib" << std::endl;
+		}
+	}
+
+	u16 save_threads = g_settings->getU16("num_map_save_threads");
+	if (save_threads > 0) {
+		s32 queue_size = MYMAX(g_settings->getS32("map_save_queue_size"), 1);
+		m_saver = new MapSaver(dbase, m_db_mutex, save_threads, queue_size);
+		infostream << "ServerMap: saving blocks with "
+			<< m_saver->getThreadCount() << " threads" << std::endl;
+	}
+
 	m_savedir = savedir;
 	m_map_saving_enabled = false;
 
@@ -1844,6 +1347,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	// Waits for the queued blocks to be written
+	delete m_saver;
+
 	/*
 		Close database if it was opened
 	*/
@@ -2021,6 +1527,10 @@ void ServerMap::finishBlockMake(BlockMakeData *data,
 		*/
 		block->raiseModified(MOD_STATE_WRITE_NEEDED,
 			MOD_REASON_EXPIRE_DAYNIGHTDIFF);
+		/*
+			Most generated blocks are all air or all stone
+		*/
+		block->compactNodes();
 	}
 
 	/*
@@ -2413,6 +1923,7 @@ s16 ServerMap::findGroundLevel(v2s16 p2d)
 }
 
 bool ServerMap::loadFromFolders() {
+	MutexAutoLock lock(m_db_mutex);
 	if (!dbase->initialized() &&
 			!fs::PathExists(m_savedir + DIR_DELIM + "map.sqlite"))
 		return true;
@@ -2520,6 +2031,8 @@ void ServerMap::save(ModifiedState save_level)
 			m_map_metadata_changed = false;
 	}
 
+	raiseFailedSaves();
+
 	// Profile modified reasons
 	Profiler modprofiler;
 
@@ -2595,6 +2108,11 @@ void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 		errorstream << "Map::listAllLoadableBlocks(): Result will be missing "
 				<< "all blocks that are stored in flat files." << std::endl;
 	}
+	// Blocks that are new in the database may still be queued
+	if (m_saver)
+		m_saver->flush();
+
+	MutexAutoLock lock(m_db_mutex);
 	dbase->listAllLoadableBlocks(dst);
 }
 
@@ -2800,6 +2318,10 @@ Database *ServerMap::createDatabase(
 		return new Database_SQLite3(savedir);
 	if (name == "dummy")
 		return new Database_Dummy();
+	#ifndef _WIN32
+	else if (name == "blocklog")
+		return new Database_BlockLog(savedir);
+	#endif
 	#if USE_LEVELDB
 	else if (name == "leveldb")
 		return new Database_LevelDB(savedir);
@@ -2818,20 +2340,83 @@ Database *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	// The write thread of m_saver opens its own transactions
+	if (m_saver) {
+		// Keep the blocks whose write failed from being unloaded
+		raiseFailedSaves();
+		return;
+	}
+
+	m_transaction_blocks.clear();
+	MutexAutoLock lock(m_db_mutex);
 	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
-	dbase->endSave();
+	if (m_saver)
+		return;
+
+	std::vector<v3s16> saved;
+	saved.swap(m_transaction_blocks);
+	try {
+		MutexAutoLock lock(m_db_mutex);
+		dbase->endSave();
+	} catch (DatabaseException &e) {
+		errorstream << "ServerMap: " << e.what() << std::endl;
+		raiseFailedSaves(saved);
+	}
+}
+
+void ServerMap::raiseFailedSaves()
+{
+	if (!m_saver)
+		return;
+
+	std::vector<v3s16> failed;
+	m_saver->takeFailedBlocks(failed);
+	raiseFailedSaves(failed);
+}
+
+void ServerMap::raiseFailedSaves(const std::vector<v3s16> &positions)
+{
+	for (size_t i = 0; i < positions.size(); i++) {
+		MapBlock *block = getBlockNoCreateNoEx(positions[i]);
+		if (block == NULL) {
+			errorstream << "ServerMap: Block " << PP(positions[i])
+				<< " failed to save and is no longer loaded,"
+				<< " its changes are lost" << std::endl;
+			continue;
+		}
+		block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SAVE_FAILED);
+	}
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase);
+	if (!m_saver) {
+		MutexAutoLock lock(m_db_mutex);
+		if (!saveBlock(block, dbase, m_map_compression))
+			return false;
+		m_transaction_blocks.push_back(block->getPos());
+		return true;
+	}
+
+	// Dummy blocks are not written
+	if (block->isDummy()) {
+		warningstream << "saveBlock: Not writing dummy block "
+			<< PP(block->getPos()) << std::endl;
+		return true;
+	}
+
+	m_saver->queueBlock(block, m_map_compression);
+	// The queued snapshot is the block as it is now. If writing it
+	// fails, raiseFailedSaves() marks the block as modified again.
+	block->resetModified();
+	return true;
 }
 
-bool ServerMap::saveBlock(MapBlock *block, Database *db)
+bool ServerMap::saveBlock(MapBlock *block, Database *db, u8 compression)
 {
 	v3s16 p3d = block->getPos();
 
@@ -2843,7 +2428,7 @@ bool ServerMap::saveBlock(MapBlock *block, Database *db)
 	}
 
 	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	u8 version = ser_ver_for_map_compression(compression);
 
 	/*
 		[0] u8 serialization version
@@ -2851,7 +2436,7 @@ bool ServerMap::saveBlock(MapBlock *block, Database *db)
 	*/
 	std::ostringstream o(std::ios_base::binary);
 	o.write((char*) &version, 1);
-	block->serialize(o, version, true);
+	block->serialize(o, version, true, compression);
 
 	std::string data = o.str();
 	bool ret = db->saveBlock(p3d, data);
@@ -2919,6 +2504,8 @@ void ServerMap::loadBlock(std::string sectordir, std::string blockfile,
 		if(version < SER_FMT_VER_HIGHEST_WRITE || save_after_load)
 		{
 			saveBlock(block);
+			if (m_saver)
+				m_saver->waitForBlock(p3d);
 
 			// Should be in database now, so delete the old file
 			fs::RecursiveDelete(fullpath);
@@ -3013,16 +2600,36 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 	}
 }
 
+void ServerMap::readBlock(v3s16 blockpos, std::string *blob)
+{
+	// The database may not have the last version of the block yet
+	if (m_saver)
+		m_saver->waitForBlock(blockpos);
+
+	if (dbase->supportsConcurrentLoads()) {
+		dbase->loadBlock(blockpos, blob);
+		return;
+	}
+
+	MutexAutoLock lock(m_db_mutex);
+	dbase->loadBlock(blockpos, blob);
+}
+
 MapBlock* ServerMap::loadBlock(v3s16 blockpos)
+{
+	std::string blob;
+	readBlock(blockpos, &blob);
+	return loadBlock(blockpos, &blob);
+}
+
+MapBlock* ServerMap::loadBlock(v3s16 blockpos, std::string *blob)
 {
 	DSTACK(FUNCTION_NAME);
 
 	v2s16 p2d(blockpos.X, blockpos.Z);
 
-	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
-	if (ret != "") {
-		loadBlock(&ret, blockpos, createSector(p2d), false);
+	if (*blob != "") {
+		loadBlock(blob, blockpos, createSector(p2d), false);
 		return getBlockNoCreateNoEx(blockpos);
 	}
 	// Not found in database, try the files
@@ -3086,8 +2693,15 @@ MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
-		return false;
+	// A queued version would bring the block back
+	if (m_saver)
+		m_saver->waitForBlock(blockpos);
+
+	{
+		MutexAutoLock lock(m_db_mutex);
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
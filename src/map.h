@@ -31,13 +31,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "constants.h"
 #include "voxel.h"
 #include "modifiedstate.h"
+#include "mapblockindex.h"
+#include "mapblocklru.h"
 #include "util/container.h"
 #include "util/cpp11_container.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
+#include "threading/mutex.h"
 
 class Settings;
 class Database;
+class MapSaver;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -187,6 +191,7 @@ class Map /*: public NodeContainer*/
 	// Returns InvalidPositionException if not found
 	MapBlock * getBlockNoCreate(v3s16 p);
 	// Returns NULL if not found
+	// Goes through m_block_index, the last hit of each thread is cached
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 
 	/* Server overrides */
@@ -206,15 +211,8 @@ class Map /*: public NodeContainer*/
 	// position is valid, otherwise false
 	MapNode getNodeNoEx(v3s16 p, bool *is_valid_position = NULL);
 
-	void unspreadLight(enum LightBank bank,
-			std::map<v3s16, u8> & from_nodes,
-			std::set<v3s16> & light_sources,
-			std::map<v3s16, MapBlock*> & modified_blocks);
-
-	void spreadLight(enum LightBank bank,
-			std::set<v3s16> & from_nodes,
-			std::map<v3s16, MapBlock*> & modified_blocks);
-	
+	// Recalculates the light of whole blocks,
+	// see voxalgo::update_lighting_blocks()
 	void updateLighting(enum LightBank bank,
 			std::map<v3s16, MapBlock*>  & a_blocks,
 			std::map<v3s16, MapBlock*> & modified_blocks);
@@ -239,6 +237,18 @@ class Map /*: public NodeContainer*/
 	bool addNodeWithEvent(v3s16 p, MapNode n, bool remove_metadata = true);
 	bool removeNodeWithEvent(v3s16 p);
 
+	/*
+		Bulk edits defer the lighting updates of the above functions.
+		Until endBulkEdit(), only the old nodes of the changed positions
+		are noted, then the lighting of all of them is updated at once
+		and a MEET_OTHER event is sent for the modified blocks.
+		Bulk edits can be nested, the outermost one updates the lighting.
+		See also MapBulkEdit.
+	*/
+	void beginBulkEdit();
+	void endBulkEdit();
+	bool isBulkEditing() const { return m_bulk_edit_depth > 0; }
+
 	/*
 		Takes the blocks at the edges into account
 	*/
@@ -261,10 +271,13 @@ class Map /*: public NodeContainer*/
 
 	/*
 		Updates usage timers and unloads unused blocks and sectors.
+		Least recently used blocks are unloaded first, until no remaining
+		block is older than unload_timeout, and the blocks fit into
+		max_loaded_blocks and memory_budget bytes (0 means no limit).
 		Saves modified blocks before unloading on MAPTYPE_SERVER.
 	*/
 	void timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
-			std::vector<v3s16> *unloaded_blocks=NULL);
+			u64 memory_budget, std::vector<v3s16> *unloaded_blocks=NULL);
 
 	/*
 		Unloads all blocks with a zero refCount().
@@ -330,6 +343,16 @@ class Map /*: public NodeContainer*/
 
 protected:
 	friend class LuaVoxelManip;
+	friend class MapSector;
+	friend class MapBlock;
+
+	// Called by MapSector when it gains or loses a block
+	void indexBlock(MapBlock *block);
+	void unindexBlock(MapBlock *block);
+
+	// Called by MapBlock when it is used or its node data changes size
+	void touchBlock(MapBlock *block);
+	void updateBlockMemoryUsage(MapBlock *block);
 
 	std::ostream &m_dout; // A bit deprecated, could be removed
 
@@ -343,6 +366,11 @@ class Map /*: public NodeContainer*/
 	MapSector *m_sector_cache;
 	v2s16 m_sector_cache_p;
 
+	// All blocks of all sectors, by block position
+	MapBlockIndex m_block_index;
+	// All blocks of all sectors, by time of last use
+	MapBlockLRU m_block_lru;
+
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
 
@@ -352,9 +380,37 @@ class Map /*: public NodeContainer*/
 	u32 m_inc_trending_up_start_time; // milliseconds
 	bool m_queue_size_timer_started;
 
+	// Nesting level of bulk edits
+	u32 m_bulk_edit_depth;
+	// Nodes changed during the bulk edit, with the node they replaced first
+	std::map<v3s16, MapNode> m_bulk_edit_oldnodes;
+
 	DISABLE_CLASS_COPY(Map);
 };
 
+/*
+	Map::beginBulkEdit() for the lifetime of the object
+*/
+class MapBulkEdit
+{
+public:
+	MapBulkEdit(Map *map) :
+		m_map(map)
+	{
+		m_map->beginBulkEdit();
+	}
+
+	~MapBulkEdit()
+	{
+		m_map->endBulkEdit();
+	}
+
+private:
+	Map *m_map;
+
+	DISABLE_CLASS_COPY(MapBulkEdit);
+};
+
 /*
 	ServerMap
 
@@ -443,9 +499,15 @@ class ServerMap : public Map
 	bool loadFromFolders();
 
 	// Call these before and after saving of blocks
+	// No-ops when blocks are saved in the background by m_saver
 	void beginSave();
 	void endSave();
 
+	// Marks the loaded blocks that m_saver failed to write, or the given
+	// ones, as modified again, so that they are saved again
+	void raiseFailedSaves();
+	void raiseFailedSaves(const std::vector<v3s16> &positions);
+
 	void save(ModifiedState save_level);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 	void listAllLoadedBlocks(std::vector<v3s16> &dst);
@@ -471,11 +533,19 @@ class ServerMap : public Map
 	// Returns true if sector now resides in memory
 	//bool deFlushSector(v2s16 p2d);
 
+	// Only queues the block if saving happens in the background
 	bool saveBlock(MapBlock *block);
-	static bool saveBlock(MapBlock *block, Database *db);
+	static bool saveBlock(MapBlock *block, Database *db,
+		u8 compression = MAP_COMPRESSION_ZLIB);
 	// This will generate a sector with getSector if not found.
 	void loadBlock(std::string sectordir, std::string blockfile, MapSector *sector, bool save_after_load=false);
 	MapBlock* loadBlock(v3s16 p);
+	// Reads the block data from the database, empty if not found. Doesn't
+	// touch the map, so it may be called without the environment lock.
+	void readBlock(v3s16 p, std::string *blob);
+	// Loads a block read by readBlock(), from the legacy sector
+	// directories if it wasn't in the database
+	MapBlock* loadBlock(v3s16 p, std::string *blob);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
@@ -514,6 +584,15 @@ class ServerMap : public Map
 	*/
 	bool m_map_metadata_changed;
 	Database *dbase;
+	// Held while using dbase, which m_saver writes to in its own thread
+	Mutex m_db_mutex;
+	// NULL if blocks are saved synchronously
+	MapSaver *m_saver;
+	// Blocks saved synchronously since beginSave(), saved again if the
+	// commit in endSave() fails
+	std::vector<v3s16> m_transaction_blocks;
+	// MapCompression codec of saved blocks, from world.mt
+	u8 m_map_compression;
 };
 
 
@@ -35,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif
 #include "util/string.h"
 #include "util/serialize.h"
+#include "util/cpp11_container.h"
 
 #define PP(x) "("<<(x).X<<","<<(x).Y<<","<<(x).Z<<")"
 
@@ -59,6 +60,7 @@ static const char *modified_reason_strings[] = {
 	"deactivateFarObjects: Static data changed considerably",
 	"finishBlockMake: expireDayNightDiff",
 	"unknown",
+	"MapSaver: write failed",
 };
 
 
@@ -71,6 +73,7 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_pos(pos),
 		m_pos_relative(pos * MAP_BLOCKSIZE),
 		m_gamedef(gamedef),
+		m_index_bits(0),
 		m_modified(MOD_STATE_WRITE_NEEDED),
 		m_modified_reason(MOD_REASON_INITIAL),
 		is_underground(false),
@@ -78,9 +81,13 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_day_night_differs(false),
 		m_day_night_differs_expired(true),
 		m_generated(false),
+		m_contents_expired(true),
 		m_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
 		m_disk_timestamp(BLOCK_TIMESTAMP_UNDEFINED),
-		m_usage_timer(0),
+		m_lru_newer(NULL),
+		m_lru_older(NULL),
+		m_lru_memory(0),
+		m_last_used(0),
 		m_refcount(0)
 {
 	data = NULL;
@@ -126,14 +133,14 @@ MapNode MapBlock::getNodeParent(v3s16 p, bool *is_valid_position)
 	if (isValidPosition(p) == false)
 		return m_parent->getNodeNoEx(getPosRelative() + p, is_valid_position);
 
-	if (data == NULL) {
+	if (isDummy()) {
 		if (is_valid_position)
 			*is_valid_position = false;
 		return MapNode(CONTENT_IGNORE);
 	}
 	if (is_valid_position)
 		*is_valid_position = true;
-	return data[p.Z * zstride + p.Y * ystride + p.X];
+	return readNode(p.Z * zstride + p.Y * ystride + p.X);
 }
 
 std::string MapBlock::getModifiedReasonString()
@@ -358,7 +365,8 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
 	// Copy from data to VoxelManipulator
-	dst.copyFrom(data, data_area, v3s16(0,0,0),
+	std::vector<MapNode> buffer;
+	dst.copyFrom(getNodesForReading(buffer), data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
 }
 
@@ -367,9 +375,15 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	v3s16 data_size(MAP_BLOCKSIZE, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
+	if (isCompact())
+		expandNodes();
+
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+
+	expireContents();
+	m_network_cache.clear();
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -379,18 +393,22 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	// Running this function un-expires m_day_night_differs
 	m_day_night_differs_expired = false;
 
-	if (data == NULL) {
+	if (isDummy()) {
 		m_day_night_differs = false;
 		return;
 	}
 
-	bool differs;
+	// A compact block only needs its distinct nodes to be checked
+	const MapNode *nodes = data ? data : &m_palette[0];
+	u32 count = data ? nodecount : m_palette.size();
+
+	bool differs = false;
 
 	/*
 		Check if any lighting value differs
 	*/
-	for (u32 i = 0; i < nodecount; i++) {
-		MapNode &n = data[i];
+	for (u32 i = 0; i < count; i++) {
+		const MapNode &n = nodes[i];
 
 		differs = !n.isLightDayNightEq(nodemgr);
 		if (differs)
@@ -403,8 +421,8 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	*/
 	if (differs) {
 		bool only_air = true;
-		for (u32 i = 0; i < nodecount; i++) {
-			MapNode &n = data[i];
+		for (u32 i = 0; i < count; i++) {
+			const MapNode &n = nodes[i];
 			if (n.getContent() != CONTENT_AIR) {
 				only_air = false;
 				break;
@@ -418,11 +436,147 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	m_day_night_differs = differs;
 }
 
+void MapBlock::actuallyUpdateContents()
+{
+	m_contents_expired = false;
+	m_contents.clear();
+
+	if (isDummy())
+		return;
+
+	const MapNode *nodes = data ? data : &m_palette[0];
+	u32 count = data ? nodecount : m_palette.size();
+
+	// Runs of the same content are very common, skip them cheaply
+	content_t last = CONTENT_IGNORE;
+	bool have_last = false;
+	for (u32 i = 0; i < count; i++) {
+		content_t c = nodes[i].getContent();
+		if (have_last && c == last)
+			continue;
+		addContent(c);
+		last = c;
+		have_last = true;
+	}
+}
+
+// Largest palette of a compact block, indices have at most 8 bits
+#define MAX_PALETTE_SIZE 256
+
+bool MapBlock::compactNodes()
+{
+	if (data == NULL)
+		return false;
+
+	// Collect the distinct nodes, giving up once there are too many
+	std::vector<MapNode> palette;
+	std::vector<u8> indices(nodecount);
+	UNORDERED_MAP<u32, u8> palette_indices;
+	u32 last_key = 0;
+	u8 last_index = 0;
+	for (u32 i = 0; i < nodecount; i++) {
+		const MapNode &n = data[i];
+		u32 key = ((u32)n.param0 << 16) | ((u32)n.param1 << 8) | n.param2;
+		// Runs of the same node are very common, skip the lookup for them
+		if (i == 0 || key != last_key) {
+			UNORDERED_MAP<u32, u8>::iterator it = palette_indices.find(key);
+			if (it == palette_indices.end()) {
+				if (palette.size() == MAX_PALETTE_SIZE)
+					return false;
+				it = palette_indices.insert(
+					std::make_pair(key, (u8)palette.size())).first;
+				palette.push_back(n);
+			}
+			last_key = key;
+			last_index = it->second;
+		}
+		indices[i] = last_index;
+	}
+
+	// Powers of two, so that no index spans two u32s
+	u8 bits = 0;
+	if (palette.size() > 1) {
+		bits = 1;
+		while ((1U << bits) < palette.size())
+			bits *= 2;
+	}
+
+	std::vector<u32> packed(nodecount * bits / 32, 0);
+	for (u32 i = 0; i < nodecount && bits > 0; i++) {
+		u32 bit = i * bits;
+		packed[bit >> 5] |= (u32)indices[i] << (bit & 31);
+	}
+
+	delete[] data;
+	data = NULL;
+	std::vector<MapNode>(palette).swap(m_palette);
+	m_indices.swap(packed);
+	m_index_bits = bits;
+	updateMemoryUsage();
+	return true;
+}
+
+u32 MapBlock::getNodeDataSize()
+{
+	if (data != NULL)
+		return nodecount * sizeof(MapNode);
+	return m_palette.size() * sizeof(MapNode) + m_indices.size() * sizeof(u32);
+}
+
+void MapBlock::expandNodes()
+{
+	MapNode *nodes = new MapNode[nodecount];
+	unpackNodes(nodes);
+	data = nodes;
+	freeCompactNodes();
+	updateMemoryUsage();
+}
+
+void MapBlock::updateMemoryUsage()
+{
+	if (m_parent)
+		m_parent->updateBlockMemoryUsage(this);
+}
+
+void MapBlock::resetUsageTimer()
+{
+	if (m_parent)
+		m_parent->touchBlock(this);
+}
+
+void MapBlock::freeCompactNodes()
+{
+	std::vector<MapNode>().swap(m_palette);
+	std::vector<u32>().swap(m_indices);
+	m_index_bits = 0;
+}
+
+void MapBlock::unpackNodes(MapNode *dst)
+{
+	if (data != NULL) {
+		std::copy(data, data + nodecount, dst);
+	} else if (m_index_bits == 0) {
+		std::fill(dst, dst + nodecount, m_palette[0]);
+	} else {
+		for (u32 i = 0; i < nodecount; i++)
+			dst[i] = readNode(i);
+	}
+}
+
+const MapNode *MapBlock::getNodesForReading(std::vector<MapNode> &buffer)
+{
+	if (data != NULL || isDummy())
+		return data;
+	buffer.resize(nodecount);
+	unpackNodes(&buffer[0]);
+	return &buffer[0];
+}
+
 void MapBlock::expireDayNightDiff()
 {
 	//INodeDefManager *nodemgr = m_gamedef->ndef();
 
-	if(data == NULL){
+	if(isDummy()){
 		m_day_night_differs = false;
 		m_day_night_differs_expired = false;
 		return;
@@ -440,7 +594,10 @@ s16 MapBlock::getGroundLevel(v2s16 p2d)
 		s16 y = MAP_BLOCKSIZE-1;
 		for(; y>=0; y--)
 		{
-			MapNode n = getNodeRef(p2d.X, y, p2d.Y);
+			bool is_valid;
+			MapNode n = getNode(p2d.X, y, p2d.Y, &is_valid);
+			if (!is_valid)
+				throw InvalidPositionException();
 			if(m_gamedef->ndef()->get(n).walkable)
 			{
 				if(y == MAP_BLOCKSIZE-1)
@@ -554,95 +711,173 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
-void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
+void MapBlock::serialize(std::ostream &os, u8 version, bool disk,
+		u8 compression)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
 
-	if(data == NULL)
+	if(isDummy())
 	{
 		throw SerializationError("ERROR: Not writing dummy block.");
 	}
 
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
 
+	if(version < SER_FMT_VER_MAP_COMPRESSION)
+		compression = MAP_COMPRESSION_ZLIB;
+
+	if(disk)
+	{
+		MapBlockSnapshot snapshot;
+		takeSnapshot(&snapshot, version, compression);
+		serializeSnapshot(os, snapshot);
+		return;
+	}
+
 	// First byte
-	u8 flags = 0;
-	if(is_underground)
-		flags |= 0x01;
-	if(getDayNightDiff())
-		flags |= 0x02;
-	if(m_lighting_expired)
-		flags |= 0x04;
-	if(m_generated == false)
-		flags |= 0x08;
-	writeU8(os, flags);
+	writeU8(os, getSerializationFlags());
+	if(version >= SER_FMT_VER_MAP_COMPRESSION)
+		writeU8(os, compression);
 
 	/*
 		Bulk node data
 	*/
-	NameIdMapping nimap;
-	if(disk)
-	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
-		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
-
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
-				content_width, params_width, true);
-		delete[] tmp_nodes;
-	}
-	else
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	std::vector<MapNode> buffer;
+	MapNode::serializeBulk(os, version, getNodesForReading(buffer), nodecount,
+			content_width, params_width, true, compression);
+
+	/*
+		Node metadata
+	*/
+	std::ostringstream oss(std::ios_base::binary);
+	m_node_metadata.serialize(oss);
+	compressMapData(oss.str(), os, compression);
+}
+
+const std::string &MapBlock::getNetworkSerialization(u8 version)
+{
+	std::map<u8, std::string>::iterator it = m_network_cache.find(version);
+	if (it != m_network_cache.end())
+		return it->second;
+
+	std::ostringstream os(std::ios_base::binary);
+	serialize(os, version, false);
+	std::string &cached = m_network_cache[version];
+	cached = os.str();
+	updateMemoryUsage();
+	return cached;
+}
+
+u32 MapBlock::getNetworkCacheSize()
+{
+	u32 size = 0;
+	for (std::map<u8, std::string>::iterator it = m_network_cache.begin();
+			it != m_network_cache.end(); ++it)
+		size += it->second.capacity();
+	return size;
+}
+
+void MapBlock::takeSnapshot(MapBlockSnapshot *snapshot, u8 version,
+		u8 compression)
+{
+	if(!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	if(isDummy())
 	{
-		u8 content_width = 2;
-		u8 params_width = 2;
-		writeU8(os, content_width);
-		writeU8(os, params_width);
-		MapNode::serializeBulk(os, version, data, nodecount,
-				content_width, params_width, true);
+		throw SerializationError("ERROR: Not writing dummy block.");
 	}
 
+	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
+
+	snapshot->pos = getPos();
+	snapshot->version = version;
+	snapshot->compression = version >= SER_FMT_VER_MAP_COMPRESSION ?
+		compression : (u8)MAP_COMPRESSION_ZLIB;
+	snapshot->flags = getSerializationFlags();
+
+	/*
+		Bulk node data
+	*/
+	NameIdMapping nimap;
+	snapshot->nodes.resize(nodecount);
+	unpackNodes(&snapshot->nodes[0]);
+	getBlockNodeIdMapping(&nimap, &snapshot->nodes[0], m_gamedef->ndef());
+
 	/*
 		Node metadata
 	*/
 	std::ostringstream oss(std::ios_base::binary);
 	m_node_metadata.serialize(oss);
-	compressZlib(oss.str(), os);
+	snapshot->metadata = oss.str();
 
 	/*
 		Data that goes to disk, but not the network
 	*/
-	if(disk)
-	{
-		if(version <= 24){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	std::ostringstream os(std::ios_base::binary);
+	if(version <= 24){
+		// Node timers
+		m_node_timers.serialize(os, version);
+	}
 
-		// Static objects
-		m_static_objects.serialize(os);
+	// Static objects
+	m_static_objects.serialize(os);
 
-		// Timestamp
-		writeU32(os, getTimestamp());
+	// Timestamp
+	writeU32(os, getTimestamp());
 
-		// Write block-specific node definition id mapping
-		nimap.serialize(os);
+	// Write block-specific node definition id mapping
+	nimap.serialize(os);
 
-		if(version >= 25){
-			// Node timers
-			m_node_timers.serialize(os, version);
-		}
+	if(version >= 25){
+		// Node timers
+		m_node_timers.serialize(os, version);
 	}
+	snapshot->tail = os.str();
+}
+
+void MapBlock::serializeSnapshot(std::ostream &os,
+		const MapBlockSnapshot &snapshot)
+{
+	writeU8(os, snapshot.flags);
+	if(snapshot.version >= SER_FMT_VER_MAP_COMPRESSION)
+		writeU8(os, snapshot.compression);
+
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, snapshot.version, &snapshot.nodes[0],
+			nodecount, content_width, params_width, true,
+			snapshot.compression);
+
+	compressMapData(snapshot.metadata, os, snapshot.compression);
+
+	os.write(snapshot.tail.c_str(), snapshot.tail.size());
+}
+
+u8 MapBlock::getSerializationFlags()
+{
+	u8 flags = 0;
+	if(is_underground)
+		flags |= 0x01;
+	if(getDayNightDiff())
+		flags |= 0x02;
+	if(m_lighting_expired)
+		flags |= 0x04;
+	if(m_generated == false)
+		flags |= 0x08;
+	return flags;
 }
 
 void MapBlock::serializeNetworkSpecific(std::ostream &os, u16 net_proto_version)
 {
-	if(data == NULL)
+	if(isDummy())
 	{
 		throw SerializationError("ERROR: Not writing dummy block.");
 	}
@@ -663,6 +898,10 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	expireContents();
+	m_network_cache.clear();
+	if(isCompact())
+		expandNodes();
 
 	if(version <= 21)
 	{
@@ -676,6 +915,10 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	m_lighting_expired = (flags & 0x04) ? true : false;
 	m_generated = (flags & 0x08) ? false : true;
 
+	u8 compression = MAP_COMPRESSION_ZLIB;
+	if(version >= SER_FMT_VER_MAP_COMPRESSION)
+		compression = readU8(is);
+
 	/*
 		Bulk node data
 	*/
@@ -688,7 +931,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	if(params_width != 2)
 		throw SerializationError("MapBlock::deSerialize(): invalid params_width");
 	MapNode::deSerializeBulk(is, version, data, nodecount,
-			content_width, params_width, true);
+			content_width, params_width, true, compression);
 
 	/*
 		NodeMetadata
@@ -698,7 +941,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompressMapData(is, oss, compression);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -753,6 +996,9 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	// Most loaded blocks are all air or all stone
+	compactNodes();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Done."<<std::endl);
 }
@@ -20,7 +20,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifndef MAPBLOCK_HEADER
 #define MAPBLOCK_HEADER
 
+#include <map>
 #include <set>
+#include <vector>
+#include <algorithm>
 #include "debug.h"
 #include "irr_v3d.h"
 #include "mapnode.h"
@@ -32,6 +35,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "modifiedstate.h"
 #include "util/numeric.h" // getContainerPos
 #include "settings.h"
+#include "serialization.h"
 
 class Map;
 class NodeMetadataList;
@@ -41,6 +45,26 @@ class VoxelManipulator;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
+/*
+	Copy of everything the on-disk serialization of a MapBlock consists of,
+	with nothing compressed yet. Taking one is cheap compared to the
+	serialization itself, which can then be done without the block.
+*/
+struct MapBlockSnapshot
+{
+	v3s16 pos;
+	u8 version;
+	// MapCompression codec, only used from SER_FMT_VER_MAP_COMPRESSION on
+	u8 compression;
+	u8 flags;
+	// Content ids are the block-specific ones of the id mapping in tail
+	std::vector<MapNode> nodes;
+	// Uncompressed node metadata
+	std::string metadata;
+	// Everything written after the node metadata
+	std::string tail;
+};
+
 /*// Named by looking towards z+
 enum{
 	FACE_BACK=0,
@@ -122,6 +146,7 @@ class NodeContainer
 #define MOD_REASON_STATIC_DATA_CHANGED       (1 << 17)
 #define MOD_REASON_EXPIRE_DAYNIGHTDIFF       (1 << 18)
 #define MOD_REASON_UNKNOWN                   (1 << 19)
+#define MOD_REASON_SAVE_FAILED               (1 << 20)
 
 ////
 //// MapBlock itself
@@ -149,15 +174,46 @@ class MapBlock /*: public NodeContainer*/
 		data = new MapNode[nodecount];
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
+		freeCompactNodes();
+		updateMemoryUsage();
 
+		expireContents();
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
+	////
+	//// Compact node storage
+	////
+
+	// Stores the nodes in a palette with bit-packed indices if the block
+	// has few distinct nodes, and frees the full node array. Writing to
+	// the block expands it again. Returns true if the block was compacted.
+	bool compactNodes();
+
+	inline bool isCompact()
+	{
+		return data == NULL && !m_palette.empty();
+	}
+
+	// Bytes used for storing the nodes
+	u32 getNodeDataSize();
+
+	// Approximate bytes used by the block, metadata and objects aside
+	u32 getMemoryUsage()
+	{
+		return sizeof(MapBlock) + getNodeDataSize() + getNetworkCacheSize();
+	}
+	// Bytes allocated for the cached network serializations
+	u32 getNetworkCacheSize();
+
 	////
 	//// Modification tracking methods
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		if (!m_network_cache.empty())
+			m_network_cache.clear();
+
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -192,7 +248,7 @@ class MapBlock /*: public NodeContainer*/
 
 	inline bool isDummy()
 	{
-		return (data == NULL);
+		return (data == NULL && m_palette.empty());
 	}
 
 	inline void unDummify()
@@ -243,7 +299,7 @@ class MapBlock /*: public NodeContainer*/
 	{
 		if (m_lighting_expired)
 			return false;
-		if (data == NULL)
+		if (isDummy())
 			return false;
 		return true;
 	}
@@ -276,7 +332,7 @@ class MapBlock /*: public NodeContainer*/
 
 	inline bool isValidPosition(s16 x, s16 y, s16 z)
 	{
-		return data != NULL
+		return !isDummy()
 			&& x >= 0 && x < MAP_BLOCKSIZE
 			&& y >= 0 && y < MAP_BLOCKSIZE
 			&& z >= 0 && z < MAP_BLOCKSIZE;
@@ -294,7 +350,7 @@ class MapBlock /*: public NodeContainer*/
 		if (!*valid_position)
 			return MapNode(CONTENT_IGNORE);
 
-		return data[z * zstride + y * ystride + x];
+		return readNode(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNode(v3s16 p, bool *valid_position)
@@ -313,8 +369,11 @@ class MapBlock /*: public NodeContainer*/
 	{
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
+		if (data == NULL)
+			expandNodes();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -329,11 +388,11 @@ class MapBlock /*: public NodeContainer*/
 
 	inline MapNode getNodeNoCheck(s16 x, s16 y, s16 z, bool *valid_position)
 	{
-		*valid_position = data != NULL;
-		if (!valid_position)
+		*valid_position = !isDummy();
+		if (!*valid_position)
 			return MapNode(CONTENT_IGNORE);
 
-		return data[z * zstride + y * ystride + x];
+		return readNode(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNodeNoCheck(v3s16 p, bool *valid_position)
@@ -343,10 +402,13 @@ class MapBlock /*: public NodeContainer*/
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode & n)
 	{
-		if (data == NULL)
+		if (isDummy())
 			throw InvalidPositionException();
+		if (data == NULL)
+			expandNodes();
 
 		data[z * zstride + y * ystride + x] = n;
+		addContent(n.getContent());
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -395,6 +457,35 @@ class MapBlock /*: public NodeContainer*/
 		return m_day_night_differs;
 	}
 
+	////
+	//// Content tracking (see m_contents)
+	////
+
+	// Rebuilds m_contents from the node data.
+	void actuallyUpdateContents();
+
+	// Call this after changing the node data without going through
+	// setNode(); the contents are then rebuilt when needed.
+	inline void expireContents()
+	{
+		m_contents_expired = true;
+	}
+
+	// Sorted list of the content ids present in the block.
+	// Nodes removed since the last rebuild may still be listed.
+	inline const std::vector<content_t> &getContents()
+	{
+		if (m_contents_expired)
+			actuallyUpdateContents();
+		return m_contents;
+	}
+
+	inline bool mayContainContent(content_t c)
+	{
+		const std::vector<content_t> &contents = getContents();
+		return std::binary_search(contents.begin(), contents.end(), c);
+	}
+
 	////
 	//// Miscellaneous stuff
 	////
@@ -437,23 +528,11 @@ class MapBlock /*: public NodeContainer*/
 	}
 
 	////
-	//// Usage timer (see m_usage_timer)
+	//// Usage tracking (see MapBlockLRU)
 	////
 
-	inline void resetUsageTimer()
-	{
-		m_usage_timer = 0;
-	}
-
-	inline void incrementUsageTimer(float dtime)
-	{
-		m_usage_timer += dtime;
-	}
-
-	inline float getUsageTimer()
-	{
-		return m_usage_timer;
-	}
+	// Marks the block as used, which postpones unloading it
+	void resetUsageTimer();
 
 	////
 	//// Reference counting (see m_refcount)
@@ -505,11 +584,26 @@ class MapBlock /*: public NodeContainer*/
 	// These don't write or read version by itself
 	// Set disk to true for on-disk format, false for over-the-network format
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
-	void serialize(std::ostream &os, u8 version, bool disk);
+	// compression is a MapCompression codec. Versions below
+	// SER_FMT_VER_MAP_COMPRESSION always use zlib.
+	void serialize(std::ostream &os, u8 version, bool disk,
+			u8 compression = MAP_COMPRESSION_ZLIB);
+	// Takes what serialize(os, version, true, compression) would write
+	void takeSnapshot(MapBlockSnapshot *snapshot, u8 version,
+			u8 compression = MAP_COMPRESSION_ZLIB);
+	// Same output as serialize(os, snapshot.version, true,
+	// snapshot.compression) of the block.
+	// Doesn't use the block, so it can be done in any thread.
+	static void serializeSnapshot(std::ostream &os,
+			const MapBlockSnapshot &snapshot);
 	// If disk == true: In addition to doing other things, will add
 	// unknown blocks from id-name mapping to wndef
 	void deSerialize(std::istream &is, u8 version, bool disk);
 
+	// What serialize(os, version, false) writes. It is cached until the
+	// block is modified, so sending it to many clients compresses it once.
+	const std::string &getNetworkSerialization(u8 version);
+
 	void serializeNetworkSpecific(std::ostream &os, u16 net_proto_version);
 	void deSerializeNetworkSpecific(std::istream &is);
 
@@ -519,15 +613,23 @@ class MapBlock /*: public NodeContainer*/
 	*/
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
+	// Tells the Map that the size of the node data has changed
+	void updateMemoryUsage();
+	// First byte of the serialized block
+	u8 getSerializationFlags();
 
 	/*
 		Used only internally, because changes can't be tracked
 	*/
 
+	// The node may be changed through the reference
 	inline MapNode &getNodeRef(s16 x, s16 y, s16 z)
 	{
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
+		if (data == NULL)
+			expandNodes();
+		m_network_cache.clear();
 
 		return data[z * zstride + y * ystride + x];
 	}
@@ -537,6 +639,36 @@ class MapBlock /*: public NodeContainer*/
 		return getNodeRef(p.X, p.Y, p.Z);
 	}
 
+	// Back to the full node array, before writing to a compact block
+	void expandNodes();
+	void freeCompactNodes();
+	// Writes all nodes of a non-dummy block to dst
+	void unpackNodes(MapNode *dst);
+	// The full node array, unpacked into buffer if the block is compact
+	const MapNode *getNodesForReading(std::vector<MapNode> &buffer);
+
+	inline MapNode readNode(u32 i)
+	{
+		if (data != NULL)
+			return data[i];
+		if (m_index_bits == 0)
+			return m_palette[0];
+		u32 bit = i * m_index_bits;
+		u32 index = (m_indices[bit >> 5] >> (bit & 31)) &
+			((1 << m_index_bits) - 1);
+		return m_palette[index];
+	}
+
+	inline void addContent(content_t c)
+	{
+		if (m_contents_expired)
+			return;
+		std::vector<content_t>::iterator it =
+			std::lower_bound(m_contents.begin(), m_contents.end(), c);
+		if (it == m_contents.end() || *it != c)
+			m_contents.insert(it, c);
+	}
+
 public:
 	/*
 		Public member variables
@@ -576,11 +708,22 @@ class MapBlock /*: public NodeContainer*/
 	IGameDef *m_gamedef;
 
 	/*
-		If NULL, block is a dummy block.
+		If NULL, block is a dummy block, unless it is compact.
 		Dummy blocks are used for caching not-found-on-disk blocks.
 	*/
 	MapNode *data;
 
+	/*
+		Compact form of the node data, see compactNodes(). It is used while
+		data is NULL and m_palette isn't empty. m_palette holds the distinct
+		nodes of the block. With one entry the block is uniform, otherwise
+		m_indices holds an m_index_bits wide index into m_palette for every
+		node, packed into u32s.
+	*/
+	std::vector<MapNode> m_palette;
+	std::vector<u32> m_indices;
+	u8 m_index_bits;
+
 	/*
 		- On the server, this is used for telling whether the
 		  block has been modified from the one on disk.
@@ -614,6 +757,22 @@ class MapBlock /*: public NodeContainer*/
 
 	bool m_generated;
 
+	/*
+		Sorted set of the content ids in the block, used for skipping
+		whole blocks that can't contain a node of interest (ABMs, LBMs,
+		find_nodes_in_area). It is a superset: setNode() only ever adds
+		to it, and it is rebuilt lazily from the node data once expired.
+	*/
+	std::vector<content_t> m_contents;
+	bool m_contents_expired;
+
+	/*
+		Output of serialize(os, version, false) by version, see
+		getNetworkSerialization(). Cleared by raiseModified() and whenever
+		the node data is overwritten.
+	*/
+	std::map<u8, std::string> m_network_cache;
+
 	/*
 		When block is removed from active blocks, this is set to gametime.
 		Value BLOCK_TIMESTAMP_UNDEFINED=0xffffffff means there is no timestamp.
@@ -623,10 +782,15 @@ class MapBlock /*: public NodeContainer*/
 	u32 m_disk_timestamp;
 
 	/*
-		When the block is accessed, this is set to 0.
-		Map will unload the block when this reaches a timeout.
+		Usage list of the Map, managed by MapBlockLRU. The block is listed
+		while m_lru_memory (the memory accounted for it) is not 0.
+		m_last_used is the list clock value when the block was last used.
 	*/
-	float m_usage_timer;
+	friend class MapBlockLRU;
+	MapBlock *m_lru_newer;
+	MapBlock *m_lru_older;
+	u32 m_lru_memory;
+	double m_last_used;
 
 	/*
 		Reference count; currently used for determining if this block is in
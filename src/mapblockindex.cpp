@@ -0,0 +1,143 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "mapblockindex.h"
+#include "threading/atomic.h"
+#include <cstddef>
+
+// Packed keys only use the lower 48 bits
+#define EMPTY_KEY ((u64)1 << 63)
+#define MIN_CAPACITY 64
+
+// Shared by all indices, so that generations of different maps never match
+static Atomic<u32> g_generation_counter;
+
+MapBlockIndex::MapBlockIndex():
+	m_mask(0),
+	m_count(0)
+{
+	resize(MIN_CAPACITY);
+	bumpGeneration();
+}
+
+u64 MapBlockIndex::packKey(v3s16 p)
+{
+	return (u64)(u16)p.X
+		| ((u64)(u16)p.Y << 16)
+		| ((u64)(u16)p.Z << 32);
+}
+
+u32 MapBlockIndex::getHomeSlot(u64 key) const
+{
+	// Fibonacci hashing, the upper bits are the best mixed ones
+	return (u32)((key * 0x9E3779B97F4A7C15ULL) >> 32) & m_mask;
+}
+
+void MapBlockIndex::bumpGeneration()
+{
+	m_generation = ++g_generation_counter;
+}
+
+MapBlock *MapBlockIndex::get(v3s16 p) const
+{
+	u64 key = packKey(p);
+	for (u32 i = getHomeSlot(key); ; i = (i + 1) & m_mask) {
+		const Slot &slot = m_slots[i];
+		if (slot.key == key)
+			return slot.block;
+		if (slot.key == EMPTY_KEY)
+			return NULL;
+	}
+}
+
+bool MapBlockIndex::insert(v3s16 p, MapBlock *block)
+{
+	// Keep the load factor at or below 1/2
+	if ((m_count + 1) * 2 > m_slots.size())
+		resize(m_slots.size() * 2);
+
+	u64 key = packKey(p);
+	u32 i = getHomeSlot(key);
+	for (; m_slots[i].key != EMPTY_KEY; i = (i + 1) & m_mask) {
+		if (m_slots[i].key == key)
+			return false;
+	}
+
+	m_slots[i].key = key;
+	m_slots[i].block = block;
+	m_count++;
+	return true;
+}
+
+bool MapBlockIndex::remove(v3s16 p)
+{
+	u64 key = packKey(p);
+	u32 i = getHomeSlot(key);
+	for (; m_slots[i].key != key; i = (i + 1) & m_mask) {
+		if (m_slots[i].key == EMPTY_KEY)
+			return false;
+	}
+
+	// Move back the following entries of the cluster that may not be
+	// placed before the hole, so that no lookup stops early at it
+	for (u32 j = (i + 1) & m_mask; m_slots[j].key != EMPTY_KEY;
+			j = (j + 1) & m_mask) {
+		u32 home = getHomeSlot(m_slots[j].key);
+		// Distance from home to the hole and to the entry
+		if (((i - home) & m_mask) < ((j - home) & m_mask)) {
+			m_slots[i] = m_slots[j];
+			i = j;
+		}
+	}
+
+	m_slots[i].key = EMPTY_KEY;
+	m_slots[i].block = NULL;
+	m_count--;
+	bumpGeneration();
+	return true;
+}
+
+void MapBlockIndex::clear()
+{
+	m_slots.clear();
+	m_count = 0;
+	resize(MIN_CAPACITY);
+	bumpGeneration();
+}
+
+void MapBlockIndex::resize(u32 capacity)
+{
+	std::vector<Slot> old_slots;
+	old_slots.swap(m_slots);
+
+	Slot empty = { EMPTY_KEY, NULL };
+	m_slots.resize(capacity, empty);
+	m_mask = capacity - 1;
+
+	for (size_t i = 0; i < old_slots.size(); i++) {
+		const Slot &slot = old_slots[i];
+		if (slot.key == EMPTY_KEY)
+			continue;
+		u32 j = getHomeSlot(slot.key);
+		while (m_slots[j].key != EMPTY_KEY)
+			j = (j + 1) & m_mask;
+		m_slots[j] = slot;
+	}
+}
@@ -0,0 +1,79 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef MAPBLOCKINDEX_HEADER
+#define MAPBLOCKINDEX_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include <vector>
+
+class MapBlock;
+
+/*
+	Hash table from block positions to the loaded MapBlocks of a Map.
+
+	Open addressing with linear probing over a flat array, so that a lookup
+	usually touches a single cache line. Removal shifts the following
+	entries back instead of leaving tombstones.
+
+	The index does not own the blocks.
+*/
+
+class MapBlockIndex
+{
+public:
+	MapBlockIndex();
+
+	MapBlock *get(v3s16 p) const;
+	// Returns false if a block is already stored at p
+	bool insert(v3s16 p, MapBlock *block);
+	// Returns false if no block is stored at p
+	bool remove(v3s16 p);
+	void clear();
+
+	u32 size() const
+	{ return m_count; }
+
+	/*
+		Changes every time a block is removed from any index. A block pointer
+		obtained from an index is valid as long as the generation of that
+		index stays the same.
+	*/
+	u32 getGeneration() const
+	{ return m_generation; }
+
+private:
+	struct Slot {
+		u64 key;
+		MapBlock *block;
+	};
+
+	static u64 packKey(v3s16 p);
+	u32 getHomeSlot(u64 key) const;
+	void resize(u32 capacity);
+	void bumpGeneration();
+
+	std::vector<Slot> m_slots;
+	u32 m_mask;
+	u32 m_count;
+	u32 m_generation;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "mapblocklru.h"
+#include "mapblock.h"
+#include "debug.h"
+
+MapBlockLRU::MapBlockLRU():
+	m_front(NULL),
+	m_back(NULL),
+	m_count(0),
+	m_memory(0),
+	m_time(0)
+{
+}
+
+void MapBlockLRU::insert(MapBlock *block)
+{
+	sanity_check(!contains(block));
+
+	block->m_lru_memory = block->getMemoryUsage();
+	m_memory += block->m_lru_memory;
+	m_count++;
+	block->m_last_used = m_time;
+	link(block);
+}
+
+void MapBlockLRU::remove(MapBlock *block)
+{
+	if (!contains(block))
+		return;
+
+	unlink(block);
+	m_count--;
+	m_memory -= block->m_lru_memory;
+	block->m_lru_memory = 0;
+}
+
+void MapBlockLRU::touch(MapBlock *block)
+{
+	// Blocks that are not in the map yet get touched too
+	if (!contains(block))
+		return;
+
+	block->m_last_used = m_time;
+	if (block == m_front)
+		return;
+
+	unlink(block);
+	link(block);
+}
+
+void MapBlockLRU::updateMemoryUsage(MapBlock *block)
+{
+	u32 memory = block->getMemoryUsage();
+	m_memory = m_memory - block->m_lru_memory + memory;
+	block->m_lru_memory = memory;
+}
+
+float MapBlockLRU::getUnusedTime(const MapBlock *block) const
+{
+	return m_time - block->m_last_used;
+}
+
+MapBlock *MapBlockLRU::getNewer(const MapBlock *block)
+{
+	return block->m_lru_newer;
+}
+
+bool MapBlockLRU::contains(const MapBlock *block)
+{
+	// Listed blocks are never accounted with zero bytes
+	return block->m_lru_memory != 0;
+}
+
+void MapBlockLRU::link(MapBlock *block)
+{
+	block->m_lru_newer = NULL;
+	block->m_lru_older = m_front;
+	if (m_front)
+		m_front->m_lru_newer = block;
+	else
+		m_back = block;
+	m_front = block;
+}
+
+void MapBlockLRU::unlink(MapBlock *block)
+{
+	if (block->m_lru_newer)
+		block->m_lru_newer->m_lru_older = block->m_lru_older;
+	else
+		m_front = block->m_lru_older;
+
+	if (block->m_lru_older)
+		block->m_lru_older->m_lru_newer = block->m_lru_newer;
+	else
+		m_back = block->m_lru_newer;
+
+	block->m_lru_newer = NULL;
+	block->m_lru_older = NULL;
+}
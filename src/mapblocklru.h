@@ -0,0 +1,86 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef MAPBLOCKLRU_HEADER
+#define MAPBLOCKLRU_HEADER
+
+#include "irrlichttypes_bloated.h"
+
+class MapBlock;
+
+/*
+	Intrusive list of the loaded MapBlocks of a Map, from the most recently
+	used block (front) to the least recently used one (back).
+
+	The links, the time of last use and the memory accounted for a block
+	are stored in the block itself, so touching a block costs O(1) and no
+	allocation. The list keeps the sum of the memory used by its blocks,
+	which lets the Map evict from the back until it fits a memory budget
+	without visiting every block.
+
+	The list does not own the blocks.
+*/
+
+class MapBlockLRU
+{
+public:
+	MapBlockLRU();
+
+	// Adds the block at the front. It must not be in any list yet.
+	void insert(MapBlock *block);
+	void remove(MapBlock *block);
+	// Marks the block as used now, moving it to the front
+	void touch(MapBlock *block);
+	// Re-reads the memory usage of a listed block
+	void updateMemoryUsage(MapBlock *block);
+
+	// Advances the clock that the times of last use are taken from
+	void step(float dtime)
+	{ m_time += dtime; }
+
+	// Seconds since the block was last touched (or inserted)
+	float getUnusedTime(const MapBlock *block) const;
+
+	MapBlock *getLeastRecentlyUsed() const
+	{ return m_back; }
+	// The next more recently used block, NULL at the front
+	static MapBlock *getNewer(const MapBlock *block);
+	static bool contains(const MapBlock *block);
+
+	u32 size() const
+	{ return m_count; }
+
+	// Sum of MapBlock::getMemoryUsage() over all blocks
+	u64 getMemoryUsage() const
+	{ return m_memory; }
+
+private:
+	void link(MapBlock *block);
+	void unlink(MapBlock *block);
+
+	MapBlock *m_front;
+	MapBlock *m_back;
+	u32 m_count;
+	u64 m_memory;
+	// Seconds, double so that it stays precise on long-running servers
+	double m_time;
+};
+
+#endif
@@ -0,0 +1,328 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "mapmigrator.h"
+#include "database.h"
+#include "exceptions.h"
+#include "filesys.h"
+#include "settings.h"
+#include "threading/thread.h"
+#include "threading/mutex_auto_lock.h"
+#include "log.h"
+#include "porting.h"
+#include <algorithm>
+#include <sstream>
+
+// Blocks loaded and saved at once
+#define BATCH_SIZE 256
+// Loaded batches that may wait for being written, per read thread
+#define BATCHES_PER_THREAD 4
+// Time between transactions and checkpoints
+#define COMMIT_INTERVAL_MS 1000
+
+/*
+	MapMigrateThread
+*/
+
+class MapMigrateThread : public Thread
+{
+public:
+	MapMigrateThread(MapMigrator *migrator) :
+		Thread("MapMigrate"),
+		m_migrator(migrator)
+	{}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		// Keep running once all batches are loaded, until stopped
+		while (!stopRequested()) {
+			m_migrator->m_free_slots.wait();
+			if (!stopRequested())
+				m_migrator->loadNextBatch();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	MapMigrator *m_migrator;
+};
+
+/*
+	MapMigrator
+*/
+
+static bool block_position_less(const v3s16 &a, const v3s16 &b)
+{
+	return Database::getBlockAsInteger(a) < Database::getBlockAsInteger(b);
+}
+
+MapMigrator::MapMigrator(Database *src, Database *dst,
+		const std::string &checkpoint_path, u32 num_threads) :
+	m_src(src),
+	m_dst(dst),
+	m_checkpoint_path(checkpoint_path),
+	m_num_threads(src->supportsConcurrentLoads() ? MYMAX(num_threads, 1) : 1),
+	m_committed(0),
+	m_next_batch(0),
+	m_free_slots(m_num_threads * BATCHES_PER_THREAD),
+	m_total_blocks(0),
+	m_copied_blocks(0),
+	m_resumed_blocks(0),
+	m_failed_blocks(0),
+	m_failed_saves(0),
+	m_copied_bytes(0)
+{
+}
+
+MapMigrator::~MapMigrator()
+{
+	for (std::map<size_t, Batch *>::iterator it = m_loaded.begin();
+			it != m_loaded.end(); ++it)
+		delete it->second;
+}
+
+bool MapMigrator::run(bool *kill, std::ostream *progress_stream)
+{
+	m_src->listAllLoadableBlocks(m_positions);
+	std::sort(m_positions.begin(), m_positions.end(), block_position_less);
+	m_positions.erase(std::unique(m_positions.begin(), m_positions.end()),
+		m_positions.end());
+	m_total_blocks = m_positions.size();
+	readCheckpoint();
+
+	size_t num_batches = (m_positions.size() + BATCH_SIZE - 1) / BATCH_SIZE;
+
+	std::vector<MapMigrateThread *> threads;
+	for (u32 i = 0; i < m_num_threads && i < num_batches; i++) {
+		MapMigrateThread *thread = new MapMigrateThread(this);
+		if (!thread->start()) {
+			delete thread;
+			break;
+		}
+		threads.push_back(thread);
+	}
+	if (num_batches > 0 && threads.empty()) {
+		errorstream << "MapMigrator: Failed to start any read thread"
+			<< std::endl;
+		return false;
+	}
+
+	u32 start_ms = porting::getTimeMs();
+	u32 last_commit_ms = start_ms;
+	bool interrupted = false;
+	// Next batch to write
+	size_t next = 0;
+	// Blocks written since the last commit
+	u32 uncommitted_blocks = 0;
+	bool committed = true;
+
+	m_dst->beginSave();
+	while (next < num_batches) {
+		if (kill && *kill) {
+			interrupted = true;
+			break;
+		}
+
+		// Batches are written in order, so that the checkpoint is exact
+		Batch *batch = NULL;
+		{
+			MutexAutoLock lock(m_queue_mutex);
+			std::map<size_t, Batch *>::iterator it = m_loaded.find(next);
+			if (it != m_loaded.end()) {
+				batch = it->second;
+				m_loaded.erase(it);
+			}
+		}
+		if (!batch) {
+			m_loaded_sem.wait(100);
+			continue;
+		}
+		m_free_slots.post();
+
+		std::vector<v3s16> positions;
+		std::vector<std::string> blocks;
+		positions.reserve(batch->positions.size());
+		blocks.reserve(batch->positions.size());
+		for (size_t i = 0; i < batch->positions.size(); i++) {
+			if (batch->blocks[i].empty()) {
+				errorstream << "Failed to load block "
+					<< PP(batch->positions[i]) << ", skipping it." << std::endl;
+				m_failed_blocks++;
+				continue;
+			}
+			m_copied_bytes += batch->blocks[i].size();
+			positions.push_back(batch->positions[i]);
+			blocks.push_back("");
+			blocks.back().swap(batch->blocks[i]);
+		}
+		delete batch;
+
+		// Stop at the first batch that fails, so that the checkpoint
+		// never passes it
+		if (!positions.empty() && !m_dst->saveBlocks(positions, blocks)) {
+			errorstream << "Failed to save some of the blocks "
+				<< PP(positions.front()) << " to " << PP(positions.back())
+				<< ", stopping the migration." << std::endl;
+			m_failed_saves += positions.size();
+			break;
+		}
+		uncommitted_blocks += positions.size();
+		next++;
+
+		u32 now_ms = porting::getTimeMs();
+		if (now_ms - last_commit_ms >= COMMIT_INTERVAL_MS) {
+			committed = commit(next, &uncommitted_blocks);
+			if (!committed)
+				break;
+			writeCheckpoint();
+			printProgress(progress_stream, start_ms, false);
+			m_dst->beginSave();
+			last_commit_ms = now_ms;
+		}
+	}
+	// The batches before a failed one are committed as well
+	if (committed)
+		committed = commit(next, &uncommitted_blocks);
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i]->stop();
+	m_free_slots.post(threads.size());
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i]->wait();
+		delete threads[i];
+	}
+
+	if (interrupted || !committed || m_failed_saves > 0) {
+		writeCheckpoint();
+		printProgress(progress_stream, start_ms, true);
+		return false;
+	}
+
+	printProgress(progress_stream, start_ms, true);
+	if (fs::PathExists(m_checkpoint_path) &&
+			!fs::DeleteSingleFileOrEmptyDirectory(m_checkpoint_path)) {
+		errorstream << "MapMigrator: Failed to remove checkpoint "
+			<< m_checkpoint_path << std::endl;
+	}
+	return true;
+}
+
+bool MapMigrator::commit(size_t next, u32 *uncommitted_blocks)
+{
+	try {
+		m_dst->endSave();
+	} catch (DatabaseException &e) {
+		errorstream << "MapMigrator: " << e.what()
+			<< ", stopping the migration." << std::endl;
+		m_failed_saves += *uncommitted_blocks;
+		*uncommitted_blocks = 0;
+		return false;
+	}
+	m_copied_blocks += *uncommitted_blocks;
+	*uncommitted_blocks = 0;
+	m_committed = MYMIN(next * BATCH_SIZE, m_positions.size());
+	return true;
+}
+
+bool MapMigrator::loadNextBatch()
+{
+	size_t index;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		index = m_next_batch++;
+	}
+
+	size_t begin = index * BATCH_SIZE;
+	if (begin >= m_positions.size())
+		return false;
+	size_t end = MYMIN(begin + BATCH_SIZE, m_positions.size());
+
+	Batch *batch = new Batch;
+	batch->positions.assign(m_positions.begin() + begin,
+		m_positions.begin() + end);
+	if (m_src->supportsConcurrentLoads()) {
+		m_src->loadBlocks(batch->positions, &batch->blocks);
+	} else {
+		MutexAutoLock lock(m_src_mutex);
+		m_src->loadBlocks(batch->positions, &batch->blocks);
+	}
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_loaded[index] = batch;
+	}
+	m_loaded_sem.post();
+	return true;
+}
+
+void MapMigrator::readCheckpoint()
+{
+	Settings checkpoint;
+	if (!fs::PathExists(m_checkpoint_path) ||
+			!checkpoint.readConfigFile(m_checkpoint_path.c_str()))
+		return;
+
+	// Keys are signed, they are stored as their two's complement
+	s64 last_key = (s64)checkpoint.getU64("last_block");
+	std::vector<v3s16>::iterator it = m_positions.begin();
+	while (it != m_positions.end() && Database::getBlockAsInteger(*it) <= last_key)
+		++it;
+	m_resumed_blocks = it - m_positions.begin();
+	m_positions.erase(m_positions.begin(), it);
+
+	actionstream << "Resuming migration, " << m_resumed_blocks
+		<< " blocks were already copied" << std::endl;
+}
+
+void MapMigrator::writeCheckpoint()
+{
+	if (m_committed == 0)
+		return;
+
+	std::ostringstream os;
+	os << "last_block = "
+		<< (u64)Database::getBlockAsInteger(m_positions[m_committed - 1])
+		<< std::endl;
+	if (!fs::safeWriteToFile(m_checkpoint_path, os.str())) {
+		errorstream << "MapMigrator: Failed to write checkpoint "
+			<< m_checkpoint_path << std::endl;
+	}
+}
+
+void MapMigrator::printProgress(std::ostream *os, u32 start_ms, bool done)
+{
+	if (!os)
+		return;
+
+	u32 done_blocks = m_resumed_blocks + m_committed;
+	float seconds = MYMAX(porting::getTimeMs() - start_ms, 1) / 1000.0f;
+	*os << " Migrated " << done_blocks << " of " << m_total_blocks
+		<< " blocks, "
+		<< (100.0 * done_blocks / MYMAX(m_total_blocks, 1)) << "% completed, "
+		<< (u32)(m_copied_blocks / seconds) << " blocks/s, "
+		<< (m_copied_bytes / seconds / (1024 * 1024)) << " MiB/s."
+		<< (done ? "\n" : "\r") << std::flush;
+}
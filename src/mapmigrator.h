@@ -0,0 +1,124 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef MAPMIGRATOR_HEADER
+#define MAPMIGRATOR_HEADER
+
+#include "irr_v3d.h"
+#include "irrlichttypes.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+class Database;
+class MapMigrateThread;
+
+/*
+	Copies every block of one map database to another (--migrate).
+
+	The blocks are copied in the order of their positions, in batches.
+	Read threads load the batches from the source database, while the
+	calling thread writes them to the destination in order, committing a
+	transaction about every second.
+
+	After every commit the last written position is stored in the
+	checkpoint file. A migration that was interrupted continues after it
+	when run again with the same checkpoint file, which is removed once
+	the migration is complete.
+*/
+class MapMigrator
+{
+public:
+	// The source is only read from several threads at once if it
+	// supports concurrent loads, otherwise by a single thread
+	MapMigrator(Database *src, Database *dst,
+		const std::string &checkpoint_path, u32 num_threads);
+	~MapMigrator();
+
+	// Returns true once every block has been copied, false if *kill was
+	// set in between or if saving to the destination failed. Prints the
+	// progress to progress_stream if not NULL.
+	bool run(bool *kill, std::ostream *progress_stream);
+
+	u32 getCopiedBlocks() const { return m_copied_blocks; }
+	// Blocks that were already copied in an earlier run
+	u32 getResumedBlocks() const { return m_resumed_blocks; }
+	u32 getFailedBlocks() const { return m_failed_blocks; }
+	// Blocks that could not be saved to the destination
+	u32 getFailedSaves() const { return m_failed_saves; }
+	u64 getCopiedBytes() const { return m_copied_bytes; }
+
+private:
+	friend class MapMigrateThread;
+
+	struct Batch
+	{
+		std::vector<v3s16> positions;
+		std::vector<std::string> blocks;
+	};
+
+	// Commits the blocks written before batch next, returns false if the
+	// commit failed
+	bool commit(size_t next, u32 *uncommitted_blocks);
+
+	// Loads the next batch, returns false if there is none left
+	bool loadNextBatch();
+
+	void readCheckpoint();
+	void writeCheckpoint();
+
+	void printProgress(std::ostream *os, u32 start_ms, bool done);
+
+	Database *m_src;
+	Database *m_dst;
+	std::string m_checkpoint_path;
+	u32 m_num_threads;
+
+	// Sorted positions of the blocks left to copy
+	std::vector<v3s16> m_positions;
+	// Positions from m_positions that have been committed
+	size_t m_committed;
+
+	// Used by the read threads if the source doesn't support concurrent
+	// loads
+	Mutex m_src_mutex;
+
+	Mutex m_queue_mutex;
+	// Index of the next batch to load
+	size_t m_next_batch;
+	// Loaded batches, by index
+	std::map<size_t, Batch *> m_loaded;
+	// Limits the number of batches in memory
+	Semaphore m_free_slots;
+	// Posted for every loaded batch
+	Semaphore m_loaded_sem;
+
+	u32 m_total_blocks;
+	u32 m_copied_blocks;
+	u32 m_resumed_blocks;
+	u32 m_failed_blocks;
+	u32 m_failed_saves;
+	u64 m_copied_bytes;
+};
+
+#endif
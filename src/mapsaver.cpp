@@ -0,0 +1,277 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "mapsaver.h"
+#include "database.h"
+#include "serialization.h"
+#include "threading/thread.h"
+#include "threading/mutex_auto_lock.h"
+#include "log.h"
+#include "porting.h"
+#include <sstream>
+
+/*
+	MapSaveThread
+*/
+
+class MapSaveThread : public Thread
+{
+public:
+	MapSaveThread(MapSaver *saver) :
+		Thread("MapSave"),
+		m_saver(saver)
+	{}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			m_saver->m_serialize_sem.wait();
+			m_saver->serializeNextJob();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	MapSaver *m_saver;
+};
+
+/*
+	MapWriteThread
+*/
+
+class MapWriteThread : public Thread
+{
+public:
+	MapWriteThread(MapSaver *saver) :
+		Thread("MapWrite"),
+		m_saver(saver)
+	{}
+
+	void *run()
+	{
+		DSTACK(FUNCTION_NAME);
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			m_saver->m_write_sem.wait();
+			m_saver->writeReadyJobs();
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return NULL;
+	}
+
+private:
+	MapSaver *m_saver;
+};
+
+/*
+	MapSaver
+*/
+
+MapSaver::MapSaver(Database *db, Mutex &db_mutex, u32 num_threads,
+		u32 max_pending) :
+	m_db(db),
+	m_db_mutex(db_mutex),
+	m_free_slots(max_pending)
+{
+	for (u32 i = 0; i < num_threads; i++) {
+		MapSaveThread *thread = new MapSaveThread(this);
+		if (!thread->start()) {
+			errorstream << "MapSaver: Failed to start save thread"
+				<< std::endl;
+			delete thread;
+			break;
+		}
+		m_save_threads.push_back(thread);
+	}
+
+	m_write_thread = new MapWriteThread(this);
+	if (!m_write_thread->start())
+		FATAL_ERROR("MapSaver: Failed to start write thread");
+
+	// Without save threads, nothing would ever be written
+	if (m_save_threads.empty())
+		FATAL_ERROR("MapSaver: Failed to start any save thread");
+}
+
+MapSaver::~MapSaver()
+{
+	flush();
+
+	for (size_t i = 0; i < m_save_threads.size(); i++)
+		m_save_threads[i]->stop();
+	m_serialize_sem.post(m_save_threads.size());
+	for (size_t i = 0; i < m_save_threads.size(); i++) {
+		m_save_threads[i]->wait();
+		delete m_save_threads[i];
+	}
+
+	m_write_thread->stop();
+	m_write_sem.post();
+	m_write_thread->wait();
+	delete m_write_thread;
+}
+
+void MapSaver::queueBlock(MapBlock *block, u8 compression)
+{
+	// Backpressure: don't let the queue outgrow the save threads
+	m_free_slots.wait();
+
+	Job *job = new Job;
+	block->takeSnapshot(&job->snapshot,
+		ser_ver_for_map_compression(compression), compression);
+	job->serialized = false;
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_jobs.push_back(job);
+		m_serialize_queue.push_back(job);
+		m_pending_blocks[job->snapshot.pos]++;
+	}
+	m_serialize_sem.post();
+}
+
+bool MapSaver::serializeNextJob()
+{
+	Job *job;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		if (m_serialize_queue.empty())
+			return false;
+		job = m_serialize_queue.front();
+		m_serialize_queue.pop_front();
+	}
+
+	/*
+		[0] u8 serialization version
+		[1] data
+	*/
+	std::ostringstream o(std::ios_base::binary);
+	o.write((char *)&job->snapshot.version, 1);
+	MapBlock::serializeSnapshot(o, job->snapshot);
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		job->data = o.str();
+		job->serialized = true;
+		// Release the node copy early, the block may wait for older ones
+		std::vector<MapNode>().swap(job->snapshot.nodes);
+	}
+	m_write_sem.post();
+	return true;
+}
+
+bool MapSaver::writeReadyJobs()
+{
+	// Jobs are written in queue order, so that an older version of a
+	// block never overwrites a newer one
+	std::vector<Job *> batch;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		while (!m_jobs.empty() && m_jobs.front()->serialized) {
+			batch.push_back(m_jobs.front());
+			m_jobs.pop_front();
+		}
+	}
+	if (batch.empty())
+		return false;
+
+	std::vector<v3s16> positions(batch.size());
+	std::vector<std::string> blocks(batch.size());
+	for (size_t i = 0; i < batch.size(); i++) {
+		positions[i] = batch[i]->snapshot.pos;
+		blocks[i].swap(batch[i]->data);
+	}
+
+	bool success;
+	{
+		MutexAutoLock lock(m_db_mutex);
+		try {
+			m_db->beginSave();
+			success = m_db->saveBlocks(positions, blocks);
+			m_db->endSave();
+		} catch (DatabaseException &e) {
+			errorstream << "MapSaver: " << e.what() << std::endl;
+			success = false;
+		}
+	}
+	if (!success) {
+		errorstream << "MapSaver: Failed to save some of "
+			<< batch.size() << " blocks" << std::endl;
+	}
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		// The database doesn't tell which blocks failed
+		if (!success) {
+			m_failed_blocks.insert(m_failed_blocks.end(),
+				positions.begin(), positions.end());
+		}
+		for (size_t i = 0; i < batch.size(); i++) {
+			std::map<v3s16, u32>::iterator it =
+				m_pending_blocks.find(batch[i]->snapshot.pos);
+			if (--it->second == 0)
+				m_pending_blocks.erase(it);
+			delete batch[i];
+		}
+	}
+	m_free_slots.post(batch.size());
+	return true;
+}
+
+void MapSaver::flush()
+{
+	// Waiting is rare (shutdown and listing all blocks), polling is enough
+	for (;;) {
+		{
+			MutexAutoLock lock(m_queue_mutex);
+			if (m_pending_blocks.empty())
+				return;
+		}
+		sleep_ms(1);
+	}
+}
+
+void MapSaver::waitForBlock(v3s16 pos)
+{
+	for (;;) {
+		{
+			MutexAutoLock lock(m_queue_mutex);
+			if (m_pending_blocks.find(pos) == m_pending_blocks.end())
+				return;
+		}
+		sleep_ms(1);
+	}
+}
+
+void MapSaver::takeFailedBlocks(std::vector<v3s16> &dst)
+{
+	MutexAutoLock lock(m_queue_mutex);
+	dst.insert(dst.end(), m_failed_blocks.begin(), m_failed_blocks.end());
+	m_failed_blocks.clear();
+}
@@ -0,0 +1,117 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef MAPSAVER_HEADER
+#define MAPSAVER_HEADER
+
+#include "irr_v3d.h"
+#include "mapblock.h"
+#include "threading/mutex.h"
+#include "threading/semaphore.h"
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+class Database;
+class MapSaveThread;
+class MapWriteThread;
+
+/*
+	Saves MapBlocks in the background.
+
+	queueBlock() only takes a snapshot of the block in the calling thread.
+	The snapshots are serialized and compressed by a pool of save threads,
+	then a single write thread stores them in the database, in the order
+	they were queued, grouped in beginSave()/endSave() transactions.
+
+	The write thread only holds db_mutex while it uses the database, every
+	other user of the database has to do the same.
+
+	A block counts as saved once it is queued. If writing it fails, its
+	position is reported by takeFailedBlocks().
+*/
+class MapSaver
+{
+public:
+	// Up to max_pending blocks can wait for being written,
+	// queueBlock() waits for one of them to be written beyond that.
+	MapSaver(Database *db, Mutex &db_mutex, u32 num_threads, u32 max_pending);
+	// Writes every queued block before returning
+	~MapSaver();
+
+	u32 getThreadCount() const { return m_save_threads.size(); }
+
+	// compression is the MapCompression codec to save the block with
+	void queueBlock(MapBlock *block, u8 compression = MAP_COMPRESSION_ZLIB);
+
+	// Returns once every block queued so far has been written
+	void flush();
+	// Returns once the block at pos has no queued version left, so that
+	// the database holds the last one
+	void waitForBlock(v3s16 pos);
+
+	// Moves the positions of the blocks that failed to be written since
+	// the last call to dst. The blocks have to be saved again.
+	void takeFailedBlocks(std::vector<v3s16> &dst);
+
+private:
+	friend class MapSaveThread;
+	friend class MapWriteThread;
+
+	struct Job
+	{
+		MapBlockSnapshot snapshot;
+		// Serialized block, including the version byte
+		std::string data;
+		bool serialized;
+	};
+
+	// Serializes the next job, returns false if there is none left
+	bool serializeNextJob();
+	// Writes the serialized jobs at the front of m_jobs,
+	// returns false if there was none
+	bool writeReadyJobs();
+
+	Database *m_db;
+	Mutex &m_db_mutex;
+
+	std::vector<MapSaveThread *> m_save_threads;
+	MapWriteThread *m_write_thread;
+
+	Mutex m_queue_mutex;
+	// Jobs that haven't been handed to the write thread, in queue order
+	std::deque<Job *> m_jobs;
+	// Jobs that haven't been serialized
+	std::deque<Job *> m_serialize_queue;
+	// Number of unwritten jobs of each block position
+	std::map<v3s16, u32> m_pending_blocks;
+	// Positions of the jobs whose write failed
+	std::vector<v3s16> m_failed_blocks;
+
+	// Places left below max_pending
+	Semaphore m_free_slots;
+	// Posted for every queued job
+	Semaphore m_serialize_sem;
+	// Posted for every serialized job
+	Semaphore m_write_sem;
+};
+
+#endif
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "exceptions.h"
 #include "mapblock.h"
 #include "serialization.h"
+#include "map.h"
 
 MapSector::MapSector(Map *parent, v2s16 pos, IGameDef *gamedef):
 		differs_from_disk(false),
@@ -44,6 +45,8 @@ void MapSector::deleteBlocks()
 	// Delete all
 	for (UNORDERED_MAP<s16, MapBlock*>::iterator i = m_blocks.begin();
 		 	i != m_blocks.end(); ++i) {
+		if (m_parent)
+			m_parent->unindexBlock(i->second);
 		delete i->second;
 	}
 
@@ -91,6 +94,8 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 
 	m_blocks[y] = block;
+	if (m_parent)
+		m_parent->indexBlock(block);
 
 	return block;
 }
@@ -109,6 +114,8 @@ void MapSector::insertBlock(MapBlock *block)
 
 	// Insert into container
 	m_blocks[block_y] = block;
+	if (m_parent)
+		m_parent->indexBlock(block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
@@ -120,6 +127,8 @@ void MapSector::deleteBlock(MapBlock *block)
 
 	// Remove from container
 	m_blocks.erase(block_y);
+	if (m_parent)
+		m_parent->unindexBlock(block);
 
 	// Delete
 	delete block;
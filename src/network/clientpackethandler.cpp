@@ -439,6 +439,7 @@ void Client::handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt)
 		for (u16 i = 0; i < removed_count; i++) {
 			*pkt >> id;
 			m_env.removeActiveObject(id);
+			m_object_positions.forget(id);
 		}
 
 		// Read added objects
@@ -484,6 +485,27 @@ void Client::handleCommand_ActiveObjectMessages(NetworkPacket* pkt)
 	}
 }
 
+void Client::handleCommand_ActiveObjectPositions(NetworkPacket* pkt)
+{
+	std::string datastring(pkt->getString(0), pkt->getSize());
+	std::istringstream is(datastring, std::ios_base::binary);
+
+	try {
+		while (is.peek() != EOF) {
+			u16 id;
+			ObjectPosition pos;
+			if (!m_object_positions.decode(is, id, pos))
+				continue;
+
+			// Pass on to the environment as a regular position update
+			m_env.processActiveObjectMessage(id, pos.toMessage());
+		}
+	} catch (SerializationError &e) {
+		errorstream << "Client::handleCommand_ActiveObjectPositions: "
+			<< "caught SerializationError: " << e.what() << std::endl;
+	}
+}
+
 void Client::handleCommand_Movement(NetworkPacket* pkt)
 {
 	LocalPlayer *player = m_env.getLocalPlayer();
@@ -138,9 +138,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		Add nodedef v3 - connected nodeboxes
 	PROTOCOL_VERSION 28:
 		CPT2_MESHOPTIONS
+	PROTOCOL_VERSION 29:
+		Add TOCLIENT_ACTIVE_OBJECT_POSITIONS, replacing the
+			GENERIC_CMD_UPDATE_POSITION active object messages
 */
 
-#define LATEST_PROTOCOL_VERSION 28
+#define LATEST_PROTOCOL_VERSION 29
 
 // Server's supported network protocol range
 #define SERVER_PROTOCOL_VERSION_MIN 13
@@ -595,6 +598,35 @@ enum ToClientCommand
 		u32 id
 	*/
 
+	TOCLIENT_ACTIVE_OBJECT_POSITIONS = 0x54,
+	/*
+		Quantized GENERIC_CMD_UPDATE_POSITION messages, positions in 1/100
+		nodes. Keyframes are sent on the reliable channel, the other updates
+		on the unreliable one, relative to the keyframe of the same sequence
+		number. Updates relative to an unknown keyframe are ignored.
+
+		for all updates
+		{
+			u16 id
+			u8 flags (keyframe, do_interpolate, is_movement_end, then
+				whether each of the optional fields below is present)
+			u8 keyframe sequence number
+			if keyframe {
+				v3s32 position
+				v3s16 velocity
+				v3s16 acceleration
+				u16 yaw (1/65536 turns)
+				u16 update_interval (ms)
+			} else {
+				[v3s16 position - keyframe position]
+				[v3s16 velocity]
+				[v3s16 acceleration]
+				[u16 yaw]
+				[u16 update_interval]
+			}
+		}
+	*/
+
 	TOCLIENT_SRP_BYTES_S_B = 0x60,
 	/*
 		Belonging to AUTH_MECHANISM_LEGACY_PASSWORD and AUTH_MECHANISM_SRP.
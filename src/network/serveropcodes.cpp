@@ -197,7 +197,7 @@ const ClientCommandFactory clientCommandFactoryTable[TOCLIENT_NUM_MSG_TYPES] =
 	{ "TOCLIENT_LOCAL_PLAYER_ANIMATIONS",  0, true }, // 0x51
 	{ "TOCLIENT_EYE_OFFSET",               0, true }, // 0x52
 	{ "TOCLIENT_DELETE_PARTICLESPAWNER",   0, true }, // 0x53
-	null_command_factory,
+	{ "TOCLIENT_ACTIVE_OBJECT_POSITIONS",  0, true }, // 0x54 Special packet, sent by 0 (rel) and 1 (unrel) channel
 	null_command_factory,
 	null_command_factory,
 	null_command_factory,
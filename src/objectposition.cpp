@@ -0,0 +1,278 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "objectposition.h"
+#include "genericobject.h"
+#include "constants.h"
+#include "exceptions.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <cmath>
+
+// Flags of an update in TOCLIENT_ACTIVE_OBJECT_POSITIONS
+#define OBJPOS_KEYFRAME        0x01
+#define OBJPOS_DO_INTERPOLATE  0x02
+#define OBJPOS_MOVEMENT_END    0x04
+#define OBJPOS_POSITION        0x08
+#define OBJPOS_VELOCITY        0x10
+#define OBJPOS_ACCELERATION    0x20
+#define OBJPOS_YAW             0x40
+#define OBJPOS_UPDATE_INTERVAL 0x80
+
+// Units per node of the quantized positions, velocities and accelerations
+#define OBJPOS_UNITS_PER_NODE 100.0f
+
+// Size of a GENERIC_CMD_UPDATE_POSITION message
+#define UPDATE_POSITION_SIZE (1 + 3 * 12 + 4 + 1 + 1 + 4)
+
+static s32 quantize(f32 v)
+{
+	return (s32)floor(v * OBJPOS_UNITS_PER_NODE / BS + 0.5f);
+}
+
+static s16 quantize_clamped(f32 v)
+{
+	s32 q = quantize(v);
+	return rangelim(q, -32767, 32767);
+}
+
+static f32 dequantize(s32 v)
+{
+	return v * BS / OBJPOS_UNITS_PER_NODE;
+}
+
+static bool fits_s16(s32 v)
+{
+	return v >= -32767 && v <= 32767;
+}
+
+/*
+	ObjectPosition
+*/
+
+ObjectPosition::ObjectPosition() :
+	yaw(0),
+	do_interpolate(false),
+	is_movement_end(false),
+	update_interval(0)
+{}
+
+bool ObjectPosition::parse(const std::string &datastring)
+{
+	if (datastring.size() != UPDATE_POSITION_SIZE ||
+			datastring[0] != GENERIC_CMD_UPDATE_POSITION)
+		return false;
+
+	const u8 *data = (const u8 *)datastring.c_str() + 1;
+	v3f p = readV3F1000(data);
+	v3f v = readV3F1000(data + 12);
+	v3f a = readV3F1000(data + 24);
+	position = v3s32(quantize(p.X), quantize(p.Y), quantize(p.Z));
+	velocity = v3s16(quantize_clamped(v.X), quantize_clamped(v.Y),
+			quantize_clamped(v.Z));
+	acceleration = v3s16(quantize_clamped(a.X), quantize_clamped(a.Y),
+			quantize_clamped(a.Z));
+
+	f32 degrees = fmod(readF1000(data + 36), 360.0f);
+	if (degrees < 0)
+		degrees += 360;
+	yaw = (u16)(s32)floor(degrees / 360 * 65536 + 0.5f);
+
+	do_interpolate = data[40] != 0;
+	is_movement_end = data[41] != 0;
+	s32 interval_ms = floor(readF1000(data + 42) * 1000 + 0.5f);
+	update_interval = rangelim(interval_ms, 0, 65535);
+	return true;
+}
+
+std::string ObjectPosition::toMessage() const
+{
+	return gob_cmd_update_position(
+		v3f(dequantize(position.X), dequantize(position.Y),
+			dequantize(position.Z)),
+		v3f(dequantize(velocity.X), dequantize(velocity.Y),
+			dequantize(velocity.Z)),
+		v3f(dequantize(acceleration.X), dequantize(acceleration.Y),
+			dequantize(acceleration.Z)),
+		yaw * 360.0f / 65536,
+		do_interpolate,
+		is_movement_end,
+		update_interval / 1000.0f
+	);
+}
+
+bool ObjectPosition::operator==(const ObjectPosition &other) const
+{
+	return position == other.position &&
+		velocity == other.velocity &&
+		acceleration == other.acceleration &&
+		yaw == other.yaw &&
+		do_interpolate == other.do_interpolate &&
+		is_movement_end == other.is_movement_end &&
+		update_interval == other.update_interval;
+}
+
+/*
+	ObjectPositionEncoder
+*/
+
+static void append_u8(std::string &s, u8 v)
+{
+	s.push_back((char)v);
+}
+
+static void append_u16(std::string &s, u16 v)
+{
+	char buf[2];
+	writeU16((u8 *)buf, v);
+	s.append(buf, 2);
+}
+
+static void append_v3s16(std::string &s, v3s16 v)
+{
+	char buf[6];
+	writeV3S16((u8 *)buf, v);
+	s.append(buf, 6);
+}
+
+static void append_v3s32(std::string &s, v3s32 v)
+{
+	char buf[12];
+	writeV3S32((u8 *)buf, v);
+	s.append(buf, 12);
+}
+
+void ObjectPositionEncoder::encode(u16 id, const ObjectPosition &pos,
+		bool force_keyframe, std::string &reliable_data,
+		std::string &unreliable_data)
+{
+	u8 flags = 0;
+	if (pos.do_interpolate)
+		flags |= OBJPOS_DO_INTERPOLATE;
+	if (pos.is_movement_end)
+		flags |= OBJPOS_MOVEMENT_END;
+
+	UNORDERED_MAP<u16, Keyframe>::iterator it = m_keyframes.find(id);
+	v3s32 d;
+	bool keyframe = force_keyframe || it == m_keyframes.end();
+	if (!keyframe) {
+		d = pos.position - it->second.pos.position;
+		keyframe = !fits_s16(d.X) || !fits_s16(d.Y) || !fits_s16(d.Z);
+	}
+
+	if (keyframe) {
+		Keyframe key;
+		key.pos = pos;
+		key.seq = it == m_keyframes.end() ? 0 : it->second.seq + 1;
+		m_keyframes[id] = key;
+
+		append_u16(reliable_data, id);
+		append_u8(reliable_data, flags | OBJPOS_KEYFRAME);
+		append_u8(reliable_data, key.seq);
+		append_v3s32(reliable_data, pos.position);
+		append_v3s16(reliable_data, pos.velocity);
+		append_v3s16(reliable_data, pos.acceleration);
+		append_u16(reliable_data, pos.yaw);
+		append_u16(reliable_data, pos.update_interval);
+		return;
+	}
+
+	// Only the fields that differ from the keyframe are sent
+	const ObjectPosition &key = it->second.pos;
+	if (d != v3s32(0, 0, 0))
+		flags |= OBJPOS_POSITION;
+	if (pos.velocity != key.velocity)
+		flags |= OBJPOS_VELOCITY;
+	if (pos.acceleration != key.acceleration)
+		flags |= OBJPOS_ACCELERATION;
+	if (pos.yaw != key.yaw)
+		flags |= OBJPOS_YAW;
+	if (pos.update_interval != key.update_interval)
+		flags |= OBJPOS_UPDATE_INTERVAL;
+
+	append_u16(unreliable_data, id);
+	append_u8(unreliable_data, flags);
+	append_u8(unreliable_data, it->second.seq);
+	if (flags & OBJPOS_POSITION)
+		append_v3s16(unreliable_data, v3s16(d.X, d.Y, d.Z));
+	if (flags & OBJPOS_VELOCITY)
+		append_v3s16(unreliable_data, pos.velocity);
+	if (flags & OBJPOS_ACCELERATION)
+		append_v3s16(unreliable_data, pos.acceleration);
+	if (flags & OBJPOS_YAW)
+		append_u16(unreliable_data, pos.yaw);
+	if (flags & OBJPOS_UPDATE_INTERVAL)
+		append_u16(unreliable_data, pos.update_interval);
+}
+
+/*
+	ObjectPositionDecoder
+*/
+
+bool ObjectPositionDecoder::decode(std::istream &is, u16 &id,
+		ObjectPosition &pos)
+{
+	id = readU16(is);
+	u8 flags = readU8(is);
+	u8 seq = readU8(is);
+
+	if (flags & OBJPOS_KEYFRAME) {
+		pos.position = readV3S32(is);
+		pos.velocity = readV3S16(is);
+		pos.acceleration = readV3S16(is);
+		pos.yaw = readU16(is);
+		pos.update_interval = readU16(is);
+	} else {
+		UNORDERED_MAP<u16, Keyframe>::iterator it = m_keyframes.find(id);
+		if (it != m_keyframes.end())
+			pos = it->second.pos;
+
+		// Always read the fields, the stream has to stay in sync
+		if (flags & OBJPOS_POSITION) {
+			v3s16 d = readV3S16(is);
+			pos.position += v3s32(d.X, d.Y, d.Z);
+		}
+		if (flags & OBJPOS_VELOCITY)
+			pos.velocity = readV3S16(is);
+		if (flags & OBJPOS_ACCELERATION)
+			pos.acceleration = readV3S16(is);
+		if (flags & OBJPOS_YAW)
+			pos.yaw = readU16(is);
+		if (flags & OBJPOS_UPDATE_INTERVAL)
+			pos.update_interval = readU16(is);
+
+		if (is.fail())
+			throw SerializationError("ObjectPositionDecoder: truncated update");
+		if (it == m_keyframes.end() || it->second.seq != seq)
+			return false;
+	}
+	if (is.fail())
+		throw SerializationError("ObjectPositionDecoder: truncated update");
+
+	pos.do_interpolate = (flags & OBJPOS_DO_INTERPOLATE) != 0;
+	pos.is_movement_end = (flags & OBJPOS_MOVEMENT_END) != 0;
+
+	if (flags & OBJPOS_KEYFRAME) {
+		Keyframe key;
+		key.pos = pos;
+		key.seq = seq;
+		m_keyframes[id] = key;
+	}
+	return true;
+}
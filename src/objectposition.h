@@ -0,0 +1,107 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef OBJECTPOSITION_HEADER
+#define OBJECTPOSITION_HEADER
+
+#include "irrlichttypes_bloated.h"
+#include "util/cpp11_container.h"
+#include <string>
+#include <iostream>
+
+/*
+	Quantized content of a GENERIC_CMD_UPDATE_POSITION message, as sent
+	in TOCLIENT_ACTIVE_OBJECT_POSITIONS.
+*/
+struct ObjectPosition
+{
+	// In 1/100 nodes
+	v3s32 position;
+	// In 1/100 nodes per second, clamped
+	v3s16 velocity;
+	v3s16 acceleration;
+	// In 1/65536 of a full turn
+	u16 yaw;
+	bool do_interpolate;
+	bool is_movement_end;
+	// In milliseconds
+	u16 update_interval;
+
+	ObjectPosition();
+
+	// Returns false if datastring isn't a GENERIC_CMD_UPDATE_POSITION
+	bool parse(const std::string &datastring);
+	// Builds the GENERIC_CMD_UPDATE_POSITION message back
+	std::string toMessage() const;
+
+	bool operator==(const ObjectPosition &other) const;
+};
+
+/*
+	Server side of TOCLIENT_ACTIVE_OBJECT_POSITIONS, one per client.
+
+	Every object has a keyframe, which is sent reliably and thus known
+	by the client once it arrives. The other updates are sent unreliably
+	as the difference to the keyframe, so that a lost update doesn't
+	affect the following ones. Updates that can't be expressed relative
+	to the keyframe become the new keyframe.
+*/
+class ObjectPositionEncoder
+{
+public:
+	// Appends the update of object id to reliable_data or unreliable_data.
+	// force_keyframe is set for updates that must not get lost.
+	void encode(u16 id, const ObjectPosition &pos, bool force_keyframe,
+			std::string &reliable_data, std::string &unreliable_data);
+
+	// Forgets the keyframe of an object the client doesn't know anymore
+	void forget(u16 id) { m_keyframes.erase(id); }
+
+	u32 getKeyframeCount() const { return m_keyframes.size(); }
+
+private:
+	struct Keyframe {
+		ObjectPosition pos;
+		u8 seq;
+	};
+	UNORDERED_MAP<u16, Keyframe> m_keyframes;
+};
+
+/*
+	Client side of TOCLIENT_ACTIVE_OBJECT_POSITIONS
+*/
+class ObjectPositionDecoder
+{
+public:
+	// Reads one update. Returns false if it is relative to a keyframe
+	// that didn't arrive yet, or was replaced already; it can be ignored.
+	// Throws SerializationError on truncated data.
+	bool decode(std::istream &is, u16 &id, ObjectPosition &pos);
+
+	void forget(u16 id) { m_keyframes.erase(id); }
+
+private:
+	struct Keyframe {
+		ObjectPosition pos;
+		u8 seq;
+	};
+	UNORDERED_MAP<u16, Keyframe> m_keyframes;
+};
+
+#endif
@@ -202,6 +202,29 @@ int ModApiEnvMod::l_swap_node(lua_State *L)
 	return 1;
 }
 
+// bulk_edit(func, ...)
+int ModApiEnvMod::l_bulk_edit(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	int nargs = lua_gettop(L) - 1;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_ERROR_HANDLER);
+	lua_insert(L, 1);
+
+	int result;
+	{
+		// Relight the changes made before an error, too
+		MapBulkEdit bulk_edit(&env->getMap());
+		result = lua_pcall(L, nargs, LUA_MULTRET, 1);
+	}
+	PCALL_RESL(L, result);
+
+	lua_remove(L, 1); // Remove error handler
+	return lua_gettop(L);
+}
+
 // get_node(pos)
 // pos = {x=num, y=num, z=num}
 int ModApiEnvMod::l_get_node(lua_State *L)
@@ -650,13 +673,50 @@ int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 
 	std::map<content_t, u16> individual_count;
 
+	Map &map = env->getMap();
+
+	// Loaded blocks that contain none of the wanted contents are
+	// skipped as a whole. Unloaded blocks read as CONTENT_IGNORE.
+	std::vector<bool> skip_block;
+	v3s16 bpmin = getNodeBlockPos(minp);
+	v3s16 bpmax = getNodeBlockPos(maxp);
+	v3s16 bext = bpmax - bpmin + v3s16(1, 1, 1);
+	if (bext.X > 0 && bext.Y > 0 && bext.Z > 0) {
+		skip_block.resize((u32)bext.X * bext.Y * bext.Z, false);
+		v3s16 bp;
+		u32 bi = 0;
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++, bi++) {
+			MapBlock *block = map.getBlockNoCreateNoEx(bp);
+			if (block == NULL || block->isDummy())
+				continue;
+			bool skip = true;
+			const std::vector<content_t> &contents = block->getContents();
+			for (std::vector<content_t>::const_iterator it = contents.begin();
+					it != contents.end(); ++it) {
+				if (filter.count(*it) != 0) {
+					skip = false;
+					break;
+				}
+			}
+			skip_block[bi] = skip;
+		}
+	}
+
 	lua_newtable(L);
 	u64 i = 0;
 	for (s16 x = minp.X; x <= maxp.X; x++)
 		for (s16 y = minp.Y; y <= maxp.Y; y++)
 			for (s16 z = minp.Z; z <= maxp.Z; z++) {
 				v3s16 p(x, y, z);
-				content_t c = env->getMap().getNodeNoEx(p).getContent();
+				v3s16 bp = getNodeBlockPos(p) - bpmin;
+				if (skip_block[(bp.X * bext.Y + bp.Y) * bext.Z + bp.Z]) {
+					// Jump to the last node of the block on this row
+					z = MYMIN(maxp.Z, (bp.Z + bpmin.Z + 1) * MAP_BLOCKSIZE - 1);
+					continue;
+				}
+				content_t c = map.getNodeNoEx(p).getContent();
 				if (filter.count(c) != 0) {
 					push_v3s16(L, p);
 					lua_rawseti(L, -2, ++i);
@@ -1047,6 +1107,7 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(set_node);
 	API_FCT(add_node);
 	API_FCT(swap_node);
+	API_FCT(bulk_edit);
 	API_FCT(add_item);
 	API_FCT(remove_node);
 	API_FCT(get_node);
@@ -39,6 +39,10 @@ class ModApiEnvMod : public ModApiBase {
 	// pos = {x=num, y=num, z=num}
 	static int l_swap_node(lua_State *L);
 
+	// bulk_edit(func, ...)
+	// Calls func(...), deferring lighting updates until it returns
+	static int l_bulk_edit(lua_State *L);
+
 	// get_node(pos)
 	// pos = {x=num, y=num, z=num}
 	static int l_get_node(lua_State *L);
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 
 #include "util/serialize.h"
+#include "util/lz4.h"
+#include "util/basic_macros.h"
 #if defined(_WIN32) && !defined(WIN32_NO_ZLIB_WINAPI)
 	#define ZLIB_WINAPI
 #endif
@@ -186,6 +188,88 @@ void decompressZlib(std::istream &is, std::ostream &os)
 	inflateEnd(&z);
 }
 
+void compressLZ4(SharedBuffer<u8> data, std::ostream &os)
+{
+	u32 size = data.getSize();
+	SharedBuffer<u8> buf(lz4_compress_bound(size));
+	u32 compressed_size = lz4_compress(*data, size, *buf);
+
+	writeU32(os, size);
+	writeU32(os, compressed_size);
+	os.write((char*)*buf, compressed_size);
+}
+
+void compressLZ4(const std::string &data, std::ostream &os)
+{
+	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
+	compressLZ4(databuf, os);
+}
+
+void decompressLZ4(std::istream &is, std::ostream &os, u32 max_size)
+{
+	u32 size = readU32(is);
+	u32 compressed_size = readU32(is);
+	// An LZ4 block can't expand to more than about 255 times its size
+	if (size > max_size || compressed_size == 0
+			|| size / 255 > compressed_size
+			|| compressed_size > lz4_compress_bound(size))
+		throw SerializationError("decompressLZ4: invalid size");
+
+	// Read in chunks, so that a corrupted size can't make us allocate
+	// more than the stream holds
+	std::string compressed;
+	char chunk[16384];
+	while (compressed.size() < compressed_size) {
+		std::streamsize count = MYMIN(sizeof(chunk),
+			compressed_size - compressed.size());
+		is.read(chunk, count);
+		if (is.gcount() != count)
+			throw SerializationError("decompressLZ4: truncated data");
+		compressed.append(chunk, count);
+	}
+
+	SharedBuffer<u8> databuf(size);
+	if (!lz4_decompress((const u8*)compressed.c_str(), compressed_size,
+			*databuf, size))
+		throw SerializationError("decompressLZ4: invalid data");
+	os.write((char*)*databuf, size);
+}
+
+void compressMapData(SharedBuffer<u8> data, std::ostream &os, u8 compression)
+{
+	switch (compression) {
+	case MAP_COMPRESSION_ZLIB:
+		compressZlib(data, os);
+		break;
+	case MAP_COMPRESSION_LZ4:
+		compressLZ4(data, os);
+		break;
+	default:
+		throw SerializationError("compressMapData: unknown codec");
+	}
+}
+
+void compressMapData(const std::string &data, std::ostream &os, u8 compression)
+{
+	SharedBuffer<u8> databuf((u8*)data.c_str(), data.size());
+	compressMapData(databuf, os, compression);
+}
+
+void decompressMapData(std::istream &is, std::ostream &os, u8 compression,
+		u32 max_size)
+{
+	switch (compression) {
+	case MAP_COMPRESSION_ZLIB:
+		decompressZlib(is, os);
+		break;
+	case MAP_COMPRESSION_LZ4:
+		decompressLZ4(is, os, max_size);
+		break;
+	default:
+		throw SerializationError("decompressMapData: unknown codec");
+	}
+}
+
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version)
 {
 	if(version >= 11)
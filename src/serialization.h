@@ -24,6 +24,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "exceptions.h"
 #include <iostream>
 #include "util/pointer.h"
+#include "util/serialize.h"
 
 /*
 	Map format serialization version
@@ -62,11 +63,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	24: 16-bit node ids and node timers (never released as stable)
 	25: Improved node timer format
 	26: Never written; read the same as 25
+	27: Compression codec of node data and metadata is stored in the block
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
 // Highest supported serialization version
-#define SER_FMT_VER_HIGHEST_READ 26
+#define SER_FMT_VER_HIGHEST_READ 27
 // Saved on disk version
 #define SER_FMT_VER_HIGHEST_WRITE 25
 // Lowest supported serialization version
@@ -75,6 +77,24 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // Can't do < 24 anymore; we have 16-bit dynamically allocated node IDs
 // in memory; conversion just won't work in this direction.
 #define SER_FMT_VER_LOWEST_WRITE 24
+// Lowest serialization version that can use other codecs than zlib
+#define SER_FMT_VER_MAP_COMPRESSION 27
+
+/*
+	Compression codecs of map data. The value is stored in the blocks.
+*/
+enum MapCompression {
+	MAP_COMPRESSION_ZLIB = 0,
+	// Larger than zlib, but much faster
+	MAP_COMPRESSION_LZ4 = 1,
+};
+
+// Version to write map data compressed with the given codec in. zlib keeps
+// the older version, so that such worlds can be read by older versions.
+inline u8 ser_ver_for_map_compression(u8 compression) {
+	return compression == MAP_COMPRESSION_ZLIB ?
+		SER_FMT_VER_HIGHEST_WRITE : SER_FMT_VER_MAP_COMPRESSION;
+}
 
 inline bool ser_ver_supported(s32 v) {
 	return v >= SER_FMT_VER_LOWEST_READ && v <= SER_FMT_VER_HIGHEST_READ;
@@ -88,6 +108,19 @@ void compressZlib(SharedBuffer<u8> data, std::ostream &os, int level = -1);
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os);
 
+void compressLZ4(SharedBuffer<u8> data, std::ostream &os);
+void compressLZ4(const std::string &data, std::ostream &os);
+// Throws SerializationError if the data would decompress to more than
+// max_size bytes
+void decompressLZ4(std::istream &is, std::ostream &os,
+		u32 max_size = LONG_STRING_MAX_LEN);
+
+// These choose the codec according to a MapCompression value
+void compressMapData(SharedBuffer<u8> data, std::ostream &os, u8 compression);
+void compressMapData(const std::string &data, std::ostream &os, u8 compression);
+void decompressMapData(std::istream &is, std::ostream &os, u8 compression,
+		u32 max_size = LONG_STRING_MAX_LEN);
+
 // These choose between zlib and a self-made one according to version
 void compress(SharedBuffer<u8> data, std::ostream &os, u8 version);
 //void compress(const std::string &data, std::ostream &os, u8 version);
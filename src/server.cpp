@@ -492,6 +492,43 @@ void Server::step(float dtime)
 	}
 }
 
+/*
+	Drops the message of the same object that aom replaces, so that only
+	the latest position and animation of an object are sent per step.
+	Returns true if a message was dropped.
+*/
+static bool coalesce_object_message(std::vector<ActiveObjectMessage> &list,
+		ActiveObjectMessage &aom)
+{
+	if (aom.datastring.empty())
+		return false;
+	u8 cmd = aom.datastring[0];
+	if (cmd != GENERIC_CMD_UPDATE_POSITION && cmd != GENERIC_CMD_SET_ANIMATION)
+		return false;
+
+	for (std::vector<ActiveObjectMessage>::iterator
+			i = list.begin(); i != list.end(); ++i) {
+		if (i->datastring.empty() || (u8)i->datastring[0] != cmd)
+			continue;
+
+		aom.reliable |= i->reliable;
+		// A position that isn't interpolated to (a teleport) stays one.
+		// do_interpolate follows the command, position, velocity,
+		// acceleration and yaw.
+		const size_t interp_pos = 1 + 3 * 12 + 4;
+		if (cmd == GENERIC_CMD_UPDATE_POSITION &&
+				i->datastring.size() > interp_pos &&
+				aom.datastring.size() > interp_pos &&
+				i->datastring[interp_pos] == 0)
+			aom.datastring[interp_pos] = 0;
+
+		// There is at most one, as every message goes through here
+		list.erase(i);
+		return true;
+	}
+	return false;
+}
+
 void Server::AsyncRunStep(bool initial_step)
 {
 	DSTACK(FUNCTION_NAME);
@@ -574,7 +611,7 @@ void Server::AsyncRunStep(bool initial_step)
 		ScopeProfiler sp(g_profiler, "Server: map timer and unload");
 		m_env->getMap().timerUpdate(map_timer_and_unload_dtime,
 			g_settings->getFloat("server_unload_unused_data_timeout"),
-			U32_MAX);
+			U32_MAX, g_settings->getU64("server_map_memory_budget"));
 	}
 
 	/*
@@ -739,6 +776,7 @@ void Server::AsyncRunStep(bool initial_step)
 
 				// Remove from known objects
 				client->m_known_objects.erase(id);
+				client->forgetObject(id);
 
 				if(obj && obj->m_known_by_count > 0)
 					obj->m_known_by_count--;
@@ -801,6 +839,7 @@ void Server::AsyncRunStep(bool initial_step)
 		// Key = object id
 		// Value = data sent by object
 		UNORDERED_MAP<u16, std::vector<ActiveObjectMessage>* > buffered_messages;
+		u32 num_coalesced = 0;
 
 		// Get active object messages from environment
 		for(;;) {
@@ -817,9 +856,12 @@ void Server::AsyncRunStep(bool initial_step)
 			}
 			else {
 				message_list = n->second;
+				if (coalesce_object_message(*message_list, aom))
+					num_coalesced++;
 			}
 			message_list->push_back(aom);
 		}
+		g_profiler->avg("Server: object messages coalesced", num_coalesced);
 
 		m_clients.lock();
 		UNORDERED_MAP<u16, RemoteClient*> clients = m_clients.getClientList();
@@ -829,6 +871,21 @@ void Server::AsyncRunStep(bool initial_step)
 			RemoteClient *client = i->second;
 			std::string reliable_data;
 			std::string unreliable_data;
+			std::string reliable_positions;
+			std::string unreliable_positions;
+			bool send_positions = client->net_proto_version >= 29;
+
+			PlayerSAO *playersao = NULL;
+			RemotePlayer *player = m_env->getPlayer(client->peer_id);
+			if (player)
+				playersao = player->getPlayerSAO();
+			client->stepObjectUpdates(dtime);
+
+			// Messages to send: the held back updates that are due,
+			// followed by the new messages the client is interested in
+			std::vector<ActiveObjectMessage> messages;
+			client->popDueObjectMessages(messages);
+
 			// Go through all objects in message buffer
 			for (UNORDERED_MAP<u16, std::vector<ActiveObjectMessage>* >::iterator
 					j = buffered_messages.begin();
@@ -838,27 +895,40 @@ void Server::AsyncRunStep(bool initial_step)
 				if (client->m_known_objects.find(id) == client->m_known_objects.end())
 					continue;
 
+				ServerActiveObject *obj = m_env->getActiveObject(id);
+				float interval = obj ? client->getObjectUpdateInterval(
+						playersao, obj->getBasePosition()) : 0;
+
 				// Get message list of object
 				std::vector<ActiveObjectMessage>* list = j->second;
-				// Go through every message
 				for (std::vector<ActiveObjectMessage>::iterator
 						k = list->begin(); k != list->end(); ++k) {
-					// Compose the full new data with header
 					ActiveObjectMessage aom = *k;
-					std::string new_data;
-					// Add object id
-					char buf[2];
-					writeU16((u8*)&buf[0], aom.id);
-					new_data.append(buf, 2);
-					// Add data
-					new_data += serializeString(aom.datastring);
-					// Add data to buffer
-					if(aom.reliable)
-						reliable_data += new_data;
-					else
-						unreliable_data += new_data;
+					if (client->filterObjectMessage(aom, interval))
+						messages.push_back(aom);
 				}
 			}
+
+			// Go through every message
+			for (std::vector<ActiveObjectMessage>::iterator
+					k = messages.begin(); k != messages.end(); ++k) {
+				const ActiveObjectMessage &aom = *k;
+
+				// Positions are quantized and delta encoded
+				ObjectPosition pos;
+				if (send_positions && pos.parse(aom.datastring)) {
+					client->m_object_positions.encode(aom.id, pos, aom.reliable,
+							reliable_positions, unreliable_positions);
+					continue;
+				}
+
+				std::string &data = aom.reliable ? reliable_data : unreliable_data;
+				// Add object id and data
+				char buf[2];
+				writeU16((u8*)&buf[0], aom.id);
+				data.append(buf, 2);
+				data.append(serializeString(aom.datastring));
+			}
 			/*
 				reliable_data and unreliable_data are now ready.
 				Send them.
@@ -870,6 +940,12 @@ void Server::AsyncRunStep(bool initial_step)
 			if(unreliable_data.size() > 0) {
 				SendActiveObjectMessages(client->peer_id, unreliable_data, false);
 			}
+
+			if (!reliable_positions.empty())
+				SendActiveObjectPositions(client->peer_id, reliable_positions, true);
+
+			if (!unreliable_positions.empty())
+				SendActiveObjectPositions(client->peer_id, unreliable_positions, false);
 		}
 		m_clients.unlock();
 
@@ -1961,6 +2037,18 @@ void Server::SendActiveObjectMessages(u16 peer_id, const std::string &datas, boo
 
 }
 
+void Server::SendActiveObjectPositions(u16 peer_id, const std::string &datas, bool reliable)
+{
+	NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_POSITIONS,
+			datas.size(), peer_id);
+
+	pkt.putRawString(datas.c_str(), datas.size());
+
+	m_clients.send(pkt.getPeerId(),
+			reliable ? clientCommandFactoryTable[pkt.getCommand()].channel : 1,
+			&pkt, reliable);
+}
+
 s32 Server::playSound(const SimpleSoundSpec &spec,
 		const ServerSoundParams &params)
 {
@@ -2152,14 +2240,18 @@ void Server::SendBlockNoLock(u16 peer_id, MapBlock *block, u8 ver, u16 net_proto
 		Create a packet with the block in the right format
 	*/
 
+	// Shared by all clients that get the block in this version
+	const std::string &data = block->getNetworkSerialization(ver);
+
 	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
 	block->serializeNetworkSpecific(os, net_proto_version);
 	std::string s = os.str();
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + s.size(), peer_id);
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA,
+			2 + 2 + 2 + 2 + data.size() + s.size(), peer_id);
 
 	pkt << p;
+	pkt.putRawString(data.c_str(), data.size());
 	pkt.putRawString(s.c_str(), s.size());
 	Send(&pkt);
 }
@@ -3267,6 +3359,9 @@ bool Server::rollbackRevertActions(const std::list<RollbackAction> &actions,
 	int num_tried = 0;
 	int num_failed = 0;
 
+	// Relight the reverted nodes at once
+	MapBulkEdit bulk_edit(map);
+
 	for(std::list<RollbackAction>::const_iterator
 			i = actions.begin();
 			i != actions.end(); ++i)
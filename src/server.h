@@ -454,6 +454,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	u32 SendActiveObjectRemoveAdd(u16 peer_id, const std::string &datas);
 	void SendActiveObjectMessages(u16 peer_id, const std::string &datas, bool reliable = true);
+	void SendActiveObjectPositions(u16 peer_id, const std::string &datas, bool reliable);
 	/*
 		Something random
 	*/
@@ -78,7 +78,7 @@ class ServerActiveObject : public ActiveObject
 		Some simple getters/setters
 	*/
 	v3f getBasePosition(){ return m_base_position; }
-	void setBasePosition(v3f pos){ m_base_position = pos; }
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 
 	/*
@@ -237,6 +237,13 @@ class ServerActiveObject : public ActiveObject
 	*/
 	v3s16 m_static_block;
 
+	/*
+		Time and send recommendation the object missed while the
+		environment was stepping it at a lower rate (see entity_step_tiers)
+	*/
+	float m_skipped_dtime;
+	bool m_skipped_send;
+
 	/*
 		Queue of messages to be sent to the client
 	*/
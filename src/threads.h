@@ -70,6 +70,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	typedef pthread_t threadhandle_t;
 #endif
 
+//
+// THREAD_LOCAL
+// Only usable for POD types without dynamic initialization.
+//
+#if __cplusplus >= 201103L
+	#define THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
 //
 // ThreadStartFunc
 //
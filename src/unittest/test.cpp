@@ -73,7 +73,15 @@ class TestGameDef : public IGameDef {
 };
 
 
-TestGameDef::TestGameDef()
+TestGameDef::TestGameDef() :
+	m_craftdef(NULL),
+	m_texturesrc(NULL),
+	m_shadersrc(NULL),
+	m_soundmgr(NULL),
+	m_eventmgr(NULL),
+	m_scenemgr(NULL),
+	m_rollbackmgr(NULL),
+	m_emergemgr(NULL)
 {
 	m_itemdef = createItemDefManager();
 	m_nodedef = createNodeDefManager();
@@ -0,0 +1,180 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "abmscanner.h"
+#include "mapblock.h"
+
+class TestABMScanner : public TestBase {
+public:
+	TestABMScanner() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestABMScanner"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testScan(IGameDef *gamedef);
+	void testNeighbors(IGameDef *gamedef);
+	void testThreads(IGameDef *gamedef);
+};
+
+static TestABMScanner g_test_instance;
+
+void TestABMScanner::runTests(IGameDef *gamedef)
+{
+	TEST(testScan, gamedef);
+	TEST(testNeighbors, gamedef);
+	TEST(testThreads, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const content_t CONTENT_TRIGGER = 200;
+static const content_t CONTENT_NEIGHBOR = 201;
+
+static ABMScanJob make_job(MapBlock *block)
+{
+	ABMScanJob job;
+	job.blockpos = block->getPos();
+	for (u32 i = 0; i < 27; i++)
+		job.blocks[i] = NULL;
+	job.blocks[ABMScanJob::getNeighbourIndex(v3s16(0, 0, 0))] = block;
+	job.seed = 1234;
+	return job;
+}
+
+static void fill(MapBlock *block, content_t c)
+{
+	MapNode n(c);
+	v3s16 p;
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		block->setNode(p, n);
+}
+
+void TestABMScanner::testScan(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	fill(&block, CONTENT_AIR);
+	MapNode n(CONTENT_TRIGGER);
+	block.setNode(v3s16(1, 2, 3), n);
+	block.setNode(v3s16(15, 15, 15), n);
+
+	ActiveABMMap aabms;
+	ActiveABM aabm;
+	aabm.abm = NULL;
+	aabm.chance = 1;
+	aabms[CONTENT_TRIGGER].push_back(aabm);
+
+	ABMScanJob job = make_job(&block);
+	job.scan(aabms);
+	UASSERTEQ(size_t, job.candidates.size(), 2);
+	UASSERT(job.candidates[0].p0 == v3s16(1, 2, 3));
+	UASSERT(job.candidates[1].p0 == v3s16(15, 15, 15));
+	UASSERTEQ(content_t, job.candidates[0].content, CONTENT_TRIGGER);
+	UASSERT(job.candidates[0].aabm == &aabms[CONTENT_TRIGGER][0]);
+
+	// The chance rolls only depend on the seed
+	fill(&block, CONTENT_TRIGGER);
+	aabms[CONTENT_TRIGGER][0].chance = 4;
+	ABMScanJob job1 = make_job(&block);
+	ABMScanJob job2 = make_job(&block);
+	job1.scan(aabms);
+	job2.scan(aabms);
+	UASSERT(!job1.candidates.empty());
+	UASSERT(job1.candidates.size() < MapBlock::nodecount);
+	UASSERTEQ(size_t, job1.candidates.size(), job2.candidates.size());
+}
+
+void TestABMScanner::testNeighbors(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	MapBlock above(NULL, v3s16(0, 1, 0), gamedef);
+	fill(&block, CONTENT_AIR);
+	fill(&above, CONTENT_AIR);
+
+	MapNode trigger(CONTENT_TRIGGER);
+	MapNode neighbor(CONTENT_NEIGHBOR);
+	// Neighbor inside the block
+	block.setNode(v3s16(4, 4, 4), trigger);
+	block.setNode(v3s16(5, 5, 5), neighbor);
+	// Neighbor in the block above
+	block.setNode(v3s16(8, 15, 8), trigger);
+	above.setNode(v3s16(8, 0, 8), neighbor);
+	// No neighbor
+	block.setNode(v3s16(12, 2, 2), trigger);
+
+	ActiveABMMap aabms;
+	ActiveABM aabm;
+	aabm.abm = NULL;
+	aabm.chance = 1;
+	aabm.required_neighbors.insert(CONTENT_NEIGHBOR);
+	aabms[CONTENT_TRIGGER].push_back(aabm);
+
+	ABMScanJob job = make_job(&block);
+	job.blocks[ABMScanJob::getNeighbourIndex(v3s16(0, 1, 0))] = &above;
+	job.scan(aabms);
+	UASSERTEQ(size_t, job.candidates.size(), 2);
+	UASSERT(job.candidates[0].p0 == v3s16(4, 4, 4));
+	UASSERT(job.candidates[1].p0 == v3s16(8, 15, 8));
+
+	// Missing neighbour blocks read as ignore
+	job = make_job(&block);
+	job.scan(aabms);
+	UASSERTEQ(size_t, job.candidates.size(), 1);
+}
+
+void TestABMScanner::testThreads(IGameDef *gamedef)
+{
+	const u32 num_blocks = 20;
+	std::vector<MapBlock *> blocks;
+	for (u32 i = 0; i < num_blocks; i++) {
+		MapBlock *block = new MapBlock(NULL, v3s16(i * 2, 0, 0), gamedef);
+		fill(block, CONTENT_AIR);
+		MapNode n(CONTENT_TRIGGER);
+		for (u32 k = 0; k <= i; k++)
+			block->setNode(v3s16(k % MAP_BLOCKSIZE, k / MAP_BLOCKSIZE, 0), n);
+		blocks.push_back(block);
+	}
+
+	ActiveABMMap aabms;
+	ActiveABM aabm;
+	aabm.abm = NULL;
+	aabm.chance = 1;
+	aabms[CONTENT_TRIGGER].push_back(aabm);
+
+	ABMScanner scanner(4);
+	UASSERT(scanner.getThreadCount() >= 1);
+
+	// Scan twice to make sure the workers can be reused
+	for (u32 round = 0; round < 2; round++) {
+		std::vector<ABMScanJob> jobs;
+		for (u32 i = 0; i < num_blocks; i++)
+			jobs.push_back(make_job(blocks[i]));
+
+		scanner.scan(aabms, jobs);
+
+		for (u32 i = 0; i < num_blocks; i++)
+			UASSERTEQ(size_t, jobs[i].candidates.size(), i + 1);
+	}
+
+	for (u32 i = 0; i < num_blocks; i++)
+		delete blocks[i];
+}
@@ -0,0 +1,176 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "environment.h"
+#include "noise.h"
+
+class TestActiveBlockList : public TestBase {
+public:
+	TestActiveBlockList() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveBlockList"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testMove();
+	void testRetryLater();
+	void testRandom();
+};
+
+static TestActiveBlockList g_test_instance;
+
+void TestActiveBlockList::runTests(IGameDef *gamedef)
+{
+	TEST(testMove);
+	TEST(testRetryLater);
+	TEST(testRandom);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// What ActiveBlockList::update used to compute from scratch
+static std::set<v3s16> get_blocks_in_range(const std::vector<v3s16> &positions,
+	s16 r, const std::set<v3s16> &forceloaded)
+{
+	std::set<v3s16> list = forceloaded;
+	for (size_t i = 0; i < positions.size(); i++) {
+		v3s16 p;
+		for (p.X = positions[i].X - r; p.X <= positions[i].X + r; p.X++)
+		for (p.Y = positions[i].Y - r; p.Y <= positions[i].Y + r; p.Y++)
+		for (p.Z = positions[i].Z - r; p.Z <= positions[i].Z + r; p.Z++)
+			list.insert(p);
+	}
+	return list;
+}
+
+void TestActiveBlockList::testMove()
+{
+	ActiveBlockList list;
+	std::set<v3s16> removed, added;
+	std::vector<v3s16> positions(1, v3s16(0, 0, 0));
+
+	list.update(positions, 1, removed, added);
+	UASSERTEQ(size_t, added.size(), 27);
+	UASSERT(removed.empty());
+
+	// Staying in the same block changes nothing
+	added.clear();
+	list.update(positions, 1, removed, added);
+	UASSERT(added.empty());
+	UASSERT(removed.empty());
+
+	// Moving by one block adds and removes one slice
+	positions[0] = v3s16(1, 0, 0);
+	list.update(positions, 1, removed, added);
+	UASSERTEQ(size_t, added.size(), 9);
+	UASSERTEQ(size_t, removed.size(), 9);
+	UASSERT(added.count(v3s16(2, 1, -1)) == 1);
+	UASSERT(removed.count(v3s16(-1, 0, 0)) == 1);
+	UASSERT(list.contains(v3s16(0, 0, 0)));
+	UASSERT(!list.contains(v3s16(-1, 0, 0)));
+
+	// A second player keeps the overlapping blocks active
+	removed.clear();
+	added.clear();
+	positions.push_back(v3s16(3, 0, 0));
+	list.update(positions, 1, removed, added);
+	UASSERTEQ(size_t, added.size(), 18);
+	positions.erase(positions.begin());
+	list.update(positions, 1, removed, added);
+	UASSERTEQ(size_t, removed.size(), 18);
+	UASSERT(list.contains(v3s16(2, 0, 0)));
+
+	list.clear();
+	UASSERT(!list.contains(v3s16(2, 0, 0)));
+}
+
+void TestActiveBlockList::testRetryLater()
+{
+	ActiveBlockList list;
+	std::set<v3s16> removed, added;
+	std::vector<v3s16> positions;
+
+	list.m_forceloaded_list.insert(v3s16(5, 5, 5));
+	list.update(positions, 2, removed, added);
+	UASSERTEQ(size_t, added.size(), 1);
+
+	list.retryLater(v3s16(5, 5, 5));
+	UASSERT(!list.contains(v3s16(5, 5, 5)));
+
+	// Reported as added again as long as it is in range
+	added.clear();
+	list.update(positions, 2, removed, added);
+	UASSERTEQ(size_t, added.size(), 1);
+	UASSERT(list.contains(v3s16(5, 5, 5)));
+
+	list.retryLater(v3s16(5, 5, 5));
+	list.m_forceloaded_list.clear();
+	added.clear();
+	list.update(positions, 2, removed, added);
+	UASSERT(added.empty());
+	UASSERT(removed.empty());
+	UASSERT(!list.contains(v3s16(5, 5, 5)));
+}
+
+void TestActiveBlockList::testRandom()
+{
+	PcgRandom pr(42);
+	ActiveBlockList list;
+	std::vector<v3s16> positions;
+	std::set<v3s16> expected;
+
+	for (u32 step = 0; step < 200; step++) {
+		// Players join, leave, walk and teleport
+		u32 action = pr.range(0, 9);
+		if (action == 0 || positions.empty()) {
+			positions.push_back(v3s16(pr.range(-5, 5), pr.range(-5, 5),
+				pr.range(-5, 5)));
+		} else if (action == 1) {
+			positions.erase(positions.begin() + pr.range(0, positions.size() - 1));
+		} else if (action == 2) {
+			positions[pr.range(0, positions.size() - 1)] = v3s16(
+				pr.range(-20, 20), pr.range(-20, 20), pr.range(-20, 20));
+		} else if (action == 3) {
+			v3s16 p(pr.range(-8, 8), pr.range(-8, 8), pr.range(-8, 8));
+			if (list.m_forceloaded_list.erase(p) == 0)
+				list.m_forceloaded_list.insert(p);
+		} else {
+			for (size_t i = 0; i < positions.size(); i++)
+				positions[i] += v3s16(pr.range(-1, 1), pr.range(-1, 1),
+					pr.range(-1, 1));
+		}
+		s16 radius = step < 150 ? 2 : 3;
+
+		std::set<v3s16> removed, added;
+		list.update(positions, radius, removed, added);
+
+		std::set<v3s16> now = get_blocks_in_range(positions, radius,
+			list.m_forceloaded_list);
+		UASSERT(list.m_list == now);
+
+		for (std::set<v3s16>::iterator i = added.begin(); i != added.end(); ++i)
+			UASSERT(expected.count(*i) == 0 && now.count(*i) == 1);
+		for (std::set<v3s16>::iterator i = removed.begin(); i != removed.end(); ++i)
+			UASSERT(expected.count(*i) == 1 && now.count(*i) == 0);
+		UASSERTEQ(size_t, expected.size() + added.size() - removed.size(),
+			now.size());
+		expected = now;
+	}
+}
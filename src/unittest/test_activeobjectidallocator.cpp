@@ -0,0 +1,108 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "activeobjectidallocator.h"
+
+class TestActiveObjectIdAllocator : public TestBase {
+public:
+	TestActiveObjectIdAllocator() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveObjectIdAllocator"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testAllocate();
+	void testReserve();
+	void testExhaustion();
+};
+
+static TestActiveObjectIdAllocator g_test_instance;
+
+void TestActiveObjectIdAllocator::runTests(IGameDef *gamedef)
+{
+	TEST(testAllocate);
+	TEST(testReserve);
+	TEST(testExhaustion);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestActiveObjectIdAllocator::testAllocate()
+{
+	ActiveObjectIdAllocator ids;
+
+	UASSERTEQ(u16, ids.allocate(), 1);
+	UASSERTEQ(u16, ids.allocate(), 2);
+	UASSERTEQ(u16, ids.allocate(), 3);
+	UASSERTEQ(u32, ids.getUsedCount(), 3);
+
+	// Released ids are not reused while there are unused ones
+	ids.release(1);
+	UASSERT(!ids.isUsed(1));
+	UASSERTEQ(u16, ids.allocate(), 4);
+	UASSERTEQ(u32, ids.getUsedCount(), 3);
+
+	// Releasing twice is harmless
+	ids.release(1);
+	UASSERTEQ(u32, ids.getUsedCount(), 3);
+
+	ids.clear();
+	UASSERTEQ(u32, ids.getUsedCount(), 0);
+	UASSERTEQ(u16, ids.allocate(), 1);
+}
+
+void TestActiveObjectIdAllocator::testReserve()
+{
+	ActiveObjectIdAllocator ids;
+
+	UASSERT(!ids.reserve(0));
+	UASSERT(ids.reserve(2));
+	UASSERT(!ids.reserve(2));
+	UASSERT(ids.isUsed(2));
+
+	// Reserved ids are skipped
+	UASSERTEQ(u16, ids.allocate(), 1);
+	UASSERTEQ(u16, ids.allocate(), 3);
+
+	// A released id that has been reserved again is not handed out
+	ids.release(1);
+	UASSERT(ids.reserve(1));
+	UASSERTEQ(u32, ids.getUsedCount(), 3);
+}
+
+void TestActiveObjectIdAllocator::testExhaustion()
+{
+	ActiveObjectIdAllocator ids;
+
+	for (u32 i = 1; i <= ActiveObjectIdAllocator::ID_COUNT; i++)
+		UASSERTEQ(u16, ids.allocate(), i);
+	UASSERTEQ(u16, ids.allocate(), 0);
+	UASSERTEQ(u32, ids.getFailedCount(), 1);
+
+	// Released ids come back in release order
+	ids.release(500);
+	ids.release(7);
+	ids.release(65535);
+	UASSERTEQ(u16, ids.allocate(), 500);
+	UASSERTEQ(u16, ids.allocate(), 7);
+	UASSERTEQ(u16, ids.allocate(), 65535);
+	UASSERTEQ(u16, ids.allocate(), 0);
+	UASSERTEQ(u32, ids.getFailedCount(), 2);
+}
@@ -0,0 +1,179 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "activeobjectindex.h"
+
+class TestActiveObjectIndex : public TestBase {
+public:
+	TestActiveObjectIndex() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveObjectIndex"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testInsertRemove();
+	void testUpdate();
+	void testQuery();
+	void testFarAway();
+	void testBlocks();
+};
+
+static TestActiveObjectIndex g_test_instance;
+
+void TestActiveObjectIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testInsertRemove);
+	TEST(testUpdate);
+	TEST(testQuery);
+	TEST(testFarAway);
+	TEST(testBlocks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool has_id(const std::vector<u16> &ids, u16 id)
+{
+	return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+void TestActiveObjectIndex::testInsertRemove()
+{
+	ActiveObjectIndex index;
+	std::vector<u16> res;
+
+	index.insert(1, v3f(0, 0, 0));
+	index.insert(2, v3f(5 * BS, 0, 0));
+	index.insert(3, v3f(-100 * BS, 20 * BS, 7 * BS));
+	UASSERTEQ(u32, index.size(), 3);
+	UASSERT(index.contains(2));
+
+	// Inserting again moves the object instead of duplicating it
+	index.insert(2, v3f(6 * BS, 0, 0));
+	UASSERTEQ(u32, index.size(), 3);
+
+	index.remove(2);
+	UASSERTEQ(u32, index.size(), 2);
+	UASSERT(!index.contains(2));
+
+	index.getObjectsInArea(v3f(-BS, -BS, -BS), v3f(10 * BS, BS, BS), res);
+	UASSERTEQ(size_t, res.size(), 1);
+	UASSERT(has_id(res, 1));
+
+	// Removing unknown ids is harmless
+	index.remove(42);
+	UASSERTEQ(u32, index.size(), 2);
+
+	index.clear();
+	UASSERTEQ(u32, index.size(), 0);
+}
+
+void TestActiveObjectIndex::testUpdate()
+{
+	ActiveObjectIndex index;
+	std::vector<u16> res;
+
+	index.insert(1, v3f(0, 0, 0));
+	index.update(1, v3f(200 * BS, 0, 0));
+	// Unknown ids are not added by update
+	index.update(7, v3f(0, 0, 0));
+	UASSERTEQ(u32, index.size(), 1);
+
+	index.getObjectsInArea(v3f(-BS, -BS, -BS), v3f(BS, BS, BS), res);
+	UASSERT(res.empty());
+
+	index.getObjectsInArea(v3f(199 * BS, -BS, -BS), v3f(201 * BS, BS, BS), res);
+	UASSERTEQ(size_t, res.size(), 1);
+	UASSERT(has_id(res, 1));
+}
+
+void TestActiveObjectIndex::testQuery()
+{
+	ActiveObjectIndex index;
+	std::vector<u16> res;
+
+	for (u16 i = 0; i < 100; i++)
+		index.insert(i + 1, v3f(i * 8 * BS, -i * BS, 0));
+
+	// Small query, goes through the cells of the box
+	index.getObjectsInArea(v3f(0, -BS, -BS), v3f(BS, BS, BS), res);
+	UASSERT(has_id(res, 1));
+	UASSERT(!has_id(res, 50));
+
+	// Candidates are whole cells: object 3 is at x = 16 nodes, which is
+	// in the next block and may not be returned for a box ending at x = 1
+	UASSERT(!has_id(res, 3));
+	res.clear();
+
+	// Huge query, goes through the occupied cells
+	index.getObjectsInArea(v3f(-1e6, -1e6, -1e6), v3f(1e6, 1e6, 1e6), res);
+	UASSERTEQ(size_t, res.size(), 100);
+	res.clear();
+
+	// Inverted boxes are empty
+	index.getObjectsInArea(v3f(BS, BS, BS), v3f(-BS, -BS, -BS), res);
+	UASSERT(res.empty());
+}
+
+void TestActiveObjectIndex::testFarAway()
+{
+	ActiveObjectIndex index;
+	std::vector<u16> res;
+
+	// Positions outside the map are clamped into the outermost cells
+	index.insert(1, v3f(1e9, 0, 0));
+	index.insert(2, v3f(-1e9, -1e9, -1e9));
+
+	index.getObjectsInArea(v3f(5e8, -BS, -BS), v3f(2e9, BS, BS), res);
+	UASSERTEQ(size_t, res.size(), 1);
+	UASSERT(has_id(res, 1));
+	res.clear();
+
+	index.getObjectsInArea(v3f(-2e9, -2e9, -2e9), v3f(-5e8, -5e8, -5e8), res);
+	UASSERTEQ(size_t, res.size(), 1);
+	UASSERT(has_id(res, 2));
+}
+
+void TestActiveObjectIndex::testBlocks()
+{
+	ActiveObjectIndex index;
+	std::vector<v3s16> blocks;
+	std::vector<u16> res;
+
+	index.insert(1, v3f(1 * BS, 1 * BS, 1 * BS));
+	index.insert(2, v3f(15 * BS, 0, 0));
+	index.insert(3, v3f(-1 * BS, 0, 0));
+	index.getOccupiedBlocks(blocks);
+	UASSERTEQ(size_t, blocks.size(), 2);
+	UASSERT(std::find(blocks.begin(), blocks.end(), v3s16(-1, 0, 0)) != blocks.end());
+
+	index.getObjectsInBlock(v3s16(0, 0, 0), res);
+	UASSERTEQ(size_t, res.size(), 2);
+	UASSERT(has_id(res, 1) && has_id(res, 2));
+	res.clear();
+
+	// Emptied cells are gone
+	index.remove(3);
+	index.getObjectsInBlock(v3s16(-1, 0, 0), res);
+	UASSERT(res.empty());
+	blocks.clear();
+	index.getOccupiedBlocks(blocks);
+	UASSERTEQ(size_t, blocks.size(), 1);
+}
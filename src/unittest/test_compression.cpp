@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serialization.h"
 #include "nodedef.h"
 #include "noise.h"
+#include "util/serialize.h"
 
 class TestCompression : public TestBase {
 public:
@@ -37,6 +38,8 @@ class TestCompression : public TestBase {
 	void testRLECompression();
 	void testZlibCompression();
 	void testZlibLargeData();
+	void testLZ4Compression();
+	void testLZ4InvalidData();
 };
 
 static TestCompression g_test_instance;
@@ -46,6 +49,8 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testRLECompression);
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
+	TEST(testLZ4Compression);
+	TEST(testLZ4InvalidData);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -170,3 +175,74 @@ void TestCompression::testZlibLargeData()
 				i, str_decompressed[i], i, data_in[i]);
 	}
 }
+
+void TestCompression::testLZ4Compression()
+{
+	std::string data[3];
+	// Runs of the same bytes like in map data, and data that doesn't compress
+	data[1].resize(20000);
+	data[2].resize(20000);
+	PseudoRandom pseudorandom(9420);
+	for (u32 i = 0; i < data[1].size(); i++) {
+		data[1][i] = (i / 300) % 3;
+		data[2][i] = pseudorandom.range(0, 255);
+	}
+
+	// The stream has to end exactly after each compressed string
+	std::ostringstream os_compressed(std::ios::binary);
+	for (u32 i = 0; i < 3; i++)
+		compressMapData(data[i], os_compressed, MAP_COMPRESSION_LZ4);
+	writeU8(os_compressed, 42);
+	UASSERT(os_compressed.str().size() < data[1].size() + data[2].size());
+
+	std::istringstream is_compressed(os_compressed.str(), std::ios::binary);
+	for (u32 i = 0; i < 3; i++) {
+		std::ostringstream os_decompressed(std::ios::binary);
+		decompressMapData(is_compressed, os_decompressed, MAP_COMPRESSION_LZ4);
+		UASSERT(os_decompressed.str() == data[i]);
+	}
+	UASSERTEQ(int, readU8(is_compressed), 42);
+}
+
+void TestCompression::testLZ4InvalidData()
+{
+	std::string data(5000, 'a');
+	std::ostringstream os_compressed(std::ios::binary);
+	compressLZ4(data, os_compressed);
+	std::string compressed = os_compressed.str();
+
+	// Truncated
+	std::istringstream is_truncated(compressed.substr(0, compressed.size() - 1),
+		std::ios::binary);
+	std::ostringstream os1(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, decompressLZ4(is_truncated, os1));
+
+	// Larger than the caller allows
+	std::istringstream is_large(compressed, std::ios::binary);
+	std::ostringstream os3(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError,
+		decompressLZ4(is_large, os3, data.size() - 1));
+
+	// Wrong decompressed size
+	compressed[3]++;
+	std::istringstream is_size(compressed, std::ios::binary);
+	std::ostringstream os2(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, decompressLZ4(is_size, os2));
+
+	// Sizes claiming gigabytes of data, followed by almost none
+	std::ostringstream os_huge(std::ios::binary);
+	writeU32(os_huge, 0xF0000000);
+	writeU32(os_huge, 0xF0000000);
+	os_huge << "aaaa";
+	std::istringstream is_huge(os_huge.str(), std::ios::binary);
+	std::ostringstream os4(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, decompressLZ4(is_huge, os4));
+
+	std::ostringstream os_short(std::ios::binary);
+	writeU32(os_short, 0x01000000);
+	writeU32(os_short, 0x00100000);
+	os_short << "aaaa";
+	std::istringstream is_short(os_short.str(), std::ios::binary);
+	std::ostringstream os5(std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, decompressLZ4(is_short, os5));
+}
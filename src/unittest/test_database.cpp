@@ -0,0 +1,675 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "database-blocklog.h"
+#include "database-cache.h"
+#include "database-dummy.h"
+#include "database-redis.h"
+#include "database-sqlite3.h"
+#include "filesys.h"
+#include "mapmigrator.h"
+#include "settings.h"
+#include "threading/thread.h"
+#include "util/string.h"
+
+#if USE_REDIS
+#include <hiredis.h>
+#endif
+#if USE_POSTGRESQL
+#include "database-postgresql.h"
+#endif
+
+class TestDatabase : public TestBase {
+public:
+	TestDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testDefaultBatches();
+	void testSQLite3Batches();
+	void testSQLite3ReadConnections();
+	void testCacheBatches();
+	void testCache();
+	void testBlockLogBatches();
+	void testBlockLog();
+	void testMigration();
+#if USE_REDIS
+	void testRedis();
+#endif
+#if USE_POSTGRESQL
+	void testPostgreSQL();
+#endif
+
+	void checkBatches(Database *db);
+};
+
+static TestDatabase g_test_instance;
+
+void TestDatabase::runTests(IGameDef *gamedef)
+{
+	TEST(testDefaultBatches);
+	TEST(testSQLite3Batches);
+	TEST(testSQLite3ReadConnections);
+	TEST(testCacheBatches);
+	TEST(testCache);
+#ifndef _WIN32
+	TEST(testBlockLogBatches);
+	TEST(testBlockLog);
+#endif
+	TEST(testMigration);
+#if USE_REDIS
+	TEST(testRedis);
+#endif
+#if USE_POSTGRESQL
+	TEST(testPostgreSQL);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestDatabase::testDefaultBatches()
+{
+	Database_Dummy db;
+	checkBatches(&db);
+}
+
+void TestDatabase::testSQLite3Batches()
+{
+	Database_SQLite3 db(getTestTempDirectory());
+	checkBatches(&db);
+}
+
+// Loads every block over and over, while the main thread saves them
+class BlockReaderThread : public Thread {
+public:
+	BlockReaderThread(Database *db, u32 count) :
+		Thread("BlockReader"),
+		m_db(db),
+		m_count(count),
+		m_bad_blocks(0)
+	{}
+
+	u32 getBadBlocks() const
+	{ return m_bad_blocks; }
+
+private:
+	void *run()
+	{
+		std::string data;
+		while (!stopRequested()) {
+			for (s16 i = 0; i < (s16)m_count; i++) {
+				data.clear();
+				m_db->loadBlock(v3s16(i, 0, 0), &data);
+				// Either not saved yet, or complete
+				if (!data.empty() && data != "block " + itos(i))
+					m_bad_blocks++;
+			}
+		}
+		return NULL;
+	}
+
+	Database *m_db;
+	u32 m_count;
+	u32 m_bad_blocks;
+};
+
+void TestDatabase::testSQLite3ReadConnections()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "sqlite_wal";
+	fs::RecursiveDelete(dir);
+
+	std::string old_readers = g_settings->get("sqlite_read_connections");
+	g_settings->set("sqlite_read_connections", "2");
+	{
+		Database_SQLite3 db(dir);
+		UASSERT(db.supportsConcurrentLoads());
+		checkBatches(&db);
+
+		const u32 count = 200;
+		BlockReaderThread reader1(&db, count), reader2(&db, count);
+		reader1.start();
+		reader2.start();
+		for (s16 i = 0; i < (s16)count; i++) {
+			db.beginSave();
+			UASSERT(db.saveBlock(v3s16(i, 0, 0), "block " + itos(i)));
+			db.endSave();
+		}
+		reader1.stop();
+		reader2.stop();
+		reader1.wait();
+		reader2.wait();
+		UASSERTEQ(u32, reader1.getBadBlocks(), 0);
+		UASSERTEQ(u32, reader2.getBadBlocks(), 0);
+
+		std::string data;
+		db.loadBlock(v3s16(count - 1, 0, 0), &data);
+		UASSERT(data == "block " + itos(count - 1));
+	}
+	g_settings->set("sqlite_read_connections", old_readers);
+}
+
+void TestDatabase::testCacheBatches()
+{
+	Database_Cache db(new Database_Dummy(), 1024 * 1024);
+	checkBatches(&db);
+	// Every block was saved through the cache first
+	UASSERTEQ(u64, db.getMisses(), 1);
+}
+
+void TestDatabase::testCache()
+{
+	Database_Dummy *backend = new Database_Dummy();
+	backend->saveBlock(v3s16(0, 0, 0), std::string(1000, 'a'));
+	backend->saveBlock(v3s16(1, 0, 0), std::string(1000, 'b'));
+	backend->saveBlock(v3s16(2, 0, 0), std::string(1000, 'c'));
+
+	// Room for two of the blocks
+	Database_Cache db(backend, 2500);
+	std::string data;
+
+	db.loadBlock(v3s16(0, 0, 0), &data);
+	UASSERT(data == std::string(1000, 'a'));
+	db.loadBlock(v3s16(0, 0, 0), &data);
+	UASSERT(data == std::string(1000, 'a'));
+	UASSERTEQ(u64, db.getHits(), 1);
+	UASSERTEQ(u64, db.getMisses(), 1);
+
+	// Missing blocks are not cached
+	db.loadBlock(v3s16(5, 0, 0), &data);
+	UASSERT(data.empty());
+	db.loadBlock(v3s16(5, 0, 0), &data);
+	UASSERTEQ(u64, db.getMisses(), 3);
+
+	// Loading two more blocks evicts the least recently used one
+	db.loadBlock(v3s16(1, 0, 0), &data);
+	db.loadBlock(v3s16(2, 0, 0), &data);
+	UASSERT(data == std::string(1000, 'c'));
+	UASSERT(db.getSize() <= 2500);
+	db.loadBlock(v3s16(0, 0, 0), &data);
+	UASSERTEQ(u64, db.getHits(), 1);
+	UASSERTEQ(u64, db.getMisses(), 6);
+
+	// Saves go to both the backend and the cache
+	UASSERT(db.saveBlock(v3s16(2, 0, 0), "new"));
+	db.loadBlock(v3s16(2, 0, 0), &data);
+	UASSERT(data == "new");
+	UASSERTEQ(u64, db.getHits(), 2);
+	backend->loadBlock(v3s16(2, 0, 0), &data);
+	UASSERT(data == "new");
+
+	// Deleted blocks aren't served from the cache
+	UASSERT(db.deleteBlock(v3s16(2, 0, 0)));
+	db.loadBlock(v3s16(2, 0, 0), &data);
+	UASSERT(data.empty());
+
+	// Blocks larger than the whole cache are passed through
+	UASSERT(db.saveBlock(v3s16(3, 0, 0), std::string(3000, 'd')));
+	db.loadBlock(v3s16(3, 0, 0), &data);
+	UASSERT(data == std::string(3000, 'd'));
+	UASSERT(db.getSize() <= 2500);
+}
+
+#ifndef _WIN32
+
+void TestDatabase::testBlockLogBatches()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "blocklog_batches";
+	fs::RecursiveDelete(dir);
+	Database_BlockLog db(dir);
+	checkBatches(&db);
+}
+
+void TestDatabase::testBlockLog()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + "blocklog";
+	fs::RecursiveDelete(dir);
+
+	// Room for a few blocks per segment
+	std::string old_segment_size = g_settings->get("blocklog_segment_size");
+	g_settings->set("blocklog_segment_size", "4096");
+
+	std::string data;
+	{
+		Database_BlockLog db(dir);
+		db.beginSave();
+		for (s16 i = 0; i < 20; i++)
+			UASSERT(db.saveBlock(v3s16(i, 0, 0), std::string(1000, 'a' + i)));
+		db.endSave();
+		UASSERT(db.deleteBlock(v3s16(1, 0, 0)));
+		UASSERT(db.saveBlock(v3s16(2, 0, 0), "newer"));
+		UASSERT(db.getSegmentCount() > 1);
+	}
+
+	// Everything is recovered from the log
+	std::string last_segment;
+	{
+		Database_BlockLog db(dir);
+		std::vector<v3s16> stored;
+		db.listAllLoadableBlocks(stored);
+		UASSERTEQ(size_t, stored.size(), 19);
+		db.loadBlock(v3s16(1, 0, 0), &data);
+		UASSERT(data.empty());
+		db.loadBlock(v3s16(2, 0, 0), &data);
+		UASSERT(data == "newer");
+		db.loadBlock(v3s16(19, 0, 0), &data);
+		UASSERT(data == std::string(1000, 'a' + 19));
+
+		char name[16];
+		snprintf(name, sizeof(name), "%08u.seg", db.getSegmentCount());
+		last_segment = dir + DIR_DELIM + "map.blocklog" + DIR_DELIM + name;
+	}
+
+	// A record cut off by a crash is dropped, the ones before it are kept
+	{
+		std::ofstream os(last_segment.c_str(),
+			std::ios_base::binary | std::ios_base::app);
+		os << std::string(30, 'x');
+	}
+	{
+		Database_BlockLog db(dir);
+		db.loadBlock(v3s16(2, 0, 0), &data);
+		UASSERT(data == "newer");
+		UASSERT(db.saveBlock(v3s16(100, 0, 0), "after"));
+	}
+	{
+		Database_BlockLog db(dir);
+		db.loadBlock(v3s16(100, 0, 0), &data);
+		UASSERT(data == "after");
+
+		// Overwriting most blocks leaves the old segments mostly unused
+		for (s16 i = 2; i < 18; i++)
+			UASSERT(db.saveBlock(v3s16(i, 0, 0), std::string(1000, 'A' + i)));
+		u32 segments = db.getSegmentCount();
+		UASSERT(db.compact() > 0);
+		UASSERT(db.getSegmentCount() < segments);
+
+		db.loadBlock(v3s16(0, 0, 0), &data);
+		UASSERT(data == std::string(1000, 'a'));
+		db.loadBlock(v3s16(2, 0, 0), &data);
+		UASSERT(data == std::string(1000, 'A' + 2));
+	}
+
+	// Compaction neither lost blocks nor brought deleted ones back
+	{
+		Database_BlockLog db(dir);
+		std::vector<v3s16> stored;
+		db.listAllLoadableBlocks(stored);
+		UASSERTEQ(size_t, stored.size(), 20);
+		db.loadBlock(v3s16(1, 0, 0), &data);
+		UASSERT(data.empty());
+		db.loadBlock(v3s16(0, 0, 0), &data);
+		UASSERT(data == std::string(1000, 'a'));
+		db.loadBlock(v3s16(17, 0, 0), &data);
+		UASSERT(data == std::string(1000, 'A' + 17));
+		db.loadBlock(v3s16(18, 0, 0), &data);
+		UASSERT(data == std::string(1000, 'a' + 18));
+		db.loadBlock(v3s16(100, 0, 0), &data);
+		UASSERT(data == "after");
+	}
+
+	g_settings->set("blocklog_segment_size", old_segment_size);
+}
+
+#endif // _WIN32
+
+// Fails to save one block
+class FailingSaveDatabase : public Database_Dummy
+{
+public:
+	FailingSaveDatabase(const v3s16 &failing_pos) :
+		m_failing_pos(failing_pos)
+	{}
+
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		if (pos == m_failing_pos)
+			return false;
+		return Database_Dummy::saveBlock(pos, data);
+	}
+
+private:
+	v3s16 m_failing_pos;
+};
+
+void TestDatabase::testMigration()
+{
+	std::string checkpoint_path = getTestTempDirectory() + DIR_DELIM
+		+ "migrate.checkpoint";
+	fs::DeleteSingleFileOrEmptyDirectory(checkpoint_path);
+
+	// Several batches, the last one partial
+	Database_Dummy src;
+	std::vector<v3s16> positions;
+	for (s16 i = 0; i < 600; i++) {
+		v3s16 pos(i % 10 - 5, i / 10 - 30, -i % 3);
+		positions.push_back(pos);
+		src.saveBlock(pos, "block " + itos(i));
+	}
+
+	// Interrupted before copying anything
+	bool kill = true;
+	{
+		Database_Dummy dst;
+		MapMigrator migrator(&src, &dst, checkpoint_path, 4);
+		UASSERT(!migrator.run(&kill, NULL));
+		UASSERTEQ(u32, migrator.getCopiedBlocks(), 0);
+	}
+
+	kill = false;
+	{
+		Database_Dummy dst;
+		MapMigrator migrator(&src, &dst, checkpoint_path, 4);
+		UASSERT(migrator.run(&kill, NULL));
+		UASSERTEQ(u32, migrator.getCopiedBlocks(), 600);
+		UASSERTEQ(u32, migrator.getResumedBlocks(), 0);
+		UASSERT(!fs::PathExists(checkpoint_path));
+
+		std::vector<std::string> loaded;
+		dst.loadBlocks(positions, &loaded);
+		for (s16 i = 0; i < 600; i++)
+			UASSERT(loaded[i] == "block " + itos(i));
+	}
+
+	// Resuming skips everything up to the checkpoint
+	std::vector<v3s16> sorted;
+	src.listAllLoadableBlocks(sorted);
+	std::vector<s64> keys;
+	for (size_t i = 0; i < sorted.size(); i++)
+		keys.push_back(Database::getBlockAsInteger(sorted[i]));
+	std::sort(keys.begin(), keys.end());
+	std::ostringstream os;
+	os << "last_block = " << (u64)keys[299] << std::endl;
+	UASSERT(fs::safeWriteToFile(checkpoint_path, os.str()));
+	{
+		Database_Dummy dst;
+		MapMigrator migrator(&src, &dst, checkpoint_path, 4);
+		UASSERT(migrator.run(&kill, NULL));
+		UASSERTEQ(u32, migrator.getCopiedBlocks(), 300);
+		UASSERTEQ(u32, migrator.getResumedBlocks(), 300);
+
+		std::vector<v3s16> copied;
+		dst.listAllLoadableBlocks(copied);
+		UASSERTEQ(size_t, copied.size(), 300);
+		for (size_t i = 0; i < copied.size(); i++)
+			UASSERT(Database::getBlockAsInteger(copied[i]) > keys[299]);
+	}
+	UASSERT(!fs::PathExists(checkpoint_path));
+
+	// A failed save stops the migration before the batch that failed,
+	// the second one of 256 blocks
+	{
+		FailingSaveDatabase dst(Database::getIntegerAsBlock(keys[300]));
+		MapMigrator migrator(&src, &dst, checkpoint_path, 4);
+		UASSERT(!migrator.run(&kill, NULL));
+		UASSERTEQ(u32, migrator.getCopiedBlocks(), 256);
+		UASSERTEQ(u32, migrator.getFailedSaves(), 256);
+
+		Settings checkpoint;
+		UASSERT(checkpoint.readConfigFile(checkpoint_path.c_str()));
+		UASSERT((s64)checkpoint.getU64("last_block") == keys[255]);
+	}
+	{
+		Database_Dummy dst;
+		MapMigrator migrator(&src, &dst, checkpoint_path, 4);
+		UASSERT(migrator.run(&kill, NULL));
+		UASSERTEQ(u32, migrator.getCopiedBlocks(), 344);
+		UASSERTEQ(u32, migrator.getResumedBlocks(), 256);
+	}
+	UASSERT(!fs::PathExists(checkpoint_path));
+}
+
+#if USE_REDIS
+
+// Runs a command on the test hash outside of Database_Redis
+static void redis_command(const char *command, const std::string &hash)
+{
+	redisContext *ctx = redisConnect("127.0.0.1", 6379);
+	UASSERT(ctx && !ctx->err);
+	redisReply *reply = static_cast<redisReply *>(
+		redisCommand(ctx, command, hash.c_str()));
+	UASSERT(reply && reply->type != REDIS_REPLY_ERROR);
+	freeReplyObject(reply);
+	redisFree(ctx);
+}
+
+void TestDatabase::testRedis()
+{
+	// Needs a server on the default port
+	Settings conf;
+	conf.set("redis_address", "127.0.0.1");
+	conf.set("redis_hash", "minetest_unittest");
+	Database_Redis *db;
+	try {
+		db = new Database_Redis(conf);
+	} catch (DatabaseException &e) {
+		warningstream << "testRedis: skipped, no redis server: "
+			<< e.what() << std::endl;
+		return;
+	}
+	const std::string hash = "minetest_unittest";
+	redis_command("DEL %s", hash);
+
+	checkBatches(db);
+
+	// HSET on a key that is not a hash fails with WRONGTYPE
+	std::vector<v3s16> positions;
+	std::vector<std::string> blocks;
+	positions.push_back(v3s16(1, 2, 3));
+	blocks.push_back("lost block");
+	redis_command("DEL %s", hash);
+	redis_command("SET %s not_a_hash", hash);
+
+	UASSERT(!db->saveBlock(positions[0], blocks[0]));
+	UASSERT(!db->saveBlocks(positions, blocks));
+
+	// Within a transaction, EXEC tells about the failure
+	db->beginSave();
+	UASSERT(db->saveBlocks(positions, blocks));
+	EXCEPTION_CHECK(DatabaseException, db->endSave());
+
+	// The connection is still in sync afterwards
+	redis_command("DEL %s", hash);
+	db->beginSave();
+	UASSERT(db->saveBlock(positions[0], "saved block"));
+	db->endSave();
+	std::string data;
+	db->loadBlock(positions[0], &data);
+	UASSERT(data == "saved block");
+
+	// The cache drops the blocks of a failed transaction
+	Database_Cache cache(db, 1024 * 1024);
+	redis_command("DEL %s", hash);
+	redis_command("SET %s not_a_hash", hash);
+	cache.beginSave();
+	UASSERT(cache.saveBlocks(positions, blocks));
+	EXCEPTION_CHECK(DatabaseException, cache.endSave());
+	redis_command("DEL %s", hash);
+	cache.loadBlock(positions[0], &data);
+	UASSERT(data.empty());
+}
+
+#endif // USE_REDIS
+
+#if USE_POSTGRESQL
+
+// Runs a statement outside of Database_PostgreSQL
+static void pgsql_exec(const std::string &connect_string, const char *sql)
+{
+	PGconn *conn = PQconnectdb(connect_string.c_str());
+	PQclear(PQexec(conn, sql));
+	PQfinish(conn);
+}
+
+void TestDatabase::testPostgreSQL()
+{
+	// Needs a server, given in the form of pgsql_connection in world.mt.
+	// The blocks table of that database is cleared.
+	const char *connect_string = getenv("MINETEST_TEST_PGSQL_CONNECTION");
+	if (!connect_string) {
+		warningstream << "testPostgreSQL: skipped, "
+			"MINETEST_TEST_PGSQL_CONNECTION is not set" << std::endl;
+		return;
+	}
+	Settings conf;
+	conf.set("pgsql_connection", connect_string);
+	Database_PostgreSQL *db = new Database_PostgreSQL(conf);
+	pgsql_exec(connect_string, "DELETE FROM blocks");
+
+	checkBatches(db);
+
+	// A read within a transaction ends the COPY, the saves after it
+	// still win
+	v3s16 pos(1, 2, 3);
+	std::string data;
+	std::vector<v3s16> positions;
+	std::vector<std::string> blocks;
+	for (u32 i = 0; i < 3; i++) {
+		positions.push_back(pos);
+		blocks.push_back("block " + itos(i));
+	}
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, "first block"));
+	db->loadBlock(pos, &data);
+	UASSERT(data == "first block");
+	UASSERT(db->saveBlocks(positions, blocks));
+	db->endSave();
+	db->loadBlock(pos, &data);
+	UASSERT(data == "block 2");
+
+	// Duplicates outside of a transaction, over more than one batch
+	positions.clear();
+	blocks.clear();
+	for (u32 i = 0; i < 200; i++) {
+		positions.push_back(v3s16(i % 50, 10, 0));
+		blocks.push_back("block " + itos(i));
+	}
+	UASSERT(db->saveBlocks(positions, blocks));
+	std::vector<std::string> loaded;
+	db->loadBlocks(positions, &loaded);
+	for (u32 i = 0; i < 200; i++)
+		UASSERT(loaded[i] == "block " + itos(150 + i % 50));
+
+	// A transaction that is interrupted is rolled back
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, "uncommitted block"));
+	delete db;
+	db = new Database_PostgreSQL(conf);
+	db->loadBlock(pos, &data);
+	UASSERT(data == "block 2");
+
+	// Losing the connection fails the commit, the next transaction
+	// reconnects
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, "lost block"));
+	pgsql_exec(connect_string, "SELECT pg_terminate_backend(pid) "
+		"FROM pg_stat_activity WHERE datname = current_database() "
+		"AND pid <> pg_backend_pid()");
+	EXCEPTION_CHECK(DatabaseException, db->endSave());
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, "saved block"));
+	db->endSave();
+	db->loadBlock(pos, &data);
+	UASSERT(data == "saved block");
+
+	// A failed upsert aborts the transaction, which must not look
+	// committed, even if the failure was seen by an earlier read
+	pgsql_exec(connect_string, "ALTER TABLE blocks "
+		"ADD CONSTRAINT unittest_check CHECK (posY <> 99)");
+	db->beginSave();
+	UASSERT(db->saveBlock(v3s16(0, 99, 0), "rejected block"));
+	UASSERT(db->saveBlock(pos, "rolled back block"));
+	EXCEPTION_CHECK(DatabaseException, db->endSave());
+	db->beginSave();
+	UASSERT(db->saveBlock(v3s16(0, 99, 0), "rejected block"));
+	EXCEPTION_CHECK(DatabaseException, db->loadBlock(pos, &data));
+	EXCEPTION_CHECK(DatabaseException, db->endSave());
+	pgsql_exec(connect_string, "ALTER TABLE blocks "
+		"DROP CONSTRAINT unittest_check");
+	db->loadBlock(pos, &data);
+	UASSERT(data == "saved block");
+
+	db->beginSave();
+	UASSERT(db->saveBlock(pos, "new block"));
+	db->endSave();
+	db->loadBlock(pos, &data);
+	UASSERT(data == "new block");
+
+	std::vector<v3s16> stored;
+	db->listAllLoadableBlocks(stored);
+	UASSERTEQ(size_t, stored.size(), 150 + 1 + 50);
+	UASSERT(std::find(stored.begin(), stored.end(), pos) != stored.end());
+	delete db;
+}
+
+#endif // USE_POSTGRESQL
+
+void TestDatabase::checkBatches(Database *db)
+{
+	// More than one full batch of every backend, plus a partial one
+	std::vector<v3s16> positions;
+	std::vector<std::string> blocks;
+	for (s16 i = 0; i < 150; i++) {
+		positions.push_back(v3s16(i, -i, i % 7));
+		blocks.push_back("block " + itos(i));
+	}
+
+	// The last save of a position wins
+	positions.push_back(v3s16(3, -3, 3));
+	blocks.push_back("newer block 3");
+
+	db->beginSave();
+	UASSERT(db->saveBlocks(positions, blocks));
+	db->endSave();
+
+	std::vector<v3s16> stored;
+	db->listAllLoadableBlocks(stored);
+	UASSERTEQ(size_t, stored.size(), 150);
+
+	// Load in a different order, with a missing block in between
+	std::vector<v3s16> wanted;
+	for (s16 i = 149; i >= 0; i--)
+		wanted.push_back(v3s16(i, -i, i % 7));
+	wanted.push_back(v3s16(1000, 0, 0));
+	wanted.push_back(v3s16(0, 0, 0));
+
+	std::vector<std::string> loaded;
+	db->loadBlocks(wanted, &loaded);
+	UASSERTEQ(size_t, loaded.size(), wanted.size());
+	for (s16 i = 0; i < 150; i++) {
+		const std::string &data = loaded[149 - i];
+		UASSERT(data == (i == 3 ? "newer block 3" : "block " + itos(i)));
+	}
+	UASSERT(loaded[150].empty());
+	UASSERT(loaded[151] == "block 0");
+
+	// The single block interface sees the same data
+	std::string data;
+	db->loadBlock(v3s16(3, -3, 3), &data);
+	UASSERT(data == "newer block 3");
+}
@@ -0,0 +1,193 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "test.h"
+
+#include <sstream>
+#include "mapblock.h"
+#include "noise.h"
+#include "voxel.h"
+
+class TestMapBlock : public TestBase {
+public:
+	TestMapBlock() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlock"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testCompactUniform(IGameDef *gamedef);
+	void testCompactPalette(IGameDef *gamedef);
+	void testCompactTooManyNodes(IGameDef *gamedef);
+	void testNetworkCache(IGameDef *gamedef);
+};
+
+static TestMapBlock g_test_instance;
+
+void TestMapBlock::runTests(IGameDef *gamedef)
+{
+	TEST(testCompactUniform, gamedef);
+	TEST(testCompactPalette, gamedef);
+	TEST(testCompactTooManyNodes, gamedef);
+	TEST(testNetworkCache, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool same_nodes(MapBlock *a, MapBlock *b)
+{
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		MapNode n1 = a->getNodeNoEx(p);
+		MapNode n2 = b->getNodeNoEx(p);
+		if (n1.param0 != n2.param0 || n1.param1 != n2.param1 ||
+				n1.param2 != n2.param2)
+			return false;
+	}
+	return true;
+}
+
+static std::string serialize_network(MapBlock *block)
+{
+	std::ostringstream os(std::ios_base::binary);
+	block->serialize(os, SER_FMT_VER_HIGHEST_WRITE, false);
+	return os.str();
+}
+
+void TestMapBlock::testCompactUniform(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	MapNode stone(t_CONTENT_STONE);
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+		block.setNode(p, stone);
+	std::string expected = serialize_network(&block);
+
+	UASSERT(block.compactNodes());
+	UASSERT(block.isCompact());
+	UASSERT(!block.isDummy());
+	UASSERT(block.getNodeDataSize() == sizeof(MapNode));
+	UASSERT(block.getNodeNoEx(v3s16(3, 4, 5)).getContent() == t_CONTENT_STONE);
+	UASSERT(serialize_network(&block) == expected);
+
+	// Writing expands the block again
+	MapNode air(CONTENT_AIR);
+	block.setNode(v3s16(1, 2, 3), air);
+	UASSERT(!block.isCompact());
+	UASSERT(block.getNodeNoEx(v3s16(1, 2, 3)).getContent() == CONTENT_AIR);
+	UASSERT(block.getNodeNoEx(v3s16(3, 2, 1)).getContent() == t_CONTENT_STONE);
+}
+
+void TestMapBlock::testCompactPalette(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	MapBlock reference(NULL, v3s16(0, 0, 0), gamedef);
+	PseudoRandom pr(1234);
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		MapNode n(pr.range(0, 1) ? t_CONTENT_STONE : CONTENT_AIR,
+			pr.range(0, 2), pr.range(0, 1));
+		block.setNode(p, n);
+		reference.setNode(p, n);
+	}
+	std::string expected = serialize_network(&block);
+
+	UASSERT(block.compactNodes());
+	UASSERT(block.getNodeDataSize() < reference.getNodeDataSize());
+	UASSERT(same_nodes(&block, &reference));
+	UASSERT(serialize_network(&block) == expected);
+
+	// Reading into a VoxelManipulator unpacks the nodes
+	VoxelArea area(v3s16(0, 0, 0), v3s16(MAP_BLOCKSIZE - 1,
+		MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1));
+	VoxelManipulator vm1, vm2;
+	vm1.addArea(area);
+	vm2.addArea(area);
+	block.copyTo(vm1);
+	reference.copyTo(vm2);
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		MapNode n1 = vm1.getNodeNoEx(p);
+		MapNode n2 = vm2.getNodeNoEx(p);
+		UASSERT(n1.param0 == n2.param0 && n1.param1 == n2.param1 &&
+			n1.param2 == n2.param2);
+	}
+
+	MapNode air(CONTENT_AIR);
+	block.setNode(v3s16(15, 15, 15), air);
+	reference.setNode(v3s16(15, 15, 15), air);
+	UASSERT(!block.isCompact());
+	UASSERT(same_nodes(&block, &reference));
+}
+
+void TestMapBlock::testCompactTooManyNodes(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	v3s16 p;
+	u32 i = 0;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		MapNode n(CONTENT_AIR, i & 0xFF, (i >> 8) & 0xFF);
+		block.setNode(p, n);
+		i++;
+	}
+
+	UASSERT(!block.compactNodes());
+	UASSERT(!block.isCompact());
+	UASSERT(block.getNodeDataSize() == MapBlock::nodecount * sizeof(MapNode));
+}
+
+void TestMapBlock::testNetworkCache(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(1, 2, 3), gamedef);
+	v3s16 p;
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+		MapNode n((p.X + p.Y) % 3 == 0 ? t_CONTENT_STONE : CONTENT_AIR,
+			p.Z, p.X);
+		block.setNode(p, n);
+	}
+	u8 version = SER_FMT_VER_HIGHEST_READ;
+	u32 uncached_size = block.getMemoryUsage();
+
+	std::ostringstream os(std::ios_base::binary);
+	block.serialize(os, version, false);
+	UASSERT(block.getNetworkSerialization(version) == os.str());
+	// The cached data counts as used memory
+	UASSERT(block.getMemoryUsage() >= uncached_size + os.str().size());
+
+	// Modifying the block has to drop the cached data
+	MapNode n(CONTENT_AIR);
+	block.setNode(v3s16(0, 0, 0), n);
+	UASSERTEQ(u32, block.getMemoryUsage(), uncached_size);
+	std::ostringstream os2(std::ios_base::binary);
+	block.serialize(os2, version, false);
+	UASSERT(os2.str() != os.str());
+	UASSERT(block.getNetworkSerialization(version) == os2.str());
+}
@@ -0,0 +1,132 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include "mapblockindex.h"
+
+class TestMapBlockIndex : public TestBase {
+public:
+	TestMapBlockIndex() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlockIndex"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testInsertRemove();
+	void testMany();
+	void testGeneration();
+};
+
+static TestMapBlockIndex g_test_instance;
+
+void TestMapBlockIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testInsertRemove);
+	TEST(testMany);
+	TEST(testGeneration);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The index never dereferences the blocks
+static MapBlock *fake_block(uintptr_t i)
+{
+	return reinterpret_cast<MapBlock *>(i * 16);
+}
+
+void TestMapBlockIndex::testInsertRemove()
+{
+	MapBlockIndex index;
+
+	UASSERT(index.get(v3s16(0, 0, 0)) == NULL);
+	UASSERT(index.insert(v3s16(0, 0, 0), fake_block(1)));
+	UASSERT(index.insert(v3s16(-1, 2, -3), fake_block(2)));
+	UASSERT(index.insert(v3s16(-2048, 2047, -2048), fake_block(3)));
+	UASSERTEQ(u32, index.size(), 3);
+
+	// Existing entries are not replaced
+	UASSERT(!index.insert(v3s16(0, 0, 0), fake_block(4)));
+	UASSERT(index.get(v3s16(0, 0, 0)) == fake_block(1));
+	UASSERT(index.get(v3s16(-1, 2, -3)) == fake_block(2));
+	UASSERT(index.get(v3s16(-2048, 2047, -2048)) == fake_block(3));
+	UASSERT(index.get(v3s16(1, 2, -3)) == NULL);
+
+	UASSERT(index.remove(v3s16(-1, 2, -3)));
+	UASSERT(!index.remove(v3s16(-1, 2, -3)));
+	UASSERT(index.get(v3s16(-1, 2, -3)) == NULL);
+	UASSERTEQ(u32, index.size(), 2);
+
+	index.clear();
+	UASSERTEQ(u32, index.size(), 0);
+	UASSERT(index.get(v3s16(0, 0, 0)) == NULL);
+}
+
+void TestMapBlockIndex::testMany()
+{
+	MapBlockIndex index;
+	uintptr_t n = 0;
+
+	// Enough entries to grow several times and to form long clusters
+	v3s16 p;
+	for (p.X = -10; p.X < 10; p.X++)
+	for (p.Y = -5; p.Y < 5; p.Y++)
+	for (p.Z = -10; p.Z < 10; p.Z++)
+		UASSERT(index.insert(p, fake_block(++n)));
+	UASSERTEQ(u32, index.size(), 4000);
+
+	// Remove every other entry, the rest has to stay reachable
+	n = 0;
+	for (p.X = -10; p.X < 10; p.X++)
+	for (p.Y = -5; p.Y < 5; p.Y++)
+	for (p.Z = -10; p.Z < 10; p.Z++) {
+		if (++n % 2 == 0)
+			UASSERT(index.remove(p));
+	}
+	UASSERTEQ(u32, index.size(), 2000);
+
+	n = 0;
+	for (p.X = -10; p.X < 10; p.X++)
+	for (p.Y = -5; p.Y < 5; p.Y++)
+	for (p.Z = -10; p.Z < 10; p.Z++) {
+		MapBlock *block = index.get(p);
+		if (++n % 2 == 0)
+			UASSERT(block == NULL);
+		else
+			UASSERT(block == fake_block(n));
+	}
+}
+
+void TestMapBlockIndex::testGeneration()
+{
+	MapBlockIndex index1;
+	MapBlockIndex index2;
+	UASSERT(index1.getGeneration() != index2.getGeneration());
+
+	u32 generation = index1.getGeneration();
+	index1.insert(v3s16(1, 1, 1), fake_block(1));
+	UASSERTEQ(u32, index1.getGeneration(), generation);
+
+	// Failed removals keep cached pointers valid
+	index1.remove(v3s16(2, 2, 2));
+	UASSERTEQ(u32, index1.getGeneration(), generation);
+
+	index1.remove(v3s16(1, 1, 1));
+	UASSERT(index1.getGeneration() != generation);
+}
@@ -0,0 +1,132 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include "mapblock.h"
+#include "mapblocklru.h"
+
+class TestMapBlockLRU : public TestBase {
+public:
+	TestMapBlockLRU() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapBlockLRU"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testOrder(IGameDef *gamedef);
+	void testUnusedTime(IGameDef *gamedef);
+	void testMemoryUsage(IGameDef *gamedef);
+};
+
+static TestMapBlockLRU g_test_instance;
+
+void TestMapBlockLRU::runTests(IGameDef *gamedef)
+{
+	TEST(testOrder, gamedef);
+	TEST(testUnusedTime, gamedef);
+	TEST(testMemoryUsage, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapBlockLRU::testOrder(IGameDef *gamedef)
+{
+	MapBlock a(NULL, v3s16(0, 0, 0), gamedef);
+	MapBlock b(NULL, v3s16(1, 0, 0), gamedef);
+	MapBlock c(NULL, v3s16(2, 0, 0), gamedef);
+	MapBlockLRU lru;
+
+	UASSERT(lru.getLeastRecentlyUsed() == NULL);
+	UASSERT(!MapBlockLRU::contains(&a));
+
+	lru.insert(&a);
+	lru.insert(&b);
+	lru.insert(&c);
+	UASSERTEQ(u32, lru.size(), 3);
+	UASSERT(MapBlockLRU::contains(&a));
+	UASSERT(lru.getLeastRecentlyUsed() == &a);
+	UASSERT(MapBlockLRU::getNewer(&a) == &b);
+	UASSERT(MapBlockLRU::getNewer(&b) == &c);
+	UASSERT(MapBlockLRU::getNewer(&c) == NULL);
+
+	lru.touch(&a);
+	UASSERT(lru.getLeastRecentlyUsed() == &b);
+	UASSERT(MapBlockLRU::getNewer(&c) == &a);
+
+	lru.remove(&c);
+	UASSERT(!MapBlockLRU::contains(&c));
+	UASSERTEQ(u32, lru.size(), 2);
+	UASSERT(MapBlockLRU::getNewer(&b) == &a);
+
+	// Unlisted blocks are left alone
+	lru.touch(&c);
+	lru.remove(&c);
+	UASSERTEQ(u32, lru.size(), 2);
+
+	lru.remove(&a);
+	lru.remove(&b);
+	UASSERT(lru.getLeastRecentlyUsed() == NULL);
+	UASSERTEQ(u32, lru.size(), 0);
+}
+
+void TestMapBlockLRU::testUnusedTime(IGameDef *gamedef)
+{
+	MapBlock a(NULL, v3s16(0, 0, 0), gamedef);
+	MapBlock b(NULL, v3s16(1, 0, 0), gamedef);
+	MapBlockLRU lru;
+
+	lru.insert(&a);
+	lru.step(2.0);
+	lru.insert(&b);
+	lru.step(1.0);
+	UASSERT(lru.getUnusedTime(&a) == 3.0);
+	UASSERT(lru.getUnusedTime(&b) == 1.0);
+
+	lru.touch(&a);
+	UASSERT(lru.getUnusedTime(&a) == 0.0);
+	UASSERT(lru.getLeastRecentlyUsed() == &b);
+
+	lru.remove(&a);
+	lru.remove(&b);
+}
+
+void TestMapBlockLRU::testMemoryUsage(IGameDef *gamedef)
+{
+	MapBlock a(NULL, v3s16(0, 0, 0), gamedef);
+	MapBlock b(NULL, v3s16(1, 0, 0), gamedef);
+	MapBlockLRU lru;
+
+	lru.insert(&a);
+	lru.insert(&b);
+	u32 full_size = a.getMemoryUsage();
+	UASSERTEQ(u64, lru.getMemoryUsage(), 2 * full_size);
+
+	// All nodes are CONTENT_IGNORE, so the block compacts to one node
+	UASSERT(a.compactNodes());
+	UASSERTEQ(u64, lru.getMemoryUsage(), 2 * full_size);
+	lru.updateMemoryUsage(&a);
+	UASSERT(a.getMemoryUsage() < full_size);
+	UASSERT(lru.getMemoryUsage() == a.getMemoryUsage() + full_size);
+
+	lru.remove(&b);
+	UASSERT(lru.getMemoryUsage() == a.getMemoryUsage());
+	lru.remove(&a);
+	UASSERTEQ(u64, lru.getMemoryUsage(), 0);
+}
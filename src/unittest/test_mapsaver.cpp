@@ -0,0 +1,242 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <sstream>
+#include "database-dummy.h"
+#include "mapblock.h"
+#include "mapsaver.h"
+#include "serialization.h"
+
+class TestMapSaver : public TestBase {
+public:
+	TestMapSaver() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapSaver"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testSnapshot(IGameDef *gamedef);
+	void testCompression(IGameDef *gamedef);
+	void testSave(IGameDef *gamedef);
+	void testBackpressure(IGameDef *gamedef);
+	void testFailedSave(IGameDef *gamedef);
+};
+
+static TestMapSaver g_test_instance;
+
+void TestMapSaver::runTests(IGameDef *gamedef)
+{
+	TEST(testSnapshot, gamedef);
+	TEST(testCompression, gamedef);
+	TEST(testSave, gamedef);
+	TEST(testBackpressure, gamedef);
+	TEST(testFailedSave, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Refuses to save blocks at negative Y
+class FailingDatabase : public Database_Dummy
+{
+public:
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		return pos.Y >= 0 && Database_Dummy::saveBlock(pos, data);
+	}
+};
+
+// Fails to commit every transaction
+class FailingCommitDatabase : public Database_Dummy
+{
+public:
+	void endSave()
+	{
+		throw DatabaseException("commit failed");
+	}
+};
+
+static void fill(MapBlock *block, u32 seed)
+{
+	v3s16 p;
+	for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+	for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+	for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++) {
+		MapNode n((p.X + p.Y + seed) % 3 == 0 ?
+			t_CONTENT_STONE : CONTENT_AIR, p.Z, seed);
+		block->setNode(p, n);
+	}
+}
+
+static std::string serialize_disk(MapBlock *block)
+{
+	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+	std::ostringstream os(std::ios_base::binary);
+	os.write((char *)&version, 1);
+	block->serialize(os, version, true);
+	return os.str();
+}
+
+void TestMapSaver::testSnapshot(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(1, 2, 3), gamedef);
+	fill(&block, 1);
+	std::string expected = serialize_disk(&block);
+
+	MapBlockSnapshot snapshot;
+	block.takeSnapshot(&snapshot, SER_FMT_VER_HIGHEST_WRITE);
+	UASSERT(snapshot.pos == v3s16(1, 2, 3));
+
+	// Later changes of the block don't show up in the snapshot
+	fill(&block, 2);
+
+	std::ostringstream os(std::ios_base::binary);
+	os.write((char *)&snapshot.version, 1);
+	MapBlock::serializeSnapshot(os, snapshot);
+	UASSERT(os.str() == expected);
+}
+
+void TestMapSaver::testCompression(IGameDef *gamedef)
+{
+	MapBlock block(NULL, v3s16(1, 2, 3), gamedef);
+	fill(&block, 1);
+
+	for (u8 compression = MAP_COMPRESSION_ZLIB;
+			compression <= MAP_COMPRESSION_LZ4; compression++) {
+		u8 version = ser_ver_for_map_compression(compression);
+		std::ostringstream os(std::ios_base::binary);
+		block.serialize(os, version, true, compression);
+
+		// Snapshots give the same result
+		MapBlockSnapshot snapshot;
+		block.takeSnapshot(&snapshot, version, compression);
+		std::ostringstream os2(std::ios_base::binary);
+		MapBlock::serializeSnapshot(os2, snapshot);
+		UASSERT(os2.str() == os.str());
+
+		MapBlock block2(NULL, v3s16(1, 2, 3), gamedef);
+		std::istringstream is(os.str(), std::ios_base::binary);
+		block2.deSerialize(is, version, true);
+		v3s16 p;
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++) {
+			MapNode n1 = block.getNodeNoEx(p);
+			MapNode n2 = block2.getNodeNoEx(p);
+			UASSERT(n1.getContent() == n2.getContent());
+			UASSERT(n1.param1 == n2.param1 && n1.param2 == n2.param2);
+		}
+	}
+}
+
+void TestMapSaver::testSave(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	Mutex db_mutex;
+	MapBlock *blocks[20];
+	std::string expected[20];
+
+	{
+		MapSaver saver(&db, db_mutex, 3, 64);
+		for (u32 i = 0; i < 20; i++) {
+			blocks[i] = new MapBlock(NULL, v3s16(i, -1, 0), gamedef);
+			fill(blocks[i], i);
+			saver.queueBlock(blocks[i]);
+		}
+
+		// Queue newer versions of some blocks, they have to win
+		for (u32 i = 0; i < 20; i += 4) {
+			fill(blocks[i], i + 1);
+			saver.queueBlock(blocks[i]);
+		}
+
+		for (u32 i = 0; i < 20; i++)
+			expected[i] = serialize_disk(blocks[i]);
+
+		saver.waitForBlock(v3s16(0, -1, 0));
+		std::string data;
+		db.loadBlock(v3s16(0, -1, 0), &data);
+		UASSERT(data == expected[0]);
+
+		// The destructor writes the rest
+	}
+
+	for (u32 i = 0; i < 20; i++) {
+		std::string data;
+		db.loadBlock(v3s16(i, -1, 0), &data);
+		UASSERT(data == expected[i]);
+		delete blocks[i];
+	}
+}
+
+void TestMapSaver::testBackpressure(IGameDef *gamedef)
+{
+	Database_Dummy db;
+	Mutex db_mutex;
+	MapBlock block(NULL, v3s16(0, 0, 0), gamedef);
+	fill(&block, 0);
+
+	// Far more blocks than the queue holds
+	MapSaver saver(&db, db_mutex, 1, 2);
+	for (u32 i = 0; i < 50; i++)
+		saver.queueBlock(&block);
+	saver.flush();
+
+	std::vector<v3s16> stored;
+	db.listAllLoadableBlocks(stored);
+	UASSERTEQ(size_t, stored.size(), 1);
+}
+
+void TestMapSaver::testFailedSave(IGameDef *gamedef)
+{
+	FailingDatabase db;
+	Mutex db_mutex;
+	MapBlock good(NULL, v3s16(0, 0, 0), gamedef);
+	MapBlock bad(NULL, v3s16(0, -1, 0), gamedef);
+	fill(&good, 0);
+	fill(&bad, 1);
+
+	MapSaver saver(&db, db_mutex, 1, 64);
+	saver.queueBlock(&good);
+	saver.flush();
+	std::vector<v3s16> failed;
+	saver.takeFailedBlocks(failed);
+	UASSERT(failed.empty());
+
+	saver.queueBlock(&bad);
+	saver.flush();
+	saver.takeFailedBlocks(failed);
+	UASSERTEQ(size_t, failed.size(), 1);
+	UASSERT(failed[0] == v3s16(0, -1, 0));
+
+	// Each failure is reported once
+	failed.clear();
+	saver.takeFailedBlocks(failed);
+	UASSERT(failed.empty());
+
+	// Commit failures count too
+	FailingCommitDatabase commit_db;
+	MapSaver commit_saver(&commit_db, db_mutex, 1, 64);
+	commit_saver.queueBlock(&good);
+	commit_saver.flush();
+	commit_saver.takeFailedBlocks(failed);
+	UASSERTEQ(size_t, failed.size(), 1);
+	UASSERT(failed[0] == v3s16(0, 0, 0));
+}
@@ -0,0 +1,197 @@
+/*
+Minetest
+Copyright (C) 2010-2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <sstream>
+#include "objectposition.h"
+#include "genericobject.h"
+#include "util/serialize.h"
+
+class TestObjectPosition : public TestBase {
+public:
+	TestObjectPosition() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestObjectPosition"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testParse();
+	void testDeltas();
+	void testLostKeyframe();
+	void testFarMove();
+};
+
+static TestObjectPosition g_test_instance;
+
+void TestObjectPosition::runTests(IGameDef *gamedef)
+{
+	TEST(testParse);
+	TEST(testDeltas);
+	TEST(testLostKeyframe);
+	TEST(testFarMove);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static ObjectPosition make_position(v3f p, v3f v, f32 yaw)
+{
+	ObjectPosition pos;
+	pos.parse(gob_cmd_update_position(p, v, v3f(0, -10 * BS, 0), yaw,
+		true, false, 0.2));
+	return pos;
+}
+
+void TestObjectPosition::testParse()
+{
+	ObjectPosition pos;
+	UASSERT(!pos.parse(gob_cmd_punched(1, 2)));
+	UASSERT(!pos.parse(""));
+
+	std::string msg = gob_cmd_update_position(v3f(12.34 * BS, -5 * BS, 0),
+		v3f(1 * BS, 0, 0), v3f(0, -10 * BS, 0), -90, false, true, 0.25);
+	UASSERT(pos.parse(msg));
+	UASSERT(pos.position == v3s32(1234, -500, 0));
+	UASSERT(pos.velocity == v3s16(100, 0, 0));
+	UASSERT(!pos.do_interpolate);
+	UASSERT(pos.is_movement_end);
+	UASSERTEQ(u16, pos.update_interval, 250);
+
+	// Back to the message, within the precision of the quantization
+	std::istringstream is(pos.toMessage(), std::ios::binary);
+	UASSERTEQ(u8, readU8(is), GENERIC_CMD_UPDATE_POSITION);
+	v3f p = readV3F1000(is);
+	UASSERT(p.getDistanceFrom(v3f(12.34 * BS, -5 * BS, 0)) < 0.01 * BS);
+	readV3F1000(is);
+	readV3F1000(is);
+	f32 yaw = readF1000(is);
+	UASSERT(yaw > 269.9 && yaw < 270.1);
+	UASSERTEQ(u8, readU8(is), 0);
+	UASSERTEQ(u8, readU8(is), 1);
+
+	ObjectPosition again;
+	UASSERT(again.parse(pos.toMessage()));
+	UASSERT(again == pos);
+}
+
+void TestObjectPosition::testDeltas()
+{
+	ObjectPositionEncoder encoder;
+	ObjectPositionDecoder decoder;
+	std::string reliable, unreliable;
+
+	ObjectPosition pos = make_position(v3f(100 * BS, 0, 0), v3f(BS, 0, 0), 0);
+	encoder.encode(1, pos, false, reliable, unreliable);
+	UASSERT(!reliable.empty());
+	UASSERT(unreliable.empty());
+
+	ObjectPosition moved = make_position(v3f(101 * BS, 0, 0), v3f(BS, 0, 0), 0);
+	encoder.encode(1, moved, false, reliable, unreliable);
+	size_t keyframe_size = reliable.size();
+	// Only the position delta is sent
+	UASSERTEQ(size_t, unreliable.size(), 4 + 6);
+	UASSERT(unreliable.size() < keyframe_size);
+
+	std::istringstream ris(reliable, std::ios::binary);
+	std::istringstream uis(unreliable, std::ios::binary);
+	u16 id;
+	ObjectPosition decoded;
+	UASSERT(decoder.decode(ris, id, decoded));
+	UASSERTEQ(u16, id, 1);
+	UASSERT(decoded == pos);
+	UASSERT(decoder.decode(uis, id, decoded));
+	UASSERT(decoded == moved);
+
+	// Anything the client didn't get doesn't matter for the next update
+	reliable.clear();
+	unreliable.clear();
+	ObjectPosition turned = make_position(v3f(102 * BS, 0, 0), v3f(0, 0, 0), 45);
+	encoder.encode(1, turned, false, reliable, unreliable);
+	UASSERT(reliable.empty());
+	std::istringstream uis2(unreliable, std::ios::binary);
+	UASSERT(decoder.decode(uis2, id, decoded));
+	UASSERT(decoded == turned);
+
+	// Reliable updates become keyframes
+	reliable.clear();
+	unreliable.clear();
+	encoder.encode(1, turned, true, reliable, unreliable);
+	UASSERT(!reliable.empty());
+	UASSERT(unreliable.empty());
+	UASSERTEQ(u32, encoder.getKeyframeCount(), 1);
+	encoder.forget(1);
+	UASSERTEQ(u32, encoder.getKeyframeCount(), 0);
+}
+
+void TestObjectPosition::testLostKeyframe()
+{
+	ObjectPositionEncoder encoder;
+	ObjectPositionDecoder decoder;
+	std::string reliable, unreliable;
+
+	ObjectPosition pos = make_position(v3f(0, 0, 0), v3f(0, 0, 0), 0);
+	encoder.encode(7, pos, false, reliable, unreliable);
+	pos = make_position(v3f(BS, 0, 0), v3f(0, 0, 0), 0);
+	encoder.encode(7, pos, false, reliable, unreliable);
+	pos = make_position(v3f(2 * BS, 0, 0), v3f(0, 0, 0), 0);
+	encoder.encode(7, pos, false, reliable, unreliable);
+
+	// The deltas arrive before the keyframe and are ignored
+	std::istringstream uis(unreliable, std::ios::binary);
+	u16 id;
+	ObjectPosition decoded;
+	UASSERT(!decoder.decode(uis, id, decoded));
+	UASSERT(!decoder.decode(uis, id, decoded));
+	UASSERT(uis.peek() == EOF);
+
+	std::istringstream ris(reliable, std::ios::binary);
+	UASSERT(decoder.decode(ris, id, decoded));
+	UASSERT(decoded.position == v3s32(0, 0, 0));
+
+	// Truncated data
+	std::istringstream tis(reliable.substr(0, 6), std::ios::binary);
+	EXCEPTION_CHECK(SerializationError, decoder.decode(tis, id, decoded));
+}
+
+void TestObjectPosition::testFarMove()
+{
+	ObjectPositionEncoder encoder;
+	ObjectPositionDecoder decoder;
+	std::string reliable, unreliable;
+
+	ObjectPosition pos = make_position(v3f(0, 0, 0), v3f(0, 0, 0), 0);
+	encoder.encode(3, pos, false, reliable, unreliable);
+	std::istringstream ris(reliable, std::ios::binary);
+	u16 id;
+	ObjectPosition decoded;
+	UASSERT(decoder.decode(ris, id, decoded));
+
+	// Too far from the keyframe for a delta, the old deltas are stale
+	reliable.clear();
+	encoder.encode(3, make_position(v3f(100, 0, 0), v3f(0, 0, 0), 0),
+		false, reliable, unreliable);
+	ObjectPosition far = make_position(v3f(1000 * BS, 0, 0), v3f(0, 0, 0), 0);
+	encoder.encode(3, far, false, reliable, unreliable);
+	UASSERT(!reliable.empty());
+
+	std::istringstream ris2(reliable, std::ios::binary);
+	UASSERT(decoder.decode(ris2, id, decoded));
+	UASSERT(decoded == far);
+	std::istringstream uis(unreliable, std::ios::binary);
+	UASSERT(!decoder.decode(uis, id, decoded));
+}
@@ -20,6 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "gamedef.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
 #include "voxelalgorithms.h"
 
 class TestVoxelAlgorithms : public TestBase {
@@ -31,6 +34,8 @@ class TestVoxelAlgorithms : public TestBase {
 
 	void testPropogateSunlight(INodeDefManager *ndef);
 	void testClearLightAndCollectSources(INodeDefManager *ndef);
+	void testUpdateLightingBlocks(IGameDef *gamedef);
+	void testBulkEditLighting(IGameDef *gamedef);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -41,8 +46,63 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 
 	TEST(testPropogateSunlight, ndef);
 	TEST(testClearLightAndCollectSources, ndef);
+	TEST(testUpdateLightingBlocks, gamedef);
+	TEST(testBulkEditLighting, gamedef);
 }
 
+/*
+	A map holding only the blocks created by the tests
+*/
+class TestLightingMap : public Map {
+public:
+	TestLightingMap(IGameDef *gamedef) :
+		Map(dstream, gamedef)
+	{}
+
+	// Creates a block filled with the given content, without light
+	void createBlock(v3s16 blockpos, content_t c)
+	{
+		v2s16 p2d(blockpos.X, blockpos.Z);
+		MapSector *sector = getSectorNoGenerateNoEx(p2d);
+		if (sector == NULL) {
+			sector = new ServerMapSector(this, p2d, m_gamedef);
+			m_sectors[p2d] = sector;
+		}
+		MapBlock *block = sector->createBlankBlock(blockpos.Y);
+
+		MapNode n(c);
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++)
+			block->setNodeNoCheck(p, n);
+	}
+
+	void setContent(v3s16 p, content_t c)
+	{
+		MapNode n(c);
+		setNode(p, n);
+	}
+
+	// Relights the blocks from blockpos1 to blockpos2
+	void relight(v3s16 blockpos1, v3s16 blockpos2)
+	{
+		std::map<v3s16, MapBlock*> blocks;
+		std::map<v3s16, MapBlock*> modified_blocks;
+		v3s16 p;
+		for (p.Z = blockpos1.Z; p.Z <= blockpos2.Z; p.Z++)
+		for (p.Y = blockpos1.Y; p.Y <= blockpos2.Y; p.Y++)
+		for (p.X = blockpos1.X; p.X <= blockpos2.X; p.X++)
+			blocks[p] = getBlockNoCreate(p);
+		updateLighting(blocks, modified_blocks);
+	}
+
+	u8 getLight(v3s16 p, LightBank bank)
+	{
+		return getNodeNoEx(p).getLight(bank, m_gamedef->ndef());
+	}
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void TestVoxelAlgorithms::testPropogateSunlight(INodeDefManager *ndef)
@@ -202,3 +262,181 @@ void TestVoxelAlgorithms::testClearLightAndCollectSources(INodeDefManager *ndef)
 		UASSERT(unlight_from.size() == 1);
 	}
 }
+
+void TestVoxelAlgorithms::testUpdateLightingBlocks(IGameDef *gamedef)
+{
+	// Sunlit column of two air blocks, with a single node roof
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), CONTENT_AIR);
+		map.createBlock(v3s16(0, -1, 0), CONTENT_AIR);
+		map.setContent(v3s16(5, 10, 5), t_CONTENT_STONE);
+		map.relight(v3s16(0, -1, 0), v3s16(0, 0, 0));
+
+		UASSERTEQ(int, map.getLight(v3s16(6, 9, 5), LIGHTBANK_DAY), LIGHT_SUN);
+		UASSERTEQ(int, map.getLight(v3s16(5, -16, 6), LIGHTBANK_DAY),
+			LIGHT_SUN);
+		// Below the roof, sunlight comes only from the sides
+		UASSERTEQ(int, map.getLight(v3s16(5, 9, 5), LIGHTBANK_DAY),
+			LIGHT_SUN - 1);
+		UASSERTEQ(int, map.getLight(v3s16(5, -16, 5), LIGHTBANK_DAY),
+			LIGHT_SUN - 1);
+		UASSERTEQ(int, map.getLight(v3s16(5, 10, 5), LIGHTBANK_DAY), 0);
+		UASSERTEQ(int, map.getLight(v3s16(5, 9, 5), LIGHTBANK_NIGHT), 0);
+	}
+
+	// Enclosed room lit by a torch
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), t_CONTENT_STONE);
+		for (s16 z = 5; z <= 9; z++)
+		for (s16 y = 5; y <= 9; y++)
+		for (s16 x = 5; x <= 9; x++)
+			map.setContent(v3s16(x, y, z), CONTENT_AIR);
+		map.setContent(v3s16(7, 7, 7), t_CONTENT_TORCH);
+		map.relight(v3s16(0, 0, 0), v3s16(0, 0, 0));
+
+		const LightBank banks[] = { LIGHTBANK_DAY, LIGHTBANK_NIGHT };
+		for (int i = 0; i < 2; i++) {
+			LightBank bank = banks[i];
+			UASSERTEQ(int, map.getLight(v3s16(7, 7, 7), bank), LIGHT_MAX - 1);
+			UASSERTEQ(int, map.getLight(v3s16(8, 7, 7), bank), LIGHT_MAX - 2);
+			UASSERTEQ(int, map.getLight(v3s16(9, 9, 9), bank), LIGHT_MAX - 7);
+			UASSERTEQ(int, map.getLight(v3s16(10, 7, 7), bank), 0);
+			UASSERTEQ(int, map.getLight(v3s16(11, 7, 7), bank), 0);
+		}
+	}
+
+	// Covering the top block invalidates the sunlight of the block below
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), CONTENT_AIR);
+		map.createBlock(v3s16(0, -1, 0), CONTENT_AIR);
+		map.relight(v3s16(0, -1, 0), v3s16(0, 0, 0));
+		UASSERTEQ(int, map.getLight(v3s16(3, -8, 3), LIGHTBANK_DAY), LIGHT_SUN);
+
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+			map.setContent(v3s16(x, MAP_BLOCKSIZE - 1, z), t_CONTENT_STONE);
+		// Only the top block is updated, the one below follows
+		map.relight(v3s16(0, 0, 0), v3s16(0, 0, 0));
+
+		UASSERTEQ(int, map.getLight(v3s16(3, 8, 3), LIGHTBANK_DAY), 0);
+		UASSERTEQ(int, map.getLight(v3s16(3, -8, 3), LIGHTBANK_DAY), 0);
+		UASSERTEQ(int, map.getLight(v3s16(3, -16, 3), LIGHTBANK_DAY), 0);
+	}
+
+	// Light from a neighbouring block enters a node opened at the border
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), t_CONTENT_STONE);
+		map.createBlock(v3s16(1, 0, 0), t_CONTENT_STONE);
+		for (s16 x = 16; x < 20; x++)
+			map.setContent(v3s16(x, 8, 8), CONTENT_AIR);
+		map.setContent(v3s16(20, 8, 8), t_CONTENT_TORCH);
+		map.relight(v3s16(0, 0, 0), v3s16(1, 0, 0));
+		UASSERTEQ(int, map.getLight(v3s16(16, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 5);
+
+		map.setContent(v3s16(15, 8, 8), CONTENT_AIR);
+		map.relight(v3s16(0, 0, 0), v3s16(0, 0, 0));
+
+		UASSERTEQ(int, map.getLight(v3s16(15, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 6);
+		UASSERTEQ(int, map.getLight(v3s16(16, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 5);
+	}
+}
+
+void TestVoxelAlgorithms::testBulkEditLighting(IGameDef *gamedef)
+{
+	std::map<v3s16, MapBlock*> modified_blocks;
+
+	// Torch on a block border lighting a corridor in the next block
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), t_CONTENT_STONE);
+		map.createBlock(v3s16(1, 0, 0), t_CONTENT_STONE);
+		for (s16 x = 12; x < 20; x++)
+			map.setContent(v3s16(x, 8, 8), CONTENT_AIR);
+		map.setContent(v3s16(15, 8, 8), t_CONTENT_TORCH);
+		map.relight(v3s16(0, 0, 0), v3s16(1, 0, 0));
+		UASSERTEQ(int, map.getLight(v3s16(16, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 2);
+
+		{
+			MapBulkEdit bulk_edit(&map);
+			map.removeNodeAndUpdate(v3s16(15, 8, 8), modified_blocks);
+			map.removeNodeAndUpdate(v3s16(20, 8, 8), modified_blocks);
+			UASSERT(map.isBulkEditing());
+		}
+		UASSERT(!map.isBulkEditing());
+
+		const LightBank banks[] = { LIGHTBANK_DAY, LIGHTBANK_NIGHT };
+		for (int i = 0; i < 2; i++) {
+			LightBank bank = banks[i];
+			UASSERTEQ(int, map.getLight(v3s16(14, 8, 8), bank), 0);
+			UASSERTEQ(int, map.getLight(v3s16(15, 8, 8), bank), 0);
+			UASSERTEQ(int, map.getLight(v3s16(16, 8, 8), bank), 0);
+			UASSERTEQ(int, map.getLight(v3s16(20, 8, 8), bank), 0);
+		}
+	}
+
+	// Moving the torch, and a torch that is placed and removed again
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), t_CONTENT_STONE);
+		map.createBlock(v3s16(1, 0, 0), t_CONTENT_STONE);
+		for (s16 x = 12; x < 20; x++)
+			map.setContent(v3s16(x, 8, 8), CONTENT_AIR);
+		map.setContent(v3s16(15, 8, 8), t_CONTENT_TORCH);
+		map.relight(v3s16(0, 0, 0), v3s16(1, 0, 0));
+
+		{
+			MapBulkEdit bulk_edit(&map);
+			map.addNodeAndUpdate(v3s16(19, 8, 8), MapNode(t_CONTENT_TORCH),
+				modified_blocks);
+			map.removeNodeAndUpdate(v3s16(15, 8, 8), modified_blocks);
+			{
+				// Nested bulk edits are updated by the outermost one
+				MapBulkEdit inner_bulk_edit(&map);
+				map.addNodeAndUpdate(v3s16(12, 8, 8),
+					MapNode(t_CONTENT_TORCH), modified_blocks);
+			}
+			map.removeNodeAndUpdate(v3s16(12, 8, 8), modified_blocks);
+		}
+
+		UASSERTEQ(int, map.getLight(v3s16(19, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 1);
+		UASSERTEQ(int, map.getLight(v3s16(15, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 5);
+		UASSERTEQ(int, map.getLight(v3s16(13, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 7);
+		UASSERTEQ(int, map.getLight(v3s16(12, 8, 8), LIGHTBANK_NIGHT),
+			LIGHT_MAX - 8);
+	}
+
+	// Sunlight under nodes placed above each other in one bulk edit
+	{
+		TestLightingMap map(gamedef);
+		map.createBlock(v3s16(0, 0, 0), CONTENT_AIR);
+		map.relight(v3s16(0, 0, 0), v3s16(0, 0, 0));
+
+		{
+			MapBulkEdit bulk_edit(&map);
+			map.addNodeAndUpdate(v3s16(5, 10, 5), MapNode(t_CONTENT_STONE),
+				modified_blocks);
+			map.addNodeAndUpdate(v3s16(5, 12, 5), MapNode(t_CONTENT_STONE),
+				modified_blocks);
+			map.removeNodeAndUpdate(v3s16(5, 10, 5), modified_blocks);
+		}
+
+		UASSERTEQ(int, map.getLight(v3s16(5, 12, 5), LIGHTBANK_DAY), 0);
+		UASSERTEQ(int, map.getLight(v3s16(5, 10, 5), LIGHTBANK_DAY),
+			LIGHT_SUN - 1);
+		UASSERTEQ(int, map.getLight(v3s16(5, 0, 5), LIGHTBANK_DAY),
+			LIGHT_SUN - 1);
+		UASSERTEQ(int, map.getLight(v3s16(6, 0, 5), LIGHTBANK_DAY),
+			LIGHT_SUN);
+	}
+}
@@ -0,0 +1,200 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "lz4.h"
+#include <cstring>
+
+/*
+	Block format, see lz4_Block_format.md of the reference implementation:
+	a block is a list of sequences, each made of a token byte, the literal
+	length, the literals, a 2 byte little endian match offset and the match
+	length. The last sequence only has literals.
+*/
+
+#define MIN_MATCH 4
+// The last match has to start this many bytes before the end
+#define MF_LIMIT 12
+// The last bytes of a block are always literals
+#define LAST_LITERALS 5
+#define MAX_DISTANCE 65535
+#define HASH_BITS 12
+
+static inline u32 read32(const u8 *p)
+{
+	u32 v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline u32 hash4(u32 v)
+{
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static inline u8 *write_length(u8 *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (u8)len;
+	return op;
+}
+
+static inline bool read_length(const u8 **ip, const u8 *iend, size_t *len)
+{
+	u8 b;
+	do {
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+		// Longer than any real block, don't let it wrap around
+		if (*len > ((size_t)-1) / 2)
+			return false;
+	} while (b == 255);
+	return true;
+}
+
+static inline u8 *write_sequence(u8 *op, const u8 *literals, size_t lit_len)
+{
+	u8 *token = op++;
+	*token = (lit_len >= 15 ? 15 : lit_len) << 4;
+	if (lit_len >= 15)
+		op = write_length(op, lit_len - 15);
+	if (lit_len > 0)
+		memcpy(op, literals, lit_len);
+	return op + lit_len;
+}
+
+size_t lz4_compress_bound(size_t src_size)
+{
+	return src_size + src_size / 255 + 16;
+}
+
+size_t lz4_compress(const u8 *src, size_t src_size, u8 *dst)
+{
+	const u8 *ip = src;
+	const u8 *anchor = src;
+	const u8 *end = src + src_size;
+	u8 *op = dst;
+
+	if (src_size > MF_LIMIT) {
+		// Positions of the last occurrence of every hashed 4 byte sequence
+		u32 table[1 << HASH_BITS];
+		memset(table, 0, sizeof(table));
+
+		const u8 *match_limit = end - MF_LIMIT;
+		const u8 *match_end_limit = end - LAST_LITERALS;
+
+		while (ip <= match_limit) {
+			u32 seq = read32(ip);
+			u32 h = hash4(seq);
+			const u8 *ref = src + table[h];
+			table[h] = ip - src;
+
+			if (ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != seq) {
+				// Skip faster through data that doesn't compress
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+
+			const u8 *mp = ip + MIN_MATCH;
+			const u8 *rp = ref + MIN_MATCH;
+			while (mp < match_end_limit && *mp == *rp) {
+				mp++;
+				rp++;
+			}
+
+			size_t match_len = mp - ip - MIN_MATCH;
+			u8 *token = op;
+			op = write_sequence(op, anchor, ip - anchor);
+			*token |= match_len >= 15 ? 15 : match_len;
+			u16 offset = ip - ref;
+			*op++ = offset & 0xFF;
+			*op++ = offset >> 8;
+			if (match_len >= 15)
+				op = write_length(op, match_len - 15);
+
+			ip = mp;
+			anchor = ip;
+			table[hash4(read32(ip - 2))] = ip - 2 - src;
+		}
+	}
+
+	op = write_sequence(op, anchor, end - anchor);
+	return op - dst;
+}
+
+bool lz4_decompress(const u8 *src, size_t src_size, u8 *dst, size_t dst_size)
+{
+	const u8 *ip = src;
+	const u8 *iend = src + src_size;
+	u8 *op = dst;
+	u8 *oend = dst + dst_size;
+
+	for (;;) {
+		if (ip >= iend)
+			return false;
+		u8 token = *ip++;
+
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && !read_length(&ip, iend, &lit_len))
+			return false;
+		if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len)
+			return false;
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		// The last sequence has no match
+		if (ip == iend)
+			return op == oend;
+
+		if (iend - ip < 2)
+			return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return false;
+
+		size_t match_len = token & 15;
+		if (match_len == 15 && !read_length(&ip, iend, &match_len))
+			return false;
+		match_len += MIN_MATCH;
+		if ((size_t)(oend - op) < match_len)
+			return false;
+
+		const u8 *ref = op - offset;
+		if (offset >= match_len) {
+			memcpy(op, ref, match_len);
+			op += match_len;
+		} else {
+			// Overlapping match, repeats the last offset bytes
+			for (size_t i = 0; i < match_len; i++)
+				*op++ = *ref++;
+		}
+	}
+}
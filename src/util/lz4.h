@@ -0,0 +1,44 @@
+/*
+Minetest
+Copyright (C) 2016 celeron55, Perttu Ahola <celeron55@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef UTIL_LZ4_HEADER
+#define UTIL_LZ4_HEADER
+
+#include "../irrlichttypes.h"
+#include <cstddef>
+
+/*
+	A small compressor for the LZ4 block format. It trades compression
+	ratio for speed; decompression in particular is much faster than zlib.
+
+	Only raw blocks are handled, the caller has to store the sizes.
+*/
+
+// Largest size lz4_compress() can produce from src_size bytes
+size_t lz4_compress_bound(size_t src_size);
+
+// Compresses src into dst, which has to hold lz4_compress_bound(src_size)
+// bytes. Returns the compressed size.
+size_t lz4_compress(const u8 *src, size_t src_size, u8 *dst);
+
+// Decompresses src into dst. Returns false if src is malformed or doesn't
+// decompress to exactly dst_size bytes.
+bool lz4_decompress(const u8 *src, size_t src_size, u8 *dst, size_t dst_size);
+
+#endif
@@ -529,7 +529,7 @@ class VoxelManipulator /*: public NodeContainer*/
 		Copy data and set flags to 0
 		dst_area.getExtent() <= src_area.getExtent()
 	*/
-	void copyFrom(MapNode *src, const VoxelArea& src_area,
+	void copyFrom(const MapNode *src, const VoxelArea& src_area,
 			v3s16 from_pos, v3s16 to_pos, v3s16 size);
 
 	// Copy data
@@ -582,170 +582,314 @@ bool is_sunlight_above(Map *map, v3s16 pos, INodeDefManager *ndef)
 	return sunlight;
 }
 
+/*!
+ * Sets the light of the nodes in the queue to the level they were pushed
+ * with, which spread_light() expects.
+ * If a node is in the queue multiple times, the brightest one counts.
+ */
+static void init_relight_queue(INodeDefManager *ndef, LightBank bank,
+	ReLightQueue &light_sources)
+{
+	bool is_valid_position;
+	for (u8 i = 0; i <= LIGHT_SUN; i++) {
+		const std::vector<ChangingLight> &lights = light_sources.lights[i];
+		for (std::vector<ChangingLight>::const_iterator it = lights.begin();
+				it < lights.end(); it++) {
+			MapNode n = it->block->getNodeNoCheck(it->rel_position,
+				&is_valid_position);
+			n.setLight(bank, i, ndef);
+			it->block->setNodeNoCheck(it->rel_position, n);
+		}
+	}
+}
+
 static const LightBank banks[] = { LIGHTBANK_DAY, LIGHTBANK_NIGHT };
 
+/*!
+ * Returns true if the light of a changed node has to be removed,
+ * because the new node can't provide as much light as the old one.
+ */
+static bool loses_light(LightBank bank, u8 old_light,
+	const ContentFeatures &old_f, const ContentFeatures &f)
+{
+	if (old_light == 0)
+		return false;
+	if (old_f.light_propagates && !f.light_propagates)
+		return true;
+	if (f.light_source < old_f.light_source)
+		return true;
+	return bank == LIGHTBANK_DAY && old_light == LIGHT_SUN
+		&& !f.sunlight_propagates;
+}
+
 void update_lighting_nodes(Map *map, INodeDefManager *ndef,
-	std::vector<std::pair<v3s16, MapNode> > &oldnodes,
+	std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
 	std::map<v3s16, MapBlock*> &modified_blocks)
 {
 	// For node getter functions
 	bool is_valid_position;
+	// Position and block of the current changed node
+	relative_v3 rel_pos;
+	mapblock_v3 block_pos;
+
+	// If a node was changed more than once, only its first old node
+	// tells which light it had
+	std::vector<std::pair<v3s16, MapNode> > oldnodes;
+	oldnodes.reserve(changed_nodes.size());
+	std::set<v3s16> seen;
+	for (std::vector<std::pair<v3s16, MapNode> >::iterator it =
+			changed_nodes.begin(); it < changed_nodes.end(); ++it) {
+		if (seen.insert(it->first).second)
+			oldnodes.push_back(*it);
+	}
 
 	// Process each light bank separately
 	for (s32 i = 0; i < 2; i++) {
 		LightBank bank = banks[i];
 		UnlightQueue disappearing_lights(256);
 		ReLightQueue light_sources(256);
-		// For each changed node process sunlight and initialize
+
+		// The nodes are processed in passes, so that the result doesn't
+		// depend on their order. First the nodes which don't lose light
+		// get back the light they had.
 		for (std::vector<std::pair<v3s16, MapNode> >::iterator it =
 				oldnodes.begin(); it < oldnodes.end(); ++it) {
-			// Get position and block of the changed node
-			v3s16 p = it->first;
-			relative_v3 rel_pos;
-			mapblock_v3 block_pos;
-			getNodeBlockPosWithOffset(p, block_pos, rel_pos);
+			getNodeBlockPosWithOffset(it->first, block_pos, rel_pos);
 			MapBlock *block = map->getBlockNoCreateNoEx(block_pos);
 			if (block == NULL || block->isDummy()) {
 				continue;
 			}
-			// Get the new node
+			modified_blocks[block_pos] = block;
+
 			MapNode n = block->getNodeNoCheck(rel_pos, &is_valid_position);
-			if (!is_valid_position) {
-				break;
+			const ContentFeatures &f = ndef->get(n);
+			const ContentFeatures &old_f = ndef->get(it->second);
+			u8 old_light = it->second.getLight(bank, ndef);
+			if (loses_light(bank, old_light, old_f, f)) {
+				continue;
+			}
+
+			u8 light = 0;
+			if (f.light_propagates) {
+				if (old_f.light_propagates) {
+					light = it->second.getLightRaw(bank, old_f);
+				} else {
+					// The node may get light from its neighbors now
+					disappearing_lights.push(0, rel_pos, block_pos, block, 6);
+				}
+				n.setLight(bank, light, f);
+				block->setNodeNoCheck(rel_pos, n);
+			}
+			if (f.light_source > light) {
+				light_sources.push(f.light_source, rel_pos, block_pos, block,
+					6);
 			}
+		}
 
-			// Light of the old node
+		// Then the light of the other nodes is removed
+		for (std::vector<std::pair<v3s16, MapNode> >::iterator it =
+				oldnodes.begin(); it < oldnodes.end(); ++it) {
+			getNodeBlockPosWithOffset(it->first, block_pos, rel_pos);
+			MapBlock *block = map->getBlockNoCreateNoEx(block_pos);
+			if (block == NULL || block->isDummy()) {
+				continue;
+			}
+
+			MapNode n = block->getNodeNoCheck(rel_pos, &is_valid_position);
+			const ContentFeatures &f = ndef->get(n);
+			const ContentFeatures &old_f = ndef->get(it->second);
 			u8 old_light = it->second.getLight(bank, ndef);
+			if (!loses_light(bank, old_light, old_f, f)) {
+				continue;
+			}
 
-			// Add the block of the added node to modified_blocks
-			modified_blocks[block_pos] = block;
+			// Add to unlight queue
+			n.setLight(bank, 0, f);
+			block->setNodeNoCheck(rel_pos, n);
+			disappearing_lights.push(old_light, rel_pos, block_pos, block, 6);
+			if (f.light_source > 0) {
+				light_sources.push(f.light_source, rel_pos, block_pos, block,
+					6);
+			}
 
-			// Get new light level of the node
-			u8 new_light = 0;
-			if (ndef->get(n).light_propagates) {
-				if (bank == LIGHTBANK_DAY && ndef->get(n).sunlight_propagates
-					&& is_sunlight_above(map, p, ndef)) {
-					new_light = LIGHT_SUN;
-				} else {
-					new_light = ndef->get(n).light_source;
-					for (int i = 0; i < 6; i++) {
-						v3s16 p2 = p + neighbor_dirs[i];
-						bool is_valid;
-						MapNode n2 = map->getNodeNoEx(p2, &is_valid);
-						if (is_valid) {
-							u8 spread = n2.getLight(bank, ndef);
-							// If the neighbor is at least as bright as
-							// this node then its light is not from
-							// this node.
-							// Its light can spread to this node.
-							if (spread > new_light && spread >= old_light) {
-								new_light = spread - 1;
-							}
-						}
+			// Remove sunlight, if there was any
+			if (bank == LIGHTBANK_DAY && old_light == LIGHT_SUN) {
+				for (s16 y = it->first.Y - 1;; y--) {
+					v3s16 n2pos(it->first.X, y, it->first.Z);
+
+					MapNode n2;
+
+					n2 = map->getNodeNoEx(n2pos, &is_valid_position);
+					if (!is_valid_position)
+						break;
+
+					// If this node doesn't have sunlight, the nodes below
+					// it don't have too.
+					if (n2.getLight(LIGHTBANK_DAY, ndef) != LIGHT_SUN) {
+						break;
 					}
+					// Remove sunlight and add to unlight queue.
+					n2.setLight(LIGHTBANK_DAY, 0, ndef);
+					map->setNode(n2pos, n2);
+					relative_v3 rel_pos2;
+					mapblock_v3 block_pos2;
+					getNodeBlockPosWithOffset(n2pos, block_pos2, rel_pos2);
+					MapBlock *block2 = map->getBlockNoCreateNoEx(
+						block_pos2);
+					disappearing_lights.push(LIGHT_SUN, rel_pos2,
+						block_pos2, block2,
+						4 /* The node above caused the change */);
 				}
-			} else {
-				// If this is an opaque node, it still can emit light.
-				new_light = ndef->get(n).light_source;
 			}
+		}
 
-			if (new_light > 0) {
-				light_sources.push(new_light, rel_pos, block_pos, block, 6);
+		// Finally sunlight is added where it is missing, now that all
+		// sunlight that disappeared has been removed
+		for (std::vector<std::pair<v3s16, MapNode> >::iterator it =
+				oldnodes.begin();
+				bank == LIGHTBANK_DAY && it < oldnodes.end(); ++it) {
+			getNodeBlockPosWithOffset(it->first, block_pos, rel_pos);
+			MapBlock *block = map->getBlockNoCreateNoEx(block_pos);
+			if (block == NULL || block->isDummy()) {
+				continue;
 			}
 
-			if (new_light < old_light) {
-				// The node became opaque or doesn't provide as much
-				// light as the previous one, so it must be unlighted.
+			MapNode n = block->getNodeNoCheck(rel_pos, &is_valid_position);
+			const ContentFeatures &f = ndef->get(n);
+			if (!f.light_propagates || !f.sunlight_propagates
+					|| n.getLightRaw(LIGHTBANK_DAY, f) == LIGHT_SUN
+					|| !is_sunlight_above(map, it->first, ndef)) {
+				continue;
+			}
 
-				// Add to unlight queue
-				n.setLight(bank, 0, ndef);
-				block->setNodeNoCheck(rel_pos, n);
-				disappearing_lights.push(old_light, rel_pos, block_pos, block,
-					6);
+			light_sources.push(LIGHT_SUN, rel_pos, block_pos, block, 6);
+			// Propagate sunlight
+			for (s16 y = it->first.Y - 1;; y--) {
+				v3s16 n2pos(it->first.X, y, it->first.Z);
 
-				// Remove sunlight, if there was any
-				if (bank == LIGHTBANK_DAY && old_light == LIGHT_SUN) {
-					for (s16 y = p.Y - 1;; y--) {
-						v3s16 n2pos(p.X, y, p.Z);
-
-						MapNode n2;
-
-						n2 = map->getNodeNoEx(n2pos, &is_valid_position);
-						if (!is_valid_position)
-							break;
-
-						// If this node doesn't have sunlight, the nodes below
-						// it don't have too.
-						if (n2.getLight(LIGHTBANK_DAY, ndef) != LIGHT_SUN) {
-							break;
-						}
-						// Remove sunlight and add to unlight queue.
-						n2.setLight(LIGHTBANK_DAY, 0, ndef);
-						map->setNode(n2pos, n2);
-						relative_v3 rel_pos2;
-						mapblock_v3 block_pos2;
-						getNodeBlockPosWithOffset(n2pos, block_pos2, rel_pos2);
-						MapBlock *block2 = map->getBlockNoCreateNoEx(
-							block_pos2);
-						disappearing_lights.push(LIGHT_SUN, rel_pos2,
-							block_pos2, block2,
-							4 /* The node above caused the change */);
-					}
+				MapNode n2;
+
+				n2 = map->getNodeNoEx(n2pos, &is_valid_position);
+				if (!is_valid_position)
+					break;
+
+				// This should not happen, but if the node has sunlight
+				// then the iteration should stop.
+				if (n2.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN) {
+					break;
 				}
-			} else if (new_light > old_light) {
-				// It is sure that the node provides more light than the previous
-				// one, unlighting is not necessary.
-				// Propagate sunlight
-				if (bank == LIGHTBANK_DAY && new_light == LIGHT_SUN) {
-					for (s16 y = p.Y - 1;; y--) {
-						v3s16 n2pos(p.X, y, p.Z);
-
-						MapNode n2;
-
-						n2 = map->getNodeNoEx(n2pos, &is_valid_position);
-						if (!is_valid_position)
-							break;
-
-						// This should not happen, but if the node has sunlight
-						// then the iteration should stop.
-						if (n2.getLight(LIGHTBANK_DAY, ndef) == LIGHT_SUN) {
-							break;
-						}
-						// If the node terminates sunlight, stop.
-						if (!ndef->get(n2).sunlight_propagates) {
-							break;
-						}
-						relative_v3 rel_pos2;
-						mapblock_v3 block_pos2;
-						getNodeBlockPosWithOffset(n2pos, block_pos2, rel_pos2);
-						MapBlock *block2 = map->getBlockNoCreateNoEx(
-							block_pos2);
-						// Mark node for lighting.
-						light_sources.push(LIGHT_SUN, rel_pos2, block_pos2,
-							block2, 4);
-					}
+				// If the node terminates sunlight, stop.
+				if (!ndef->get(n2).sunlight_propagates) {
+					break;
 				}
+				relative_v3 rel_pos2;
+				mapblock_v3 block_pos2;
+				getNodeBlockPosWithOffset(n2pos, block_pos2, rel_pos2);
+				MapBlock *block2 = map->getBlockNoCreateNoEx(
+					block_pos2);
+				// Mark node for lighting.
+				light_sources.push(LIGHT_SUN, rel_pos2, block_pos2,
+					block2, 4);
 			}
-
 		}
+
 		// Remove lights
 		unspread_light(map, ndef, bank, disappearing_lights, light_sources,
 			modified_blocks);
 		// Initialize light values for light spreading.
-		for (u8 i = 0; i <= LIGHT_SUN; i++) {
-			const std::vector<ChangingLight> &lights = light_sources.lights[i];
-			for (std::vector<ChangingLight>::const_iterator it = lights.begin();
-					it < lights.end(); it++) {
-				MapNode n = it->block->getNodeNoCheck(it->rel_position,
-					&is_valid_position);
-				n.setLight(bank, i, ndef);
-				it->block->setNodeNoCheck(it->rel_position, n);
-			}
-		}
+		init_relight_queue(ndef, bank, light_sources);
 		// Spread lights.
 		spread_light(map, ndef, bank, light_sources, modified_blocks);
 	}
 }
 
+void update_lighting_blocks(Map *map, INodeDefManager *ndef, LightBank bank,
+	std::map<v3s16, MapBlock*> &a_blocks,
+	std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	assert(bank == LIGHTBANK_DAY || bank == LIGHTBANK_NIGHT);
+
+	bool is_valid_position;
+	UnlightQueue unlight_from(256);
+	ReLightQueue light_sources(256);
+	// Sunlit nodes, filled by MapBlock::propagateSunlight()
+	std::set<v3s16> sunlit_nodes;
+
+	for (std::map<v3s16, MapBlock*>::iterator it = a_blocks.begin();
+			it != a_blocks.end(); ++it) {
+		MapBlock *block = it->second;
+
+		for (;;) {
+			if (block->isDummy())
+				break;
+
+			mapblock_v3 block_pos = block->getPos();
+			modified_blocks[block_pos] = block;
+
+			// Clear all light from the block
+			relative_v3 rel_pos;
+			for (rel_pos.Z = 0; rel_pos.Z < MAP_BLOCKSIZE; rel_pos.Z++)
+			for (rel_pos.X = 0; rel_pos.X < MAP_BLOCKSIZE; rel_pos.X++)
+			for (rel_pos.Y = 0; rel_pos.Y < MAP_BLOCKSIZE; rel_pos.Y++) {
+				MapNode n = block->getNodeNoCheck(rel_pos, &is_valid_position);
+				const ContentFeatures &f = ndef->get(n);
+				u8 old_light = n.getLight(bank, ndef);
+				n.setLight(bank, 0, f);
+				block->setNodeNoCheck(rel_pos, n);
+
+				if (f.light_source != 0) {
+					light_sources.push(f.light_source, rel_pos, block_pos,
+						block, 6);
+				}
+
+				// Light leaving the block has to be removed around it,
+				// and light from around it may enter the changed nodes
+				bool at_border = rel_pos.X == 0 ||
+					rel_pos.X == MAP_BLOCKSIZE - 1 ||
+					rel_pos.Y == 0 || rel_pos.Y == MAP_BLOCKSIZE - 1 ||
+					rel_pos.Z == 0 || rel_pos.Z == MAP_BLOCKSIZE - 1;
+				if (at_border && (old_light != 0 || f.light_propagates)) {
+					unlight_from.push(old_light, rel_pos, block_pos, block,
+						6);
+				}
+			}
+
+			// For night lighting, sunlight is not propagated
+			if (bank == LIGHTBANK_NIGHT || block->propagateSunlight(sunlit_nodes))
+				break;
+
+			// Bottom sunlight is not valid; get the block and loop to it
+			block_pos.Y--;
+			block = map->getBlockNoCreateNoEx(block_pos);
+			if (block == NULL)
+				FATAL_ERROR("Invalid position");
+		}
+	}
+
+	// A block may have been updated more than once, only the final
+	// sunlight counts
+	mapblock_v3 block_pos;
+	relative_v3 rel_pos;
+	MapBlock *block = NULL;
+	for (std::set<v3s16>::const_iterator it = sunlit_nodes.begin();
+			it != sunlit_nodes.end(); ++it) {
+		mapblock_v3 pos;
+		getNodeBlockPosWithOffset(*it, pos, rel_pos);
+		if (block == NULL || pos != block_pos) {
+			block_pos = pos;
+			block = map->getBlockNoCreateNoEx(block_pos);
+		}
+		MapNode n = block->getNodeNoCheck(rel_pos, &is_valid_position);
+		u8 light = n.getLight(LIGHTBANK_DAY, ndef);
+		if (light > 1)
+			light_sources.push(light, rel_pos, block_pos, block, 6);
+	}
+
+	unspread_light(map, ndef, bank, unlight_from, light_sources,
+		modified_blocks);
+	init_relight_queue(ndef, bank, light_sources);
+	spread_light(map, ndef, bank, light_sources, modified_blocks);
+}
+
 } // namespace voxalgo
 
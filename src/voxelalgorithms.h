@@ -62,7 +62,10 @@ SunlightPropagateResult propagateSunlight(VoxelManipulator &v, VoxelArea a,
  * Before calling this procedure make sure that all new nodes on
  * the map have zero light level!
  *
- * \param oldnodes contains the MapNodes that were replaced by the new
+ * The changed nodes may be given in any order, and a node may be
+ * listed more than once, in which case its first old node is used.
+ *
+ * \param changed_nodes contains the MapNodes that were replaced by the new
  * MapNodes and their positions
  * \param modified_blocks output, contains all map blocks that
  * the function modified
@@ -70,7 +73,27 @@ SunlightPropagateResult propagateSunlight(VoxelManipulator &v, VoxelArea a,
 void update_lighting_nodes(
 	Map *map,
 	INodeDefManager *ndef,
-	std::vector<std::pair<v3s16, MapNode> > &oldnodes,
+	std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+	std::map<v3s16, MapBlock*> &modified_blocks);
+
+/*!
+ * Recalculates the light of whole map blocks in one light bank.
+ * All light in the blocks is cleared and sunlight is propagated
+ * into them from above. Then the light of the nodes around them is
+ * removed if it came from the blocks, and the light sources and
+ * surrounding light are spread again.
+ * If the sunlight at the bottom of a block is not valid, the block below
+ * it is updated too.
+ *
+ * \param a_blocks the blocks to update
+ * \param modified_blocks output, contains all map blocks that
+ * the function modified
+ */
+void update_lighting_blocks(
+	Map *map,
+	INodeDefManager *ndef,
+	LightBank bank,
+	std::map<v3s16, MapBlock*> &a_blocks,
 	std::map<v3s16, MapBlock*> &modified_blocks);
 
 } // namespace voxalgo